@@ -4,7 +4,25 @@ in vec2 out_uv;
 uniform sampler2D texture;
 out vec4 frag_color;
 
+#ifdef EQUIRECTANGULAR
+/* the plane covers the eye, the equirectangular texture is sampled by the
+ * view direction of the fragment */
+const float PI = 3.1416;
+
+uniform mat4 vp;
+#endif
+
 void main()
 {
+#ifdef EQUIRECTANGULAR
+  vec2 frag_coord = vec2(out_uv) * 2 - 1;
+  vec4 view_dir = normalize(inverse(vp) * vec4(frag_coord, 1, 1));
+
+  float u = atan(view_dir.x, -view_dir.z) / (2 * PI) + 0.5;
+  float v = acos(-view_dir.y) / PI;
+
+  frag_color = texture2D (texture, vec2(u, v));
+#else
   frag_color = texture2D (texture, out_uv);
+#endif
 }
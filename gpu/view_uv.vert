@@ -0,0 +1,29 @@
+#version 330
+
+layout(std140) uniform ViewBlock {
+   mat4 view_projection[2];
+   int eye_count;
+};
+
+in vec3 position;
+in vec2 uv;
+in mat4 model;
+out vec2 out_uv;
+out vec3 out_pos;
+
+void main()
+{
+   int eye = gl_InstanceID % eye_count;
+   vec4 clip = view_projection[eye] * model * vec4(position, 1);
+   if (eye_count > 1) {
+      /* squash the eye into its half of the side by side target, the clip
+       * distance cuts what would spill into the other half */
+      gl_ClipDistance[0] = eye == 0 ? clip.w - clip.x : clip.w + clip.x;
+      clip.x = clip.x * 0.5 + (eye == 0 ? -0.5 : 0.5) * clip.w;
+   } else {
+      gl_ClipDistance[0] = 1.0;
+   }
+   gl_Position = clip;
+   out_uv = uv;
+   out_pos = position;
+}
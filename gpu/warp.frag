@@ -3,17 +3,37 @@
 #version 330
 precision highp float;
 
+/* Specializations, see gst_3d_shader_from_vert_frag_defines():
+ * KAPPA, SCALE, SCALE_IN: lens distortion of the device
+ * SCREEN_CENTER_LEFT, SCREEN_CENTER_RIGHT: lens centers in uv space
+ * NO_CLIP: skips the test for samples that leave the eye */
+
+#ifndef KAPPA
+#define KAPPA vec4(1.0, 0.22, 0.24, 0.0)
+#endif
+#ifndef SCALE
+#define SCALE vec2(0.1469278, 0.2350845)
+#endif
+#ifndef SCALE_IN
+#define SCALE_IN vec2(4, 2.5)
+#endif
+#ifndef SCREEN_CENTER_LEFT
+#define SCREEN_CENTER_LEFT vec2(0.25, 0.5)
+#endif
+#ifndef SCREEN_CENTER_RIGHT
+#define SCREEN_CENTER_RIGHT vec2(0.75, 0.5)
+#endif
+
 uniform sampler2D texture;
 uniform vec2 screen_size;
 
-const vec4 kappa = vec4(1.0, 0.22, 0.24, 0.0);
-// const vec4 kappa = vec4(1.0, 1.7, 0.7, 15.0);
+const vec4 kappa = KAPPA;
 
-const vec2 screen_center_left = vec2(0.25, 0.5);
-const vec2 screen_center_right = vec2(0.75, 0.5);
+const vec2 screen_center_left = SCREEN_CENTER_LEFT;
+const vec2 screen_center_right = SCREEN_CENTER_RIGHT;
 
-const vec2 scale = vec2(0.1469278, 0.2350845);
-const vec2 scale_in = vec2(4, 2.5);
+const vec2 scale = SCALE;
+const vec2 scale_in = SCALE_IN;
 
 in vec2 out_uv;
 out vec4 frag_color;
@@ -46,12 +66,14 @@ void main()
 	vec2 screen_center = out_uv.x < 0.5 ? screen_center_left : screen_center_right;
 	vec2 tc = hmd_warp(screen_center);
 
+#ifndef NO_CLIP
 	if (is_outside_area(tc, screen_center))
 	{
 	  // We are outside of the warped area
 		frag_color = vec4(0.0, 0.0, 0.0, 1.0);
 		return;
 	}
+#endif
 
   // double mono video for fake stereo
 	//tc.x = gl_FragCoord.x < center_x ? (2.0 * tc.x) : (2.0 * (tc.x - 0.5));
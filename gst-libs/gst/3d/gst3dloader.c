@@ -0,0 +1,501 @@
+/*
+ * GStreamer Plugins VR
+ * Copyright (C) 2016 Lubosz Sarnecki <lubosz.sarnecki@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define GST_USE_UNSTABLE_API
+#include <gst/gl/gl.h>
+#include <gst/gl/gstglfuncs.h>
+
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "gst3dloader.h"
+#include "gst3dmeshfile.h"
+#include "gst3dmeshoptimize.h"
+#include "gst3dmeshbatch.h"
+
+#define GST_CAT_DEFAULT gst_3d_loader_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+G_DEFINE_TYPE_WITH_CODE (Gst3DLoader, gst_3d_loader, GST_TYPE_OBJECT,
+    GST_DEBUG_CATEGORY_INIT (gst_3d_loader_debug, "3dloader", 0, "loader"));
+
+#define GST_3D_LOADER_IMPORT_FLAGS (aiProcess_Triangulate \
+    | aiProcess_JoinIdenticalVertices | aiProcess_GenSmoothNormals \
+    | aiProcess_SortByPType)
+
+typedef struct
+{
+  GLfloat position[3];
+  guint32 normal;
+  GLfloat uv[2];
+} Gst3DLoaderVertex;
+
+typedef struct
+{
+  Gst3DNode *node;
+  /* either parsed data or the index of a mesh in the baked mesh file */
+  Gst3DMeshData *data;
+  guint file_mesh;
+} Gst3DLoaderUpload;
+
+typedef struct
+{
+  gchar *file;
+  Gst3DShader *shader;
+  GAsyncQueue *results;
+
+  /* handed out to the caller, the model is attached to it when uploaded */
+  Gst3DNode *root;
+
+  /* built by the worker, not visible to the GL thread until uploaded */
+  Gst3DNode *tree;
+  GQueue uploads;
+  Gst3DMeshFile *mesh_file;
+} Gst3DLoaderJob;
+
+static void
+_job_free (Gst3DLoaderJob * job)
+{
+  Gst3DLoaderUpload *upload;
+
+  while ((upload = g_queue_pop_head (&job->uploads))) {
+    gst_3d_mesh_data_free (upload->data);
+    g_free (upload);
+  }
+
+  if (job->tree)
+    gst_object_unref (job->tree);
+  gst_3d_mesh_file_free (job->mesh_file);
+  gst_object_unref (job->root);
+  gst_object_unref (job->shader);
+  g_async_queue_unref (job->results);
+  g_free (job->file);
+  g_free (job);
+}
+
+/* @transform is baked into the vertices if not %NULL */
+static Gst3DMeshData *
+_convert_mesh (const struct aiScene *scene, const struct aiMesh *mesh,
+    const struct aiMatrix4x4 *transform)
+{
+  Gst3DVertexLayout layout;
+  GLenum draw_mode;
+  guint face_size;
+
+  /* SortByPType leaves one primitive type per mesh */
+  if (mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) {
+    draw_mode = GL_TRIANGLES;
+    face_size = 3;
+  } else if (mesh->mPrimitiveTypes & aiPrimitiveType_LINE) {
+    draw_mode = GL_LINES;
+    face_size = 2;
+  } else if (mesh->mPrimitiveTypes & aiPrimitiveType_POINT) {
+    draw_mode = GL_POINTS;
+    face_size = 1;
+  } else {
+    return NULL;
+  }
+
+  gst_3d_vertex_layout_init (&layout);
+  gst_3d_vertex_layout_add (&layout, "position", 3, GL_FLOAT, GL_FALSE);
+  gst_3d_vertex_layout_add (&layout, "normal", 4, GL_INT_2_10_10_10_REV,
+      GL_TRUE);
+  gst_3d_vertex_layout_add (&layout, "uv", 2, GL_FLOAT, GL_FALSE);
+  g_assert (layout.stride == sizeof (Gst3DLoaderVertex));
+
+  Gst3DMeshData *data = gst_3d_mesh_data_new (&layout, mesh->mNumVertices,
+      mesh->mNumFaces * face_size, draw_mode);
+
+  /* normals only get the rotation and scale applied, which is correct for
+   * the uniformly scaled transforms models use in practice */
+  struct aiMatrix3x3 normal_transform;
+  if (transform)
+    aiMatrix3FromMatrix4 (&normal_transform, transform);
+
+  Gst3DLoaderVertex *v = (Gst3DLoaderVertex *) data->vertices;
+  for (guint i = 0; i < mesh->mNumVertices; i++) {
+    struct aiVector3D position = mesh->mVertices[i];
+    if (transform)
+      aiTransformVecByMatrix4 (&position, transform);
+    v[i].position[0] = position.x;
+    v[i].position[1] = position.y;
+    v[i].position[2] = position.z;
+
+    if (mesh->mNormals) {
+      struct aiVector3D normal = mesh->mNormals[i];
+      if (transform)
+        aiTransformVecByMatrix3 (&normal, &normal_transform);
+      gfloat length = sqrtf (normal.x * normal.x + normal.y * normal.y +
+          normal.z * normal.z);
+      if (length > 0.f)
+        length = 1.f / length;
+      v[i].normal = gst_3d_vertex_pack_normal (normal.x * length,
+          normal.y * length, normal.z * length);
+    } else {
+      v[i].normal = gst_3d_vertex_pack_normal (0.f, 0.f, 1.f);
+    }
+
+    if (mesh->mTextureCoords[0]) {
+      v[i].uv[0] = mesh->mTextureCoords[0][i].x;
+      v[i].uv[1] = mesh->mTextureCoords[0][i].y;
+    } else {
+      v[i].uv[0] = v[i].uv[1] = 0.f;
+    }
+  }
+
+  guint32 *index = data->indices;
+  for (guint i = 0; i < mesh->mNumFaces; i++) {
+    const struct aiFace *face = &mesh->mFaces[i];
+    for (guint j = 0; j < face_size; j++)
+      *index++ = j < face->mNumIndices ? face->mIndices[j] : face->mIndices[0];
+  }
+
+  if (mesh->mMaterialIndex < scene->mNumMaterials) {
+    const struct aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+    struct aiColor4D color;
+    struct aiString path;
+
+    if (aiGetMaterialColor (material, AI_MATKEY_COLOR_DIFFUSE,
+            &color) == aiReturn_SUCCESS)
+      graphene_vec4_init (&data->diffuse_color, color.r, color.g, color.b,
+          color.a);
+
+    if (aiGetMaterialTexture (material, aiTextureType_DIFFUSE, 0, &path,
+            NULL, NULL, NULL, NULL, NULL, NULL) == aiReturn_SUCCESS)
+      data->diffuse_texture = g_strndup (path.data, path.length);
+  }
+
+  /* still on the loader thread, the GL thread only copies the result */
+  gst_3d_mesh_data_optimize (data, GST_3D_MESH_OPTIMIZE_OVERDRAW_THRESHOLD);
+
+  return data;
+}
+
+/* assimp matrices transform column vectors, graphene ones row vectors */
+static void
+_convert_transform (const struct aiMatrix4x4 *m, graphene_matrix_t * result)
+{
+  float v[16] = {
+    m->a1, m->b1, m->c1, m->d1,
+    m->a2, m->b2, m->c2, m->d2,
+    m->a3, m->b3, m->c3, m->d3,
+    m->a4, m->b4, m->c4, m->d4,
+  };
+  graphene_matrix_init_from_float (result, v);
+}
+
+/* Builds a node for @ai_node and its children. The meshes stay in the
+ * space of their node, the node gets its transform. */
+static Gst3DNode *
+_convert_node (Gst3DLoaderJob * job, const struct aiScene *scene,
+    const struct aiNode *ai_node)
+{
+  Gst3DNode *node = gst_3d_node_new (job->root->context);
+  graphene_matrix_t transform;
+
+  _convert_transform (&ai_node->mTransformation, &transform);
+  gst_3d_node_set_transform (node, &transform);
+  node->shader = job->shader;
+
+  GPtrArray *meshes = g_ptr_array_new ();
+  for (guint i = 0; i < ai_node->mNumMeshes; i++) {
+    Gst3DMeshData *data = _convert_mesh (scene,
+        scene->mMeshes[ai_node->mMeshes[i]], NULL);
+    if (data)
+      g_ptr_array_add (meshes, data);
+  }
+
+  /* parts of a node share its transform, so they can share buffers */
+  GPtrArray *batches = gst_3d_mesh_data_batch_all (meshes);
+  for (guint i = 0; i < batches->len; i++) {
+    Gst3DLoaderUpload *upload = g_new0 (Gst3DLoaderUpload, 1);
+    upload->node = node;
+    upload->data = g_ptr_array_index (batches, i);
+    g_queue_push_tail (&job->uploads, upload);
+  }
+  g_ptr_array_set_free_func (batches, NULL);
+  g_ptr_array_unref (batches);
+
+  for (guint i = 0; i < ai_node->mNumChildren; i++)
+    gst_3d_node_append_child (node, _convert_node (job, scene,
+            ai_node->mChildren[i]));
+
+  return node;
+}
+
+static void
+_collect_meshes (const struct aiScene *scene, const struct aiNode *ai_node,
+    const struct aiMatrix4x4 *parent_transform, GPtrArray * meshes)
+{
+  struct aiMatrix4x4 transform = *parent_transform;
+
+  aiMultiplyMatrix4 (&transform, &ai_node->mTransformation);
+
+  for (guint i = 0; i < ai_node->mNumMeshes; i++) {
+    Gst3DMeshData *data = _convert_mesh (scene,
+        scene->mMeshes[ai_node->mMeshes[i]], &transform);
+    if (data)
+      g_ptr_array_add (meshes, data);
+  }
+
+  for (guint i = 0; i < ai_node->mNumChildren; i++)
+    _collect_meshes (scene, ai_node->mChildren[i], &transform, meshes);
+}
+
+/**
+ * gst_3d_loader_import:
+ *
+ * Imports all meshes of @file synchronously with their node transforms
+ * applied, e.g. to bake them into a mesh file. Needs no GL context.
+ *
+ * Returns: (transfer full) (element-type Gst3DMeshData): the meshes, or
+ * %NULL on error
+ */
+GPtrArray *
+gst_3d_loader_import (const gchar * file, GError ** error)
+{
+  const struct aiScene *scene = aiImportFile (file,
+      GST_3D_LOADER_IMPORT_FLAGS);
+
+  if (!scene || !scene->mRootNode) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+        "Unable to import %s: %s", file, aiGetErrorString ());
+    if (scene)
+      aiReleaseImport (scene);
+    return NULL;
+  }
+
+  GPtrArray *meshes =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) gst_3d_mesh_data_free);
+  struct aiMatrix4x4 identity;
+  aiIdentityMatrix4 (&identity);
+  _collect_meshes (scene, scene->mRootNode, &identity, meshes);
+
+  aiReleaseImport (scene);
+
+  return meshes;
+}
+
+static void
+_load_mesh_file (Gst3DLoaderJob * job)
+{
+  GError *error = NULL;
+
+  job->mesh_file = gst_3d_mesh_file_open (job->file, &error);
+  if (!job->mesh_file) {
+    GST_WARNING ("Unable to open %s: %s", job->file, error->message);
+    g_clear_error (&error);
+    return;
+  }
+
+  /* baked meshes are already transformed, one node holds all of them */
+  job->tree = gst_3d_node_new (job->root->context);
+  job->tree->shader = job->shader;
+
+  for (guint i = 0; i < gst_3d_mesh_file_get_n_meshes (job->mesh_file); i++) {
+    Gst3DLoaderUpload *upload = g_new0 (Gst3DLoaderUpload, 1);
+    upload->node = job->tree;
+    upload->file_mesh = i;
+    g_queue_push_tail (&job->uploads, upload);
+  }
+}
+
+static void
+_load_func (gpointer data, gpointer user_data)
+{
+  Gst3DLoaderJob *job = data;
+  gint64 start = g_get_monotonic_time ();
+
+  if (gst_3d_mesh_file_is_mesh_file (job->file)) {
+    _load_mesh_file (job);
+    g_async_queue_push (job->results, job);
+    return;
+  }
+
+  const struct aiScene *scene = aiImportFile (job->file,
+      GST_3D_LOADER_IMPORT_FLAGS);
+
+  if (!scene || !scene->mRootNode) {
+    GST_WARNING ("Unable to import %s: %s", job->file, aiGetErrorString ());
+  } else {
+    job->tree = _convert_node (job, scene, scene->mRootNode);
+
+    GST_DEBUG ("parsed %s with %d meshes in %" G_GINT64_FORMAT " ms",
+        job->file, g_queue_get_length (&job->uploads),
+        (g_get_monotonic_time () - start) / 1000);
+  }
+
+  if (scene)
+    aiReleaseImport (scene);
+
+  g_async_queue_push (job->results, job);
+}
+
+void
+gst_3d_loader_init (Gst3DLoader * self)
+{
+  self->context = NULL;
+  self->current = NULL;
+  self->upload_budget = GST_3D_LOADER_DEFAULT_UPLOAD_BUDGET;
+  self->results = g_async_queue_new ();
+  /* one worker, imports are memory heavy and the GL thread is the
+   * bottleneck for uploading anyway */
+  self->pool = g_thread_pool_new (_load_func, NULL, 1, FALSE, NULL);
+}
+
+Gst3DLoader *
+gst_3d_loader_new (GstGLContext * context)
+{
+  g_return_val_if_fail (GST_IS_GL_CONTEXT (context), NULL);
+  Gst3DLoader *loader = g_object_new (GST_3D_TYPE_LOADER, NULL);
+  loader->context = gst_object_ref (context);
+  return loader;
+}
+
+static void
+gst_3d_loader_finalize (GObject * object)
+{
+  Gst3DLoader *self = GST_3D_LOADER (object);
+  Gst3DLoaderJob *job;
+  g_return_if_fail (self != NULL);
+
+  /* lets running imports finish, they own their job */
+  g_thread_pool_free (self->pool, FALSE, TRUE);
+
+  if (self->current)
+    _job_free (self->current);
+  while ((job = g_async_queue_try_pop (self->results)))
+    _job_free (job);
+  g_async_queue_unref (self->results);
+
+  if (self->context) {
+    gst_object_unref (self->context);
+    self->context = NULL;
+  }
+
+  G_OBJECT_CLASS (gst_3d_loader_parent_class)->finalize (object);
+}
+
+static void
+gst_3d_loader_class_init (Gst3DLoaderClass * klass)
+{
+  GObjectClass *obj_class = G_OBJECT_CLASS (klass);
+  obj_class->finalize = gst_3d_loader_finalize;
+}
+
+/**
+ * gst_3d_loader_load:
+ * @file: mesh file baked with gst-3d-bake, or a model in any format assimp
+ *   can import
+ * @shader: shader to draw the model with, must outlive the model like for
+ *   gst_3d_node_new_from_mesh_shader()
+ *
+ * Starts importing @file on the loader thread and returns immediately.
+ * The returned node stays empty until gst_3d_loader_process() has uploaded
+ * the whole model, then it gets the model as child.
+ *
+ * Returns: (transfer full): the root node of the model
+ */
+Gst3DNode *
+gst_3d_loader_load (Gst3DLoader * self, const gchar * file,
+    Gst3DShader * shader)
+{
+  Gst3DLoaderJob *job = g_new0 (Gst3DLoaderJob, 1);
+
+  job->file = g_strdup (file);
+  job->shader = gst_object_ref (shader);
+  job->results = g_async_queue_ref (self->results);
+  job->root = gst_3d_node_new (self->context);
+  g_queue_init (&job->uploads);
+
+  GST_DEBUG ("loading %s", file);
+
+  g_thread_pool_push (self->pool, job, NULL);
+
+  return gst_object_ref (job->root);
+}
+
+/**
+ * gst_3d_loader_process:
+ *
+ * Uploads parsed models, at most upload_budget bytes per call. Call it once
+ * per frame from the GL thread.
+ *
+ * Returns: %TRUE if there is no more work pending
+ */
+gboolean
+gst_3d_loader_process (Gst3DLoader * self)
+{
+  gsize uploaded = 0;
+
+  while (uploaded < self->upload_budget) {
+    Gst3DLoaderJob *job = self->current;
+    Gst3DLoaderUpload *upload;
+
+    if (!job) {
+      job = self->current = g_async_queue_try_pop (self->results);
+      if (!job)
+        return TRUE;
+    }
+
+    upload = g_queue_pop_head (&job->uploads);
+    if (upload) {
+      Gst3DMesh *mesh;
+
+      if (upload->data) {
+        mesh = gst_3d_mesh_new (self->context);
+        gst_3d_mesh_init_buffers (mesh);
+        gst_3d_mesh_upload_data (mesh, upload->data);
+        uploaded += gst_3d_mesh_data_get_size (upload->data);
+        gst_3d_mesh_data_free (upload->data);
+      } else {
+        mesh = gst_3d_mesh_file_create_mesh (job->mesh_file, self->context,
+            upload->file_mesh);
+        uploaded += mesh->vertex_count * mesh->layout.stride +
+            mesh->index_count * gst_3d_mesh_index_type_size (mesh->index_type);
+      }
+
+      gst_3d_mesh_bind_shader (mesh, job->shader);
+      upload->node->meshes = g_list_append (upload->node->meshes, mesh);
+      g_free (upload);
+      continue;
+    }
+
+    if (job->tree) {
+      GST_DEBUG ("%s is ready", job->file);
+      gst_3d_node_append_child (job->root, job->tree);
+      job->tree = NULL;
+    }
+    _job_free (job);
+    self->current = NULL;
+  }
+
+  return FALSE;
+}
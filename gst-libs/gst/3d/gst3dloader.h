@@ -0,0 +1,73 @@
+/*
+ * GStreamer Plugins VR
+ * Copyright (C) 2016 Lubosz Sarnecki <lubosz.sarnecki@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_3D_LOADER_H__
+#define __GST_3D_LOADER_H__
+
+
+#include <gst/gst.h>
+#include <gst/gl/gstgl_fwd.h>
+
+#include "gst3dnode.h"
+
+G_BEGIN_DECLS
+#define GST_3D_TYPE_LOADER            (gst_3d_loader_get_type ())
+#define GST_3D_LOADER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_3D_TYPE_LOADER, Gst3DLoader))
+#define GST_3D_LOADER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), GST_3D_TYPE_LOADER, Gst3DLoaderClass))
+#define GST_IS_3D_LOADER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_3D_TYPE_LOADER))
+#define GST_IS_3D_LOADER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_3D_TYPE_LOADER))
+#define GST_3D_LOADER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_3D_TYPE_LOADER, Gst3DLoaderClass))
+typedef struct _Gst3DLoader Gst3DLoader;
+typedef struct _Gst3DLoaderClass Gst3DLoaderClass;
+
+/* bytes of vertex and index data uploaded per frame */
+#define GST_3D_LOADER_DEFAULT_UPLOAD_BUDGET (8 * 1024 * 1024)
+
+struct _Gst3DLoader
+{
+  /*< private > */
+  GstObject parent;
+
+  GstGLContext *context;
+
+  GThreadPool *pool;
+  /* parsed models waiting for upload */
+  GAsyncQueue *results;
+  gpointer current;
+
+  gsize upload_budget;
+};
+
+struct _Gst3DLoaderClass
+{
+  GstObjectClass parent_class;
+};
+
+Gst3DLoader *gst_3d_loader_new (GstGLContext * context);
+GType gst_3d_loader_get_type (void);
+
+Gst3DNode *gst_3d_loader_load (Gst3DLoader * self, const gchar * file, Gst3DShader * shader);
+gboolean gst_3d_loader_process (Gst3DLoader * self);
+
+GPtrArray *gst_3d_loader_import (const gchar * file, GError ** error);
+
+G_END_DECLS
+#endif /* __GST_3D_LOADER_H__ */
@@ -31,6 +31,7 @@
 #include <gst/gl/gstglfuncs.h>
 
 #include "gst3dmesh.h"
+#include "gst3dmeshoptimize.h"
 
 #define GST_CAT_DEFAULT gst_3d_mesh_debug
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
@@ -41,9 +42,30 @@ G_DEFINE_TYPE_WITH_CODE (Gst3DMesh, gst_3d_mesh, GST_TYPE_OBJECT,
 void
 gst_3d_mesh_init (Gst3DMesh * self)
 {
-  self->index_size = 0;
+  self->index_count = 0;
+  self->index_type = GL_UNSIGNED_SHORT;
+  self->vertex_count = 0;
   self->vao = 0;
   self->vbo_indices = 0;
+  self->vbo_vertices = 0;
+  self->vertex_scratch = NULL;
+  self->index_scratch = NULL;
+  self->diffuse_texture = NULL;
+  self->first_index = 0;
+  self->lods = NULL;
+  self->parts = NULL;
+  self->usage = GST_3D_MESH_USAGE_STATIC;
+  self->shadow_vertices = NULL;
+  self->stream_region = 0;
+  for (guint i = 0; i < GST_3D_MESH_STREAM_REGIONS; i++)
+    self->stream_fences[i] = NULL;
+  for (guint i = 0; i < GST_3D_VERTEX_LAYOUT_MAX_ATTRIBUTES; i++)
+    self->attribute_locations[i] = -1;
+  graphene_vec4_init (&self->diffuse_color, 1.f, 1.f, 1.f, 1.f);
+  gst_3d_vertex_layout_init (&self->layout);
+  self->has_bounds = FALSE;
+  graphene_box_init_from_box (&self->bounds, graphene_box_empty ());
+  graphene_sphere_init (&self->bounding_sphere, NULL, 0.f);
 }
 
 Gst3DMesh *
@@ -118,6 +140,196 @@ gst_3d_mesh_new_assimp (GstGLContext * context, const char *file)
   return mesh;
 }
 
+/* Generated meshes only depend on their parameters, so elements sharing a GL
+ * context share one copy of them. The cache only holds weak references and
+ * the meshes are freed when the last user drops them. It is kept per
+ * context and not per share group, because vertex array objects are not
+ * shared between contexts. */
+#define GST_3D_MESH_CACHE_KEY "gst-3d-mesh-cache"
+
+G_LOCK_DEFINE_STATIC (mesh_cache);
+
+static void
+_weak_ref_free (GWeakRef * ref)
+{
+  g_weak_ref_clear (ref);
+  g_free (ref);
+}
+
+static gboolean
+_weak_ref_is_dead (gpointer key, gpointer value, gpointer user_data)
+{
+  GObject *object = g_weak_ref_get ((GWeakRef *) value);
+
+  if (!object)
+    return TRUE;
+  g_object_unref (object);
+  return FALSE;
+}
+
+typedef void (*Gst3DMeshUploadFunc) (Gst3DMesh * mesh, gconstpointer params);
+
+static Gst3DMesh *
+_mesh_cache_get (GstGLContext * context, gchar * key,
+    Gst3DMeshUploadFunc upload, gconstpointer params)
+{
+  GHashTable *cache;
+  GWeakRef *ref;
+  Gst3DMesh *mesh = NULL;
+
+  G_LOCK (mesh_cache);
+
+  cache = g_object_get_data (G_OBJECT (context), GST_3D_MESH_CACHE_KEY);
+  if (!cache) {
+    cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        (GDestroyNotify) _weak_ref_free);
+    g_object_set_data_full (G_OBJECT (context), GST_3D_MESH_CACHE_KEY, cache,
+        (GDestroyNotify) g_hash_table_unref);
+  }
+
+  /* keys of freed meshes, e.g. of previous aspects, are not kept around */
+  g_hash_table_foreach_remove (cache, _weak_ref_is_dead, NULL);
+
+  ref = g_hash_table_lookup (cache, key);
+  if (ref)
+    mesh = g_weak_ref_get (ref);
+
+  if (mesh) {
+    GST_DEBUG ("reusing cached mesh %s", key);
+    g_free (key);
+  } else {
+    GST_DEBUG ("generating mesh %s", key);
+    mesh = gst_3d_mesh_new (context);
+    gst_3d_mesh_init_buffers (mesh);
+    upload (mesh, params);
+
+    ref = g_new0 (GWeakRef, 1);
+    g_weak_ref_init (ref, mesh);
+    g_hash_table_replace (cache, key, ref);
+  }
+
+  G_UNLOCK (mesh_cache);
+
+  return mesh;
+}
+
+typedef struct
+{
+  float radius;
+  unsigned stacks;
+  unsigned slices;
+} Gst3DSphereParams;
+
+static void
+_upload_sphere (Gst3DMesh * mesh, gconstpointer params)
+{
+  const Gst3DSphereParams *p = params;
+  gst_3d_mesh_upload_sphere (mesh, p->radius, p->stacks, p->slices);
+}
+
+static void
+_upload_plane (Gst3DMesh * mesh, gconstpointer params)
+{
+  gst_3d_mesh_upload_plane (mesh, *(const float *) params);
+}
+
+static void
+_upload_cube (Gst3DMesh * mesh, gconstpointer params)
+{
+  gst_3d_mesh_upload_cube (mesh);
+}
+
+/**
+ * gst_3d_mesh_cache_get_sphere:
+ *
+ * Like gst_3d_mesh_new_sphere(), but returns the existing mesh if one with
+ * the same parameters is alive on @context. The returned mesh is shared and
+ * must not be modified.
+ *
+ * Returns: (transfer full): the sphere mesh
+ */
+Gst3DMesh *
+gst_3d_mesh_cache_get_sphere (GstGLContext * context, float radius,
+    unsigned stacks, unsigned slices)
+{
+  g_return_val_if_fail (GST_IS_GL_CONTEXT (context), NULL);
+  Gst3DSphereParams params = { radius, stacks, slices };
+  return _mesh_cache_get (context,
+      g_strdup_printf ("sphere/%a/%u/%u", radius, stacks, slices),
+      _upload_sphere, &params);
+}
+
+/**
+ * gst_3d_mesh_sphere_lod_get_size:
+ * @stacks: (out): segments of longitude
+ * @slices: (out): rings of latitude
+ *
+ * Vertices are spaced evenly in both directions, which the previous fixed
+ * 100x100 sphere did not do.
+ */
+void
+gst_3d_mesh_sphere_lod_get_size (guint level, guint * stacks, guint * slices)
+{
+  level = MIN (level, GST_3D_MESH_SPHERE_LODS - 1);
+  *slices = 8 << level;
+  *stacks = 2 * *slices;
+}
+
+/**
+ * gst_3d_mesh_sphere_lod_for_density:
+ * @pixels_per_radian: how many pixels one radian of the sphere covers. This
+ *   is the lower of the display density of the eye and the texel density of
+ *   the projected video, detail beyond either is not visible.
+ * @tolerance: largest acceptable error in pixels
+ *
+ * A chord spanning the angle d deviates from the sphere by about d^2 / 8 of
+ * its radius, so the segments have to be below sqrt (8 * tolerance /
+ * pixels_per_radian).
+ *
+ * Returns: the coarsest level that keeps the error below @tolerance
+ */
+guint
+gst_3d_mesh_sphere_lod_for_density (gfloat pixels_per_radian, gfloat tolerance)
+{
+  if (pixels_per_radian <= 0.f)
+    return 0;
+
+  gfloat max_angle = sqrtf (8.f * tolerance / pixels_per_radian);
+
+  for (guint level = 0; level < GST_3D_MESH_SPHERE_LODS; level++) {
+    guint stacks, slices;
+    gst_3d_mesh_sphere_lod_get_size (level, &stacks, &slices);
+    if (2 * M_PI / (stacks - 1) <= max_angle)
+      return level;
+  }
+
+  return GST_3D_MESH_SPHERE_LODS - 1;
+}
+
+Gst3DMesh *
+gst_3d_mesh_cache_get_sphere_lod (GstGLContext * context, float radius,
+    guint level)
+{
+  guint stacks, slices;
+  gst_3d_mesh_sphere_lod_get_size (level, &stacks, &slices);
+  return gst_3d_mesh_cache_get_sphere (context, radius, stacks, slices);
+}
+
+Gst3DMesh *
+gst_3d_mesh_cache_get_plane (GstGLContext * context, float aspect)
+{
+  g_return_val_if_fail (GST_IS_GL_CONTEXT (context), NULL);
+  return _mesh_cache_get (context, g_strdup_printf ("plane/%a", aspect),
+      _upload_plane, &aspect);
+}
+
+Gst3DMesh *
+gst_3d_mesh_cache_get_cube (GstGLContext * context)
+{
+  g_return_val_if_fail (GST_IS_GL_CONTEXT (context), NULL);
+  return _mesh_cache_get (context, g_strdup ("cube"), _upload_cube, NULL);
+}
+
 static void
 gst_3d_mesh_finalize (GObject * object)
 {
@@ -125,114 +337,1138 @@ gst_3d_mesh_finalize (GObject * object)
   g_return_if_fail (self != NULL);
 
   GstGLFuncs *gl = self->context->gl_vtable;
-  if (self->vao) {
-    gl->DeleteVertexArrays (1, &self->vao);
-    self->vao = 0;
-  }
+  if (self->vao) {
+    gl->DeleteVertexArrays (1, &self->vao);
+    self->vao = 0;
+  }
+
+  GList *l;
+  for (l = self->attribute_buffers; l != NULL; l = l->next) {
+    struct Gst3DAttributeBuffer *buf = (struct Gst3DAttributeBuffer *) l->data;
+    gl->DeleteBuffers (1, &buf->location);
+    g_free (buf);
+  }
+
+  if (self->vbo_vertices) {
+    gl->DeleteBuffers (1, &self->vbo_vertices);
+    self->vbo_vertices = 0;
+  }
+
+  if (self->vbo_indices) {
+    gl->DeleteBuffers (1, &self->vbo_indices);
+    self->vbo_indices = 0;
+  }
+
+  g_free (self->diffuse_texture);
+  self->diffuse_texture = NULL;
+
+  for (guint i = 0; i < GST_3D_MESH_STREAM_REGIONS; i++) {
+    if (self->stream_fences[i]) {
+      gl->DeleteSync (self->stream_fences[i]);
+      self->stream_fences[i] = NULL;
+    }
+  }
+
+  g_free (self->shadow_vertices);
+  self->shadow_vertices = NULL;
+
+  if (self->lods) {
+    g_array_unref (self->lods);
+    self->lods = NULL;
+  }
+
+  if (self->parts) {
+    g_array_unref (self->parts);
+    self->parts = NULL;
+  }
+
+  if (self->context) {
+    gst_object_unref (self->context);
+    self->context = NULL;
+  }
+
+  G_OBJECT_CLASS (gst_3d_mesh_parent_class)->finalize (object);
+}
+
+static void
+gst_3d_mesh_class_init (Gst3DMeshClass * klass)
+{
+  GObjectClass *obj_class = G_OBJECT_CLASS (klass);
+  obj_class->finalize = gst_3d_mesh_finalize;
+}
+
+void
+gst_3d_mesh_init_buffers (Gst3DMesh * self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (GST_IS_GL_CONTEXT (self->context));
+
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  gl->GenVertexArrays (1, &self->vao);//创建顶点数组对象(Vertex Array Object)
+  gl->BindVertexArray (self->vao);    //绑定顶点数组对象
+  gl->GenBuffers (1, &self->vbo_indices);//创建索引缓冲区对象(Element Buffer Object-EBO/Index Buffer Object-IBO)
+}
+
+void
+gst_3d_mesh_bind (Gst3DMesh * self)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  gl->BindVertexArray (self->vao);
+}
+
+static gsize
+_region_size (Gst3DMesh * self)
+{
+  return self->vertex_count * self->layout.stride;
+}
+
+static guint
+_vertex_regions (Gst3DMesh * self)
+{
+  return self->usage == GST_3D_MESH_USAGE_STREAM ?
+      GST_3D_MESH_STREAM_REGIONS : 1;
+}
+
+static GLenum
+_usage_hint (Gst3DMesh * self)
+{
+  switch (self->usage) {
+    case GST_3D_MESH_USAGE_DYNAMIC:
+      return GL_DYNAMIC_DRAW;
+    case GST_3D_MESH_USAGE_STREAM:
+      return GL_STREAM_DRAW;
+    default:
+      return GL_STATIC_DRAW;
+  }
+}
+
+/* points the vertex array to the current region of the vertex buffer */
+static void
+_point_attributes (Gst3DMesh * self)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  gsize base = self->stream_region * _region_size (self);
+
+  gl->BindVertexArray (self->vao);
+  gl->BindBuffer (GL_ARRAY_BUFFER, self->vbo_vertices);
+  for (guint i = 0; i < self->layout.n_attributes; i++) {
+    const Gst3DVertexAttribute *attrib = &self->layout.attributes[i];
+    if (self->attribute_locations[i] == -1)
+      continue;
+    gl->VertexAttribPointer (self->attribute_locations[i], attrib->components,
+        attrib->type, attrib->normalized, self->layout.stride,
+        (gpointer) (gintptr) (base + attrib->offset));
+  }
+}
+
+static void
+_reset_stream (Gst3DMesh * self)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  for (guint i = 0; i < GST_3D_MESH_STREAM_REGIONS; i++) {
+    if (self->stream_fences[i]) {
+      gl->DeleteSync (self->stream_fences[i]);
+      self->stream_fences[i] = NULL;
+    }
+  }
+  self->stream_region = 0;
+
+  g_free (self->shadow_vertices);
+  self->shadow_vertices = NULL;
+  if (self->usage != GST_3D_MESH_USAGE_STATIC)
+    self->shadow_vertices = g_malloc (_region_size (self));
+}
+
+void
+gst_3d_mesh_bind_shader (Gst3DMesh * self, Gst3DShader * shader)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  gst_3d_shader_bind (shader);
+  gl->BindVertexArray (self->vao);
+
+  if (self->vbo_vertices) {
+    for (guint i = 0; i < self->layout.n_attributes; i++) {
+      const Gst3DVertexAttribute *attrib = &self->layout.attributes[i];
+      GLint attrib_location =
+          gst_3d_shader_get_attribute_location (shader, attrib->name);
+      if (attrib_location == -1) {
+        GST_DEBUG ("shader does not use attribute %s.", attrib->name);
+        continue;
+      }
+      self->attribute_locations[i] = attrib_location;
+      gl->EnableVertexAttribArray (attrib_location);
+    }
+    _point_attributes (self);
+  }
+
+  GList *l;
+  for (l = self->attribute_buffers; l != NULL; l = l->next) {
+    struct Gst3DAttributeBuffer *buf = (struct Gst3DAttributeBuffer *) l->data;
+    GST_DEBUG ("%s: location: %d length: %d size: %zu", buf->name,
+               buf->location, buf->vector_length, buf->element_size);
+
+    gl->BindBuffer (GL_ARRAY_BUFFER, buf->location);
+
+    GLint attrib_location = gst_3d_shader_get_attribute_location (shader, buf->name);
+
+    if (attrib_location != -1) {
+      gl->VertexAttribPointer (attrib_location, buf->vector_length, GL_FLOAT, GL_FALSE, 0, 0);
+      gl->EnableVertexAttribArray (attrib_location);
+    } else {
+      GST_WARNING ("could not find attribute %s in shader.", buf->name);
+    }
+  }
+  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices);
+}
+
+void
+gst_3d_mesh_unbind_buffers (Gst3DMesh * self)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
+  gl->BindBuffer (GL_ARRAY_BUFFER, 0);
+}
+
+void
+gst_3d_mesh_draw (Gst3DMesh * self)
+{
+  gst_3d_mesh_draw_mode (self, self->draw_mode);
+}
+
+void
+gst_3d_mesh_draw_mode (Gst3DMesh * self, GLenum draw_mode)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  gl->DrawElements (draw_mode, self->index_count, self->index_type,
+      (gpointer) (gsize) (self->first_index *
+          gst_3d_mesh_index_type_size (self->index_type)));
+}
+
+/**
+ * gst_3d_mesh_draw_instanced:
+ * @instance_count: number of copies, their attributes have a divisor of 1
+ *
+ * Draws the mesh @instance_count times with a single draw call.
+ */
+void
+gst_3d_mesh_draw_instanced (Gst3DMesh * self, GLenum draw_mode,
+    guint instance_count)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  gl->DrawElementsInstanced (draw_mode, self->index_count, self->index_type,
+      (gpointer) (gsize) (self->first_index *
+          gst_3d_mesh_index_type_size (self->index_type)), instance_count);
+}
+
+/**
+ * gst_3d_mesh_set_lods:
+ * @lods: index ranges of the levels, from the most to the least detailed
+ *
+ * Describes the levels of detail stored in the index buffer and selects
+ * the most detailed one.
+ */
+void
+gst_3d_mesh_set_lods (Gst3DMesh * self, const Gst3DMeshLod * lods,
+    guint n_lods)
+{
+  if (self->lods)
+    g_array_unref (self->lods);
+  self->lods = NULL;
+
+  if (n_lods == 0)
+    return;
+
+  self->lods = g_array_sized_new (FALSE, FALSE, sizeof (Gst3DMeshLod), n_lods);
+  g_array_append_vals (self->lods, lods, n_lods);
+  gst_3d_mesh_set_lod (self, 0);
+}
+
+/**
+ * gst_3d_mesh_set_lod:
+ * @level: level of detail, 0 is the most detailed
+ *
+ * Selects the index range drawn by gst_3d_mesh_draw(). Levels past the
+ * last one select the last one.
+ */
+void
+gst_3d_mesh_set_lod (Gst3DMesh * self, guint level)
+{
+  if (!self->lods)
+    return;
+
+  const Gst3DMeshLod *lod = &g_array_index (self->lods, Gst3DMeshLod,
+      MIN (level, self->lods->len - 1));
+  self->first_index = lod->first_index;
+  self->index_count = lod->index_count;
+}
+
+/**
+ * gst_3d_mesh_set_parts:
+ * @parts: index ranges of the source meshes of a batch
+ *
+ * Records the parts of a batched mesh. gst_3d_mesh_draw() still draws all
+ * of them at once.
+ */
+void
+gst_3d_mesh_set_parts (Gst3DMesh * self, const Gst3DMeshPart * parts,
+    guint n_parts)
+{
+  if (self->parts)
+    g_array_unref (self->parts);
+  self->parts = NULL;
+
+  if (n_parts == 0)
+    return;
+
+  self->parts =
+      g_array_sized_new (FALSE, FALSE, sizeof (Gst3DMeshPart), n_parts);
+  g_array_append_vals (self->parts, parts, n_parts);
+}
+
+/**
+ * gst_3d_mesh_draw_part:
+ * @part: index of the part, see gst_3d_mesh_set_parts()
+ *
+ * Draws a single source mesh of a batched mesh.
+ */
+void
+gst_3d_mesh_draw_part (Gst3DMesh * self, GLenum draw_mode, guint part)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  g_return_if_fail (self->parts && part < self->parts->len);
+
+  const Gst3DMeshPart *range =
+      &g_array_index (self->parts, Gst3DMeshPart, part);
+  gl->DrawElements (draw_mode, range->index_count, self->index_type,
+      (gpointer) (gsize) (range->first_index *
+          gst_3d_mesh_index_type_size (self->index_type)));
+}
+
+void
+gst_3d_mesh_draw_arrays (Gst3DMesh * self)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  gl->DrawArrays (self->draw_mode, 0, self->vertex_count);
+}
+
+void
+gst_3d_vertex_layout_init (Gst3DVertexLayout * layout)
+{
+  memset (layout, 0, sizeof (Gst3DVertexLayout));
+}
+
+/**
+ * gst_3d_vertex_attribute_size:
+ *
+ * Returns: the size of one value of an attribute in bytes, 0 if @type is
+ *   no vertex attribute type or does not have @components components
+ */
+gsize
+gst_3d_vertex_attribute_size (GLint components, GLenum type)
+{
+  if (components < 1 || components > 4)
+    return 0;
+
+  switch (type) {
+    case GL_FLOAT:
+      return components * sizeof (GLfloat);
+    case GL_HALF_FLOAT:
+      return components * sizeof (guint16);
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+      return components * sizeof (GLubyte);
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+      return components * sizeof (GLushort);
+    case GL_INT_2_10_10_10_REV:
+    case GL_UNSIGNED_INT_2_10_10_10_REV:
+      /* all four components are packed into one word */
+      return components == 4 ? sizeof (GLuint) : 0;
+    default:
+      return 0;
+  }
+}
+
+static guint
+_vertex_attribute_size (GLint components, GLenum type)
+{
+  gsize size = gst_3d_vertex_attribute_size (components, type);
+  g_assert (size != 0);
+  return size;
+}
+
+/**
+ * gst_3d_vertex_layout_add:
+ * @name: attribute name in the shader
+ * @components: number of components, must be 4 for packed types
+ * @type: GL component type, e.g. GL_FLOAT, GL_HALF_FLOAT or
+ *   GL_INT_2_10_10_10_REV
+ * @normalized: whether integer components are normalized to [-1, 1] / [0, 1]
+ *
+ * Appends an attribute after the previous ones. Offsets are kept 4 byte
+ * aligned.
+ */
+void
+gst_3d_vertex_layout_add (Gst3DVertexLayout * layout, const gchar * name,
+    GLint components, GLenum type, GLboolean normalized)
+{
+  g_return_if_fail (layout->n_attributes < GST_3D_VERTEX_LAYOUT_MAX_ATTRIBUTES);
+
+  Gst3DVertexAttribute *attrib = &layout->attributes[layout->n_attributes++];
+
+  g_strlcpy (attrib->name, name, GST_3D_VERTEX_ATTRIBUTE_NAME_LENGTH);
+  attrib->components = components;
+  attrib->type = type;
+  attrib->normalized = normalized;
+  attrib->offset = layout->stride;
+
+  layout->stride += GST_ROUND_UP_4 (_vertex_attribute_size (components, type));
+}
+
+const Gst3DVertexAttribute *
+gst_3d_vertex_layout_find (const Gst3DVertexLayout * layout, const gchar * name)
+{
+  for (guint i = 0; i < layout->n_attributes; i++)
+    if (g_strcmp0 (layout->attributes[i].name, name) == 0)
+      return &layout->attributes[i];
+  return NULL;
+}
+
+/* packs a unit vector for a 4 component GL_INT_2_10_10_10_REV attribute */
+guint32
+gst_3d_vertex_pack_normal (gfloat x, gfloat y, gfloat z)
+{
+  gint32 ix = (gint32) roundf (CLAMP (x, -1.0f, 1.0f) * 511.0f);
+  gint32 iy = (gint32) roundf (CLAMP (y, -1.0f, 1.0f) * 511.0f);
+  gint32 iz = (gint32) roundf (CLAMP (z, -1.0f, 1.0f) * 511.0f);
+
+  return ((guint32) ix & 0x3ff) | (((guint32) iy & 0x3ff) << 10)
+      | (((guint32) iz & 0x3ff) << 20);
+}
+
+/* IEEE 754 half precision, for GL_HALF_FLOAT attributes */
+guint16
+gst_3d_vertex_pack_half (gfloat value)
+{
+  union
+  {
+    gfloat f;
+    guint32 u;
+  } bits = {.f = value };
+
+  guint32 sign = (bits.u >> 16) & 0x8000;
+  gint32 exponent = ((bits.u >> 23) & 0xff) - 127 + 15;
+  guint32 mantissa = bits.u & 0x7fffff;
+
+  if (exponent <= 0) {
+    /* flush denormals to zero, they are irrelevant for vertex data */
+    return sign;
+  } else if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+
+  /* round to nearest */
+  mantissa += 0x1000;
+  if (mantissa & 0x800000) {
+    mantissa = 0;
+    exponent++;
+    if (exponent >= 31)
+      return sign | 0x7c00;
+  }
+
+  return sign | (exponent << 10) | (mantissa >> 13);
+}
+
+/* box around float positions, FALSE if the layout has none */
+static gboolean
+_compute_bounds (const Gst3DVertexLayout * layout, const guint8 * vertices,
+    guint vertex_count, graphene_box_t * bounds)
+{
+  const Gst3DVertexAttribute *position =
+      gst_3d_vertex_layout_find (layout, "position");
+  gfloat min[3] = { G_MAXFLOAT, G_MAXFLOAT, G_MAXFLOAT };
+  gfloat max[3] = { -G_MAXFLOAT, -G_MAXFLOAT, -G_MAXFLOAT };
+
+  if (!position || position->type != GL_FLOAT || position->components < 3
+      || vertex_count == 0)
+    return FALSE;
+
+  for (guint i = 0; i < vertex_count; i++) {
+    const gfloat *p =
+        (const gfloat *) (vertices + i * layout->stride + position->offset);
+    for (guint c = 0; c < 3; c++) {
+      min[c] = MIN (min[c], p[c]);
+      max[c] = MAX (max[c], p[c]);
+    }
+  }
+
+  graphene_point3d_t pmin, pmax;
+  graphene_point3d_init (&pmin, min[0], min[1], min[2]);
+  graphene_point3d_init (&pmax, max[0], max[1], max[2]);
+  graphene_box_init (bounds, &pmin, &pmax);
+  return TRUE;
+}
+
+/**
+ * gst_3d_mesh_upload_interleaved:
+ * @layout: format of @vertices
+ * @vertices: @vertex_count vertices of layout->stride bytes each
+ *
+ * Uploads all attributes of the mesh into one vertex buffer. Compared to
+ * one buffer per attribute, every vertex is fetched from one cache line and
+ * binding the mesh to a shader touches a single buffer object.
+ */
+void
+gst_3d_mesh_upload_interleaved (Gst3DMesh * self,
+    const Gst3DVertexLayout * layout, gconstpointer vertices,
+    guint vertex_count)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  self->layout = *layout;
+  self->vertex_count = vertex_count;
+  _reset_stream (self);
+
+  if (!self->vbo_vertices)
+    gl->GenBuffers (1, &self->vbo_vertices);
+
+  gl->BindBuffer (GL_ARRAY_BUFFER, self->vbo_vertices);
+  if (_vertex_regions (self) == 1) {
+    gl->BufferData (GL_ARRAY_BUFFER, _region_size (self), vertices,
+        _usage_hint (self));
+  } else {
+    gl->BufferData (GL_ARRAY_BUFFER, _region_size (self) * _vertex_regions
+        (self), NULL, _usage_hint (self));
+    gl->BufferSubData (GL_ARRAY_BUFFER, 0, _region_size (self), vertices);
+  }
+
+  if (self->shadow_vertices)
+    memcpy (self->shadow_vertices, vertices, _region_size (self));
+
+  graphene_box_t bounds;
+  gst_3d_mesh_set_bounds (self, _compute_bounds (layout, vertices,
+          vertex_count, &bounds) ? &bounds : NULL);
+}
+
+/**
+ * gst_3d_mesh_set_bounds:
+ * @bounds: (nullable): the box around all vertices, NULL if unknown
+ *
+ * Sets the bounds used for culling. Uploads of CPU memory compute them,
+ * meshes written through gst_3d_mesh_map_vertices() have to set them.
+ */
+void
+gst_3d_mesh_set_bounds (Gst3DMesh * self, const graphene_box_t * bounds)
+{
+  self->bounds_generation++;
+  self->has_bounds = bounds != NULL;
+  if (!bounds)
+    return;
+
+  graphene_box_init_from_box (&self->bounds, bounds);
+  graphene_box_get_bounding_sphere (&self->bounds, &self->bounding_sphere);
+}
+
+/* Partial updates only grow the bounds, they stay conservative without
+ * scanning the whole mesh again. */
+static void
+_grow_bounds (Gst3DMesh * self, guint first_vertex, guint vertex_count)
+{
+  graphene_box_t updated;
+
+  if (!self->has_bounds)
+    return;
+
+  if (!_compute_bounds (&self->layout, self->shadow_vertices +
+          first_vertex * self->layout.stride, vertex_count, &updated))
+    return;
+
+  graphene_box_union (&self->bounds, &updated, &updated);
+  gst_3d_mesh_set_bounds (self, &updated);
+}
+
+static gpointer _scratch_acquire (Gst3DMesh * self, gsize size);
+static void _scratch_release (Gst3DMesh * self, gpointer data);
+
+/**
+ * gst_3d_mesh_set_usage:
+ *
+ * Sets how often the mesh is updated. Takes effect with the next upload,
+ * so call it before generating the mesh. Meshes that are not static keep
+ * a CPU copy of their vertices for partial updates.
+ */
+void
+gst_3d_mesh_set_usage (Gst3DMesh * self, Gst3DMeshUsage usage)
+{
+  self->usage = usage;
+}
+
+/* Streamed meshes rotate through GST_3D_MESH_STREAM_REGIONS copies of the
+ * vertices. The region that was drawn until now is fenced, and the next
+ * one is written after the GPU finished the draws that read it, which are
+ * frames ago. Without sync objects, fall back to orphaning. */
+static gboolean
+_stream_advance (Gst3DMesh * self)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  if (self->usage != GST_3D_MESH_USAGE_STREAM || !gl->FenceSync
+      || !gl->MapBufferRange)
+    return FALSE;
+
+  guint current = self->stream_region;
+  guint next = (current + 1) % GST_3D_MESH_STREAM_REGIONS;
+
+  if (self->stream_fences[current])
+    gl->DeleteSync (self->stream_fences[current]);
+  self->stream_fences[current] =
+      gl->FenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  if (self->stream_fences[next]) {
+    GLenum result = gl->ClientWaitSync (self->stream_fences[next],
+        GL_SYNC_FLUSH_COMMANDS_BIT, G_GUINT64_CONSTANT (1000000000));
+    if (result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED)
+      GST_WARNING ("waiting for stream region %d failed", next);
+    gl->DeleteSync (self->stream_fences[next]);
+    self->stream_fences[next] = NULL;
+  }
+
+  self->stream_region = next;
+  return TRUE;
+}
+
+/* uploads the changed span of the CPU copy */
+static void
+_upload_vertex_span (Gst3DMesh * self, gsize offset, gsize size)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  gsize region_size = _region_size (self);
+
+  gl->BindBuffer (GL_ARRAY_BUFFER, self->vbo_vertices);
+
+  if (_stream_advance (self)) {
+    /* the new region is stale, it gets the whole copy */
+    gpointer data = gl->MapBufferRange (GL_ARRAY_BUFFER,
+        self->stream_region * region_size, region_size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+        GL_MAP_UNSYNCHRONIZED_BIT);
+    if (data) {
+      memcpy (data, self->shadow_vertices, region_size);
+      gl->UnmapBuffer (GL_ARRAY_BUFFER);
+    } else {
+      gl->BufferSubData (GL_ARRAY_BUFFER, self->stream_region * region_size,
+          region_size, self->shadow_vertices);
+    }
+    _point_attributes (self);
+  } else if (offset == 0 && size == region_size) {
+    /* orphan the storage instead of waiting for draws reading it */
+    gl->BufferData (GL_ARRAY_BUFFER, region_size * _vertex_regions (self),
+        NULL, _usage_hint (self));
+    gl->BufferSubData (GL_ARRAY_BUFFER, self->stream_region * region_size,
+        region_size, self->shadow_vertices);
+  } else {
+    gl->BufferSubData (GL_ARRAY_BUFFER,
+        self->stream_region * region_size + offset, size,
+        self->shadow_vertices + offset);
+  }
+}
+
+/**
+ * gst_3d_mesh_update_vertices:
+ * @vertices: @vertex_count interleaved vertices in the layout of the mesh
+ *
+ * Replaces vertices @first_vertex to @first_vertex + @vertex_count. The
+ * mesh must not be static. The number of vertices can only be changed by
+ * uploading the mesh again. The bounds grow to include the new vertices,
+ * the scene recomputes the bounds of the nodes drawing the mesh before
+ * the next frame.
+ */
+void
+gst_3d_mesh_update_vertices (Gst3DMesh * self, guint first_vertex,
+    guint vertex_count, gconstpointer vertices)
+{
+  g_return_if_fail (self->shadow_vertices != NULL);
+  g_return_if_fail (first_vertex + vertex_count <= self->vertex_count);
+
+  gsize offset = first_vertex * self->layout.stride;
+  gsize size = vertex_count * self->layout.stride;
+
+  memcpy (self->shadow_vertices + offset, vertices, size);
+  _upload_vertex_span (self, offset, size);
+  _grow_bounds (self, first_vertex, vertex_count);
+}
+
+/**
+ * gst_3d_mesh_update_attribute:
+ * @values: @vertex_count tightly packed values of the attribute
+ *
+ * Replaces one attribute of vertices @first_vertex to @first_vertex +
+ * @vertex_count, e.g. only the positions of a point cloud. Updated
+ * positions grow the bounds like gst_3d_mesh_update_vertices().
+ */
+void
+gst_3d_mesh_update_attribute (Gst3DMesh * self, const gchar * name,
+    guint first_vertex, guint vertex_count, gconstpointer values)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  g_return_if_fail (first_vertex + vertex_count <= self->vertex_count);
 
+  /* meshes with one buffer per attribute */
   GList *l;
   for (l = self->attribute_buffers; l != NULL; l = l->next) {
     struct Gst3DAttributeBuffer *buf = (struct Gst3DAttributeBuffer *) l->data;
-    gl->DeleteBuffers (1, &buf->location);
-    g_free (buf);
+    if (g_strcmp0 (buf->name, name) != 0)
+      continue;
+    gsize value_size = buf->vector_length * buf->element_size;
+    gl->BindBuffer (GL_ARRAY_BUFFER, buf->location);
+    gl->BufferSubData (GL_ARRAY_BUFFER, first_vertex * value_size,
+        vertex_count * value_size, values);
+    return;
   }
 
-  if (self->vbo_indices) {
-    gl->DeleteBuffers (1, &self->vbo_indices);
-    self->vbo_indices = 0;
-  }
+  const Gst3DVertexAttribute *attrib =
+      gst_3d_vertex_layout_find (&self->layout, name);
+  g_return_if_fail (attrib != NULL);
+  g_return_if_fail (self->shadow_vertices != NULL);
 
-  if (self->context) {
-    gst_object_unref (self->context);
-    self->context = NULL;
+  guint value_size = _vertex_attribute_size (attrib->components, attrib->type);
+  guint8 *dest = self->shadow_vertices + first_vertex * self->layout.stride +
+      attrib->offset;
+  const guint8 *src = values;
+
+  for (guint i = 0; i < vertex_count; i++) {
+    memcpy (dest, src, value_size);
+    dest += self->layout.stride;
+    src += value_size;
   }
 
-  G_OBJECT_CLASS (gst_3d_mesh_parent_class)->finalize (object);
+  _upload_vertex_span (self, first_vertex * self->layout.stride,
+      vertex_count * self->layout.stride);
+  if (g_strcmp0 (name, "position") == 0)
+    _grow_bounds (self, first_vertex, vertex_count);
+}
+
+/* 16 bit index buffers get the indices packed into scratch memory, which
+ * is released with _release_indices() once uploaded. */
+static gconstpointer
+_pack_indices (Gst3DMesh * self, guint index_count, const guint32 * indices)
+{
+  if (self->index_type != GL_UNSIGNED_SHORT)
+    return indices;
+
+  GLushort *packed = _scratch_acquire (self, index_count * sizeof (GLushort));
+  for (guint i = 0; i < index_count; i++)
+    packed[i] = (GLushort) indices[i];
+  return packed;
 }
 
 static void
-gst_3d_mesh_class_init (Gst3DMeshClass * klass)
+_release_indices (Gst3DMesh * self, gconstpointer data,
+    const guint32 * indices)
 {
-  GObjectClass *obj_class = G_OBJECT_CLASS (klass);
-  obj_class->finalize = gst_3d_mesh_finalize;
+  if (data != indices)
+    _scratch_release (self, (gpointer) data);
 }
 
+/**
+ * gst_3d_mesh_update_indices:
+ *
+ * Replaces indices @first_index to @first_index + @index_count, which have
+ * to be within the index buffer. The number of indices is not changed,
+ * see gst_3d_mesh_replace_indices().
+ */
 void
-gst_3d_mesh_init_buffers (Gst3DMesh * self)
+gst_3d_mesh_update_indices (Gst3DMesh * self, guint first_index,
+    guint index_count, const guint32 * indices)
 {
-  g_return_if_fail (self != NULL);
-  g_return_if_fail (GST_IS_GL_CONTEXT (self->context));
-
   GstGLFuncs *gl = self->context->gl_vtable;
+  gsize index_size = gst_3d_mesh_index_type_size (self->index_type);
 
-  gl->GenVertexArrays (1, &self->vao);//创建顶点数组对象(Vertex Array Object)
-  gl->BindVertexArray (self->vao);    //绑定顶点数组对象
-  gl->GenBuffers (1, &self->vbo_indices);//创建索引缓冲区对象(Element Buffer Object-EBO/Index Buffer Object-IBO)
+  g_return_if_fail (first_index + index_count <= self->index_count);
+
+  gconstpointer data = _pack_indices (self, index_count, indices);
+
+  gl->BindVertexArray (self->vao);
+  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices);
+  gl->BufferSubData (GL_ELEMENT_ARRAY_BUFFER, first_index * index_size,
+      index_count * index_size, data);
+
+  _release_indices (self, data, indices);
 }
 
+/**
+ * gst_3d_mesh_replace_indices:
+ *
+ * Replaces the whole index buffer with @index_count indices. Levels of
+ * detail and parts refer to the old indices and are removed.
+ */
 void
-gst_3d_mesh_bind (Gst3DMesh * self)
+gst_3d_mesh_replace_indices (Gst3DMesh * self, guint index_count,
+    const guint32 * indices)
 {
   GstGLFuncs *gl = self->context->gl_vtable;
+  gsize index_size = gst_3d_mesh_index_type_size (self->index_type);
+  gconstpointer data = _pack_indices (self, index_count, indices);
+
   gl->BindVertexArray (self->vao);
+  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices);
+  /* orphans the old storage, draws in flight keep reading it */
+  gl->BufferData (GL_ELEMENT_ARRAY_BUFFER, index_count * index_size, data,
+      _usage_hint (self));
+  self->index_count = index_count;
+  self->first_index = 0;
+  gst_3d_mesh_set_lods (self, NULL, 0);
+  gst_3d_mesh_set_parts (self, NULL, 0);
+
+  _release_indices (self, data, indices);
 }
 
-void
-gst_3d_mesh_bind_shader (Gst3DMesh * self, Gst3DShader * shader)
+/* Used instead of mapping when the context has no glMapBufferRange, and to
+ * pack 16 bit index updates. It is reused while it stays small, larger
+ * ones are freed once uploaded so one big mesh does not pin its size for
+ * the lifetime of the context. */
+#define GST_3D_MESH_SCRATCH_KEY "gst-3d-mesh-scratch"
+#define GST_3D_MESH_SCRATCH_KEEP (64 * 1024)
+
+static gpointer
+_scratch_acquire (Gst3DMesh * self, gsize size)
+{
+  GByteArray *scratch = g_object_get_data (G_OBJECT (self->context),
+      GST_3D_MESH_SCRATCH_KEY);
+
+  if (!scratch) {
+    scratch = g_byte_array_new ();
+    g_object_set_data_full (G_OBJECT (self->context), GST_3D_MESH_SCRATCH_KEY,
+        scratch, (GDestroyNotify) g_byte_array_unref);
+  }
+
+  if (scratch->len < size)
+    g_byte_array_set_size (scratch, size);
+
+  return scratch->data;
+}
+
+static void
+_scratch_release (Gst3DMesh * self, gpointer data)
+{
+  GByteArray *scratch = g_object_get_data (G_OBJECT (self->context),
+      GST_3D_MESH_SCRATCH_KEY);
+
+  /* the shadow vertices are written in place of the scratch as well */
+  if (scratch && scratch->data == data
+      && scratch->len > GST_3D_MESH_SCRATCH_KEEP)
+    g_object_set_data (G_OBJECT (self->context), GST_3D_MESH_SCRATCH_KEY,
+        NULL);
+}
+
+static gpointer
+_map_buffer (Gst3DMesh * self, GLenum target, guint buffer, gsize size,
+    gsize allocation, gpointer * scratch)
 {
   GstGLFuncs *gl = self->context->gl_vtable;
+  gpointer data = NULL;
 
-  gst_3d_shader_bind (shader);
+  gl->BindBuffer (target, buffer);
+  gl->BufferData (target, allocation, NULL, _usage_hint (self));
 
-  GList *l;
-  for (l = self->attribute_buffers; l != NULL; l = l->next) {
-    struct Gst3DAttributeBuffer *buf = (struct Gst3DAttributeBuffer *) l->data;
-    GST_DEBUG ("%s: location: %d length: %d size: %zu", buf->name,
-               buf->location, buf->vector_length, buf->element_size);
+  if (*scratch)
+    return *scratch;
 
-    gl->BindBuffer (GL_ARRAY_BUFFER, buf->location);
+  if (gl->MapBufferRange)
+    data = gl->MapBufferRange (target, 0, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
 
-    GLint attrib_location = gst_gl_shader_get_attribute_location (shader->shader, buf->name);
+  if (!data) {
+    GST_DEBUG ("buffer mapping unavailable, generating into scratch memory");
+    data = *scratch = _scratch_acquire (self, size);
+  }
 
-    if (attrib_location != -1) {
-      gl->VertexAttribPointer (attrib_location, buf->vector_length, GL_FLOAT, GL_FALSE, 0, 0);
-      gl->EnableVertexAttribArray (attrib_location);
-    } else {
-      GST_WARNING ("could not find attribute %s in shader.", buf->name);
-    }
+  return data;
+}
+
+static void
+_unmap_buffer (Gst3DMesh * self, GLenum target, guint buffer, gsize size,
+    gpointer * scratch)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  gl->BindBuffer (target, buffer);
+
+  if (*scratch) {
+    gl->BufferSubData (target, 0, size, *scratch);
+    _scratch_release (self, *scratch);
+    *scratch = NULL;
+  } else if (!gl->UnmapBuffer (target)) {
+    GST_WARNING ("buffer contents were lost while mapped");
   }
-  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices);
 }
 
-void
-gst_3d_mesh_unbind_buffers (Gst3DMesh * self)
+/**
+ * gst_3d_mesh_map_vertices:
+ * @layout: format of the vertices
+ * @vertex_count: number of vertices to allocate
+ *
+ * Allocates the vertex buffer of the mesh and returns write only memory for
+ * @vertex_count vertices of layout->stride bytes, so generators do not need
+ * to build an intermediate copy. The memory must be filled completely and
+ * released with gst_3d_mesh_unmap_vertices() before drawing.
+ *
+ * Returns: (transfer none): memory to write the vertices to
+ */
+gpointer
+gst_3d_mesh_map_vertices (Gst3DMesh * self, const Gst3DVertexLayout * layout,
+    guint vertex_count)
 {
   GstGLFuncs *gl = self->context->gl_vtable;
 
-  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
-  gl->BindBuffer (GL_ARRAY_BUFFER, 0);
+  self->layout = *layout;
+  self->vertex_count = vertex_count;
+  gst_3d_mesh_set_bounds (self, NULL);
+  _reset_stream (self);
+
+  if (!self->vbo_vertices)
+    gl->GenBuffers (1, &self->vbo_vertices);
+
+  /* meshes that are updated later keep the vertices, write them there */
+  self->vertex_scratch = self->shadow_vertices;
+
+  return _map_buffer (self, GL_ARRAY_BUFFER, self->vbo_vertices,
+      _region_size (self), _region_size (self) * _vertex_regions (self),
+      &self->vertex_scratch);
 }
 
 void
-gst_3d_mesh_draw (Gst3DMesh * self)
+gst_3d_mesh_unmap_vertices (Gst3DMesh * self)
+{
+  _unmap_buffer (self, GL_ARRAY_BUFFER, self->vbo_vertices,
+      self->vertex_count * self->layout.stride, &self->vertex_scratch);
+}
+
+/**
+ * gst_3d_mesh_map_indices:
+ * @index_type: GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, see
+ *   gst_3d_mesh_index_type_for_vertex_count()
+ *
+ * Like gst_3d_mesh_map_vertices() for the index buffer.
+ *
+ * Returns: (transfer none): memory to write the indices to
+ */
+gpointer
+gst_3d_mesh_map_indices (Gst3DMesh * self, GLenum index_type,
+    guint index_count)
 {
-  // g_print ("gst_3d_mesh_draw self->index_size:%d.\n", self->index_size);
   GstGLFuncs *gl = self->context->gl_vtable;
-  gl->DrawElements (self->draw_mode, self->index_size, GL_UNSIGNED_SHORT, 0);
+
+  self->index_type = index_type;
+  self->index_count = index_count;
+  gst_3d_mesh_set_lods (self, NULL, 0);
+  gst_3d_mesh_set_parts (self, NULL, 0);
+  self->first_index = 0;
+
+  /* the element array binding is part of the vertex array state */
+  gl->BindVertexArray (self->vao);
+
+  gsize size = index_count * gst_3d_mesh_index_type_size (index_type);
+  return _map_buffer (self, GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices, size,
+      size, &self->index_scratch);
 }
 
 void
-gst_3d_mesh_draw_mode (Gst3DMesh * self, GLenum draw_mode)
+gst_3d_mesh_unmap_indices (Gst3DMesh * self)
 {
   GstGLFuncs *gl = self->context->gl_vtable;
-  gl->DrawElements (draw_mode, self->index_size, GL_UNSIGNED_SHORT, 0);
+
+  gl->BindVertexArray (self->vao);
+  _unmap_buffer (self, GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices,
+      self->index_count * gst_3d_mesh_index_type_size (self->index_type),
+      &self->index_scratch);
+}
+
+static inline void
+_write_index (gpointer indices, GLenum index_type, guint i, guint32 value)
+{
+  if (index_type == GL_UNSIGNED_SHORT)
+    ((GLushort *) indices)[i] = (GLushort) value;
+  else
+    ((GLuint *) indices)[i] = value;
+}
+
+/**
+ * gst_3d_mesh_data_new:
+ *
+ * Allocates CPU geometry for @vertex_count vertices in @layout and
+ * @index_count 32 bit indices. Needs no GL context, so it can be filled on
+ * any thread.
+ */
+Gst3DMeshData *
+gst_3d_mesh_data_new (const Gst3DVertexLayout * layout, guint vertex_count,
+    guint index_count, GLenum draw_mode)
+{
+  Gst3DMeshData *data = g_new0 (Gst3DMeshData, 1);
+
+  data->layout = *layout;
+  data->vertex_count = vertex_count;
+  data->vertices = g_malloc (vertex_count * layout->stride);
+  data->index_count = index_count;
+  data->indices = g_new (guint32, index_count);
+  data->draw_mode = draw_mode;
+  graphene_vec4_init (&data->diffuse_color, 1.f, 1.f, 1.f, 1.f);
+
+  return data;
 }
 
 void
-gst_3d_mesh_draw_arrays (Gst3DMesh * self)
+gst_3d_mesh_data_free (Gst3DMeshData * data)
+{
+  if (!data)
+    return;
+  g_free (data->vertices);
+  g_free (data->indices);
+  g_free (data->diffuse_texture);
+  if (data->lods)
+    g_array_unref (data->lods);
+  if (data->parts)
+    g_array_unref (data->parts);
+  g_free (data);
+}
+
+/* bytes the data will occupy on the GPU */
+gsize
+gst_3d_mesh_data_get_size (const Gst3DMeshData * data)
+{
+  return data->vertex_count * data->layout.stride + data->index_count *
+      gst_3d_mesh_index_type_size (gst_3d_mesh_index_type_for_vertex_count
+      (data->vertex_count));
+}
+
+/**
+ * gst_3d_mesh_upload_data:
+ *
+ * Uploads geometry prepared with gst_3d_mesh_data_new(). Must be called
+ * from the GL thread after gst_3d_mesh_init_buffers().
+ */
+void
+gst_3d_mesh_upload_data (Gst3DMesh * self, const Gst3DMeshData * data)
+{
+  gpointer vertices = gst_3d_mesh_map_vertices (self, &data->layout,
+      data->vertex_count);
+  memcpy (vertices, data->vertices, data->vertex_count * data->layout.stride);
+  gst_3d_mesh_unmap_vertices (self);
+
+  graphene_box_t bounds;
+  if (_compute_bounds (&data->layout, data->vertices, data->vertex_count,
+          &bounds))
+    gst_3d_mesh_set_bounds (self, &bounds);
+
+  GLenum index_type =
+      gst_3d_mesh_index_type_for_vertex_count (data->vertex_count);
+  gpointer indices = gst_3d_mesh_map_indices (self, index_type,
+      data->index_count);
+  if (index_type == GL_UNSIGNED_INT) {
+    memcpy (indices, data->indices, data->index_count * sizeof (guint32));
+  } else {
+    for (guint i = 0; i < data->index_count; i++)
+      ((GLushort *) indices)[i] = (GLushort) data->indices[i];
+  }
+  gst_3d_mesh_unmap_indices (self);
+
+  self->first_index = 0;
+  if (data->lods)
+    gst_3d_mesh_set_lods (self, (const Gst3DMeshLod *) data->lods->data,
+        data->lods->len);
+  if (data->parts)
+    gst_3d_mesh_set_parts (self, (const Gst3DMeshPart *) data->parts->data,
+        data->parts->len);
+
+  self->draw_mode = data->draw_mode;
+  self->diffuse_color = data->diffuse_color;
+  g_free (self->diffuse_texture);
+  self->diffuse_texture = g_strdup (data->diffuse_texture);
+}
+
+/**
+ * gst_3d_mesh_index_type_for_vertex_count:
+ *
+ * Returns: GL_UNSIGNED_SHORT if every vertex can be addressed with 16 bit,
+ * GL_UNSIGNED_INT otherwise.
+ */
+GLenum
+gst_3d_mesh_index_type_for_vertex_count (guint vertex_count)
+{
+  return vertex_count <= G_MAXUINT16 + 1 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+gsize
+gst_3d_mesh_index_type_size (GLenum index_type)
+{
+  switch (index_type) {
+    case GL_UNSIGNED_BYTE:
+      return sizeof (GLubyte);
+    case GL_UNSIGNED_SHORT:
+      return sizeof (GLushort);
+    case GL_UNSIGNED_INT:
+      return sizeof (GLuint);
+    default:
+      g_assert_not_reached ();
+      return 0;
+  }
+}
+
+/**
+ * gst_3d_mesh_upload_index_buffer:
+ * @index_type: type of @indices, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+ * @index_count: number of indices, not bytes
+ *
+ * Uploads already packed indices and records their type for drawing.
+ */
+void
+gst_3d_mesh_upload_index_buffer (Gst3DMesh * self, GLenum index_type,
+    gconstpointer indices, guint index_count)
 {
   GstGLFuncs *gl = self->context->gl_vtable;
-  gl->DrawArrays (self->draw_mode, 0, self->index_size);
+
+  self->index_type = index_type;
+  self->index_count = index_count;
+  gst_3d_mesh_set_lods (self, NULL, 0);
+  gst_3d_mesh_set_parts (self, NULL, 0);
+  self->first_index = 0;
+
+  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices);
+  gl->BufferData (GL_ELEMENT_ARRAY_BUFFER,
+      index_count * gst_3d_mesh_index_type_size (index_type), indices,
+      _usage_hint (self));
+}
+
+/**
+ * gst_3d_mesh_upload_indices:
+ * @indices: (inout): 32 bit indices into the vertices of the mesh
+ *
+ * Uploads @indices with the smallest index type that can address
+ * vertex_count vertices. Meshes with up to 65536 vertices are packed to
+ * 16 bit in place, so @indices is not usable afterwards.
+ */
+void
+gst_3d_mesh_upload_indices (Gst3DMesh * self, guint32 * indices,
+    guint index_count)
+{
+  GLenum index_type = gst_3d_mesh_index_type_for_vertex_count (self->vertex_count);
+
+  if (index_type == GL_UNSIGNED_SHORT) {
+    /* writes always stay behind the reads, so packing in place is safe */
+    GLushort *packed = (GLushort *) indices;
+    for (guint i = 0; i < index_count; i++)
+      packed[i] = (GLushort) indices[i];
+  }
+
+  GST_DEBUG ("uploading %d %s indices for %d vertices", index_count,
+      index_type == GL_UNSIGNED_SHORT ? "16 bit" : "32 bit", self->vertex_count);
+
+  gst_3d_mesh_upload_index_buffer (self, index_type, indices, index_count);
 }
 
 void
@@ -254,25 +1490,28 @@ gst_3d_mesh_append_attribute_buffer (Gst3DMesh * self, const gchar * name,
   gl->BindBuffer (GL_ARRAY_BUFFER, attrib_buffer->location);
   gl->BufferData (GL_ARRAY_BUFFER, //顶点数据属性
                   self->vertex_count * attrib_buffer->vector_length * attrib_buffer->element_size, vertices, //存储数据的总数量 元素总数*单位元素存储空间
-                  GL_STATIC_DRAW);//设置分配数据之后的读取和写入方式
+                  _usage_hint (self));//设置分配数据之后的读取和写入方式
 
   self->attribute_buffers = g_list_append (self->attribute_buffers, attrib_buffer);//将 attrib_buffer 添加到 attribute_buffers(GList)中
 }
 
+typedef struct
+{
+  GLfloat position[3];
+  guint16 uv[2];
+} Gst3DPlaneVertex;
+
 void
 gst_3d_mesh_upload_plane (Gst3DMesh * self, float aspect)
 {
-  // g_print ("gst_3d_mesh_upload_plane aspect:%f.\n", aspect);
-  GstGLFuncs *gl = self->context->gl_vtable;
-
   /* *INDENT-OFF* */
-  GLfloat vertices[] = {
-     -aspect,  1.0,  0.0, 1.0,
-      aspect,  1.0,  0.0, 1.0,
-      aspect, -1.0,  0.0, 1.0,
-     -aspect, -1.0,  0.0, 1.0
+  const GLfloat positions[] = {
+     -aspect,  1.0,  0.0,
+      aspect,  1.0,  0.0,
+      aspect, -1.0,  0.0,
+     -aspect, -1.0,  0.0
   };
-  GLfloat uvs[] = {
+  const GLfloat uvs[] = {
      0.0, 1.0,
      1.0, 1.0,
      1.0, 0.0,
@@ -281,26 +1520,33 @@ gst_3d_mesh_upload_plane (Gst3DMesh * self, float aspect)
   /* *INDENT-ON* */
   const GLushort indices[] = { 0, 1, 2, 3, 0 };
 
-  self->vertex_count = 4;
-  self->draw_mode = GL_TRIANGLE_STRIP;
+  Gst3DPlaneVertex vertices[4];
+  Gst3DVertexLayout layout;
+
+  for (guint i = 0; i < G_N_ELEMENTS (vertices); i++) {
+    memcpy (vertices[i].position, &positions[i * 3], sizeof (GLfloat) * 3);
+    vertices[i].uv[0] = gst_3d_vertex_pack_half (uvs[i * 2]);
+    vertices[i].uv[1] = gst_3d_vertex_pack_half (uvs[i * 2 + 1]);
+  }
 
-  gst_3d_mesh_append_attribute_buffer (self, "position", sizeof (GLfloat), 4,
-      vertices);
-  gst_3d_mesh_append_attribute_buffer (self, "uv", sizeof (GLfloat), 2, uvs);
+  gst_3d_vertex_layout_init (&layout);
+  gst_3d_vertex_layout_add (&layout, "position", 3, GL_FLOAT, GL_FALSE);
+  gst_3d_vertex_layout_add (&layout, "uv", 2, GL_HALF_FLOAT, GL_FALSE);
+  g_assert (layout.stride == sizeof (Gst3DPlaneVertex));
 
-  // index
-  self->index_size = sizeof (indices);  // /sizeof(indices[0])
-  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices);
-  gl->BufferData (GL_ELEMENT_ARRAY_BUFFER, self->index_size, indices, GL_STATIC_DRAW);
+  self->draw_mode = GL_TRIANGLE_STRIP;
+
+  gst_3d_mesh_upload_interleaved (self, &layout, vertices,
+      G_N_ELEMENTS (vertices));
+  gst_3d_mesh_upload_index_buffer (self, GL_UNSIGNED_SHORT, indices,
+      G_N_ELEMENTS (indices));
 }
 
 void
 gst_3d_mesh_upload_cube (Gst3DMesh * self)
 {
-  GstGLFuncs *gl = self->context->gl_vtable;
-
   /* *INDENT-OFF* */
-  GLfloat positions[] = {
+  const GLfloat positions[] = {
       /* front face */
        1.0,  1.0, -1.0,
        1.0, -1.0, -1.0,
@@ -333,8 +1579,7 @@ gst_3d_mesh_upload_cube (Gst3DMesh * self)
       -1.0,  1.0,  1.0
   };
 
-  /* *INDENT-OFF* */
-  GLfloat uvs[] = {
+  const GLfloat uvs[] = {
       /* front face */
        0.667, 0.5,
        0.667, 0.0,
@@ -398,7 +1643,7 @@ gst_3d_mesh_upload_cube (Gst3DMesh * self)
       //  0.0, 0.0
   };
 
-  GLushort indices[] = {
+  const GLushort indices[] = {
       0, 1, 2,
       0, 2, 3,
       4, 5, 6,
@@ -414,51 +1659,78 @@ gst_3d_mesh_upload_cube (Gst3DMesh * self)
   };
   /* *INDENT-ON* */
 
-  self->vertex_count = 4 * 6;
+  Gst3DPlaneVertex vertices[4 * 6];
+  Gst3DVertexLayout layout;
+
+  for (guint i = 0; i < G_N_ELEMENTS (vertices); i++) {
+    memcpy (vertices[i].position, &positions[i * 3], sizeof (GLfloat) * 3);
+    vertices[i].uv[0] = gst_3d_vertex_pack_half (uvs[i * 2]);
+    vertices[i].uv[1] = gst_3d_vertex_pack_half (uvs[i * 2 + 1]);
+  }
+
+  gst_3d_vertex_layout_init (&layout);
+  gst_3d_vertex_layout_add (&layout, "position", 3, GL_FLOAT, GL_FALSE);
+  gst_3d_vertex_layout_add (&layout, "uv", 2, GL_HALF_FLOAT, GL_FALSE);
+
   self->draw_mode = GL_TRIANGLES;
 
-  gst_3d_mesh_append_attribute_buffer (self, "position", sizeof (GLfloat), 3, positions);
-  gst_3d_mesh_append_attribute_buffer (self, "uv", sizeof (GLfloat), 2, uvs);
+  gst_3d_mesh_upload_interleaved (self, &layout, vertices,
+      G_N_ELEMENTS (vertices));
 
-  // index
-  self->index_size = sizeof (indices);
-  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices);
-  gl->BufferData (GL_ELEMENT_ARRAY_BUFFER, self->index_size, indices, GL_STATIC_DRAW);
+  gst_3d_mesh_upload_index_buffer (self, GL_UNSIGNED_SHORT, indices,
+      G_N_ELEMENTS (indices));
 }
 
 
-void
-gst_3d_mesh_upload_line (Gst3DMesh * self, graphene_vec3_t * from,
-                         graphene_vec3_t * to, graphene_vec3_t * color)
+typedef struct
 {
-  GstGLFuncs *gl = self->context->gl_vtable;
+  GLfloat position[3];
+  GLubyte color[4];
+} Gst3DLineVertex;
 
-  GLfloat vertices[] = {
-    graphene_vec3_get_x (from), graphene_vec3_get_y (from),
-    graphene_vec3_get_z (from), 1.0,
-    graphene_vec3_get_x (to), graphene_vec3_get_y (to),
-    graphene_vec3_get_z (to), 1.0
-  };
-  GLfloat colors[] = {
-    graphene_vec3_get_x (color), graphene_vec3_get_y (color),
-    graphene_vec3_get_z (color),
-    graphene_vec3_get_x (color), graphene_vec3_get_y (color),
-    graphene_vec3_get_z (color)
+/**
+ * gst_3d_mesh_data_new_line:
+ *
+ * Creates a GL_LINES segment with a color attribute, e.g. to batch
+ * several lines into one mesh.
+ */
+Gst3DMeshData *
+gst_3d_mesh_data_new_line (graphene_vec3_t * from, graphene_vec3_t * to,
+    graphene_vec3_t * color)
+{
+  const GLubyte rgba[] = {
+    (GLubyte) (CLAMP (graphene_vec3_get_x (color), 0.0, 1.0) * 255.0),
+    (GLubyte) (CLAMP (graphene_vec3_get_y (color), 0.0, 1.0) * 255.0),
+    (GLubyte) (CLAMP (graphene_vec3_get_z (color), 0.0, 1.0) * 255.0),
+    255
   };
+  Gst3DVertexLayout layout;
 
-  self->vertex_count = 2;
-  self->draw_mode = GL_LINES;
+  gst_3d_vertex_layout_init (&layout);
+  gst_3d_vertex_layout_add (&layout, "position", 3, GL_FLOAT, GL_FALSE);
+  /* color is a vec3 in the shader, the alpha byte only pads the vertex */
+  gst_3d_vertex_layout_add (&layout, "color", 4, GL_UNSIGNED_BYTE, GL_TRUE);
 
-  gst_3d_mesh_append_attribute_buffer (self, "position", sizeof (GLfloat), 4, vertices);
-  gst_3d_mesh_append_attribute_buffer (self, "color", sizeof (GLfloat), 3, colors);
+  Gst3DMeshData *data = gst_3d_mesh_data_new (&layout, 2, 2, GL_LINES);
+  Gst3DLineVertex *vertices = (Gst3DLineVertex *) data->vertices;
 
-  const GLushort indices[] = { 0, 1 };
+  graphene_vec3_to_float (from, vertices[0].position);
+  graphene_vec3_to_float (to, vertices[1].position);
+  memcpy (vertices[0].color, rgba, sizeof (rgba));
+  memcpy (vertices[1].color, rgba, sizeof (rgba));
+  data->indices[0] = 0;
+  data->indices[1] = 1;
 
-  // index
-  self->index_size = sizeof (indices);
-  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices);
-  gl->BufferData (GL_ELEMENT_ARRAY_BUFFER, self->index_size, indices, GL_STATIC_DRAW);
+  return data;
+}
 
+void
+gst_3d_mesh_upload_line (Gst3DMesh * self, graphene_vec3_t * from,
+                         graphene_vec3_t * to, graphene_vec3_t * color)
+{
+  Gst3DMeshData *data = gst_3d_mesh_data_new_line (from, to, color);
+  gst_3d_mesh_upload_data (self, data);
+  gst_3d_mesh_data_free (data);
 }
 
 
@@ -466,188 +1738,434 @@ void
 gst_3d_mesh_upload_point_plane (Gst3DMesh * self, unsigned width,
                                 unsigned height)
 {
-  GLfloat *vertices;
-  // GLfloat *texcoords;
-  GLuint *indices;
+  Gst3DVertexLayout layout;
+  guint vertex_count = width * height;
 
-  GstGLFuncs *gl = self->context->gl_vtable;
-
-  self->vertex_count = width * height;
-  const int component_size = sizeof (GLfloat) * self->vertex_count;
+  gst_3d_vertex_layout_init (&layout);
+  gst_3d_vertex_layout_add (&layout, "position", 3, GL_FLOAT, GL_FALSE);
 
-  vertices = (GLfloat *) malloc (component_size * 3);
-  // texcoords = (GLfloat *) malloc (component_size * 2);
-
-  GLfloat *v = vertices;
-  // GLfloat *t = texcoords;
+  GLfloat *v = gst_3d_mesh_map_vertices (self, &layout, vertex_count);
 
   float w_step = 2.0 / (float) width;
   float h_step = 2.0 / (float) height;
 
   float curent_w = -1.0;
-  /*
-    float u_step = 1.0 / (float) width;
-    float v_step = 1.0 / (float) height;
-
-    float curent_u = 0.0;
-  */
 
   for (int i = 0; i < width; i++) {
     float curent_h = -1.0;
-    // float curent_v = 0.0;
     for (int j = 0; j < height; j++) {
-
       *v++ = curent_w;
       *v++ = curent_h;
       *v++ = 0;
 
       curent_h += h_step;
-      /*
-       *t++ = curent_u;
-       *t++ = curent_v;
-       curent_v += v_step;
-       */
     }
-    // curent_u += u_step;
     curent_w += w_step;
   }
 
-  gst_3d_mesh_append_attribute_buffer (self, "position", sizeof (GLfloat), 3, vertices);
+  gst_3d_mesh_unmap_vertices (self);
 
   // linear index. TODO: do not use index at all here.
-  self->index_size = self->vertex_count;
-  indices = (GLuint *) malloc (sizeof (GLuint) * self->index_size);
-  GLuint *indextemp = indices;
-  for (int i = 0; i < self->index_size; i++) {
-    *indextemp++ = i;
-  }
+  GLenum index_type = gst_3d_mesh_index_type_for_vertex_count (vertex_count);
+  gpointer indices = gst_3d_mesh_map_indices (self, index_type, vertex_count);
+  for (guint i = 0; i < vertex_count; i++)
+    _write_index (indices, index_type, i, i);
+  gst_3d_mesh_unmap_indices (self);
 
-  // upload index
-  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices);
-  gl->BufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof (GLuint) * self->index_size, indices, GL_STATIC_DRAW);
   self->draw_mode = GL_POINTS;
 }
 
+static void
+_set_radius_bounds (Gst3DMesh * self, float radius)
+{
+  graphene_box_t bounds;
+  graphene_point3d_t min, max;
+
+  graphene_point3d_init (&min, -radius, -radius, -radius);
+  graphene_point3d_init (&max, radius, radius, radius);
+  graphene_box_init (&bounds, &min, &max);
+  gst_3d_mesh_set_bounds (self, &bounds);
+}
+
+/* Columns of a band of the sphere grid. Rows are walked band by band, so
+ * the previous row of a band is still in a 32 entry vertex cache when the
+ * next one reuses it, see gst_3d_mesh_compute_acmr(). */
+#define SPHERE_BAND_WIDTH 14
+
+/* triangle lists in the winding of the former strips, typed so the loops
+ * do not switch on the index type per element */
+#define SPHERE_BAND_INDICES(name, type)                                 \
+static void                                                             \
+name (type * restrict indices, guint stacks, guint slices)              \
+{                                                                       \
+  for (guint first = 0; first < stacks - 1; first += SPHERE_BAND_WIDTH) { \
+    guint last = MIN (first + SPHERE_BAND_WIDTH, stacks - 1);           \
+    for (guint i = 0; i < slices - 1; i++) {                            \
+      for (guint j = first; j < last; j++) {                            \
+        type a = i * stacks + j;                                        \
+        type b = a + stacks;                                            \
+        *indices++ = a;                                                 \
+        *indices++ = b;                                                 \
+        *indices++ = a + 1;                                             \
+        *indices++ = a + 1;                                             \
+        *indices++ = b;                                                 \
+        *indices++ = b + 1;                                             \
+      }                                                                 \
+    }                                                                   \
+  }                                                                     \
+}
+
+SPHERE_BAND_INDICES (_sphere_band_indices_16, guint16)
+SPHERE_BAND_INDICES (_sphere_band_indices_32, guint32)
+
+/**
+ * gst_3d_mesh_generate_sphere:
+ * @vertices: (out caller-allocates): room for @stacks * @slices vertices
+ *
+ * Fills @vertices with the sphere gst_3d_mesh_upload_sphere() draws. The
+ * trigonometry is done once per row and column, the inner loop only scales
+ * the tables and is left to the compiler to vectorize.
+ */
+void
+gst_3d_mesh_generate_sphere (Gst3DSphereVertex * vertices, float radius,
+    guint stacks, guint slices)
+{
+  float *tables = g_new (float, 3 * stacks);
+  float *restrict cos_phi = tables;
+  float *restrict sin_phi = tables + stacks;
+  float *restrict u = tables + 2 * stacks;
+
+  double const J = 1. / (double) (stacks - 1);
+  double const I = 1. / (double) (slices - 1);
+
+  for (guint j = 0; j < stacks; j++) {
+    double const phi = 2 * M_PI * j * J + M_PI / 2.0;
+    cos_phi[j] = cos (phi) * radius;
+    sin_phi[j] = sin (phi) * radius;
+    u[j] = j * J;
+  }
+
+  for (guint i = 0; i < slices; i++) {
+    double const theta = M_PI * i * I;
+    float const sin_theta = sin (theta);
+    float const y = -cos (theta) * radius;
+    float const v = i * I;
+    Gst3DSphereVertex *restrict row = vertices + i * stacks;
+
+    for (guint j = 0; j < stacks; j++) {
+      row[j].position[0] = sin_theta * cos_phi[j];
+      row[j].position[1] = y;
+      row[j].position[2] = sin_theta * sin_phi[j];
+      row[j].uv[0] = u[j];
+      row[j].uv[1] = v;
+    }
+  }
+
+  g_free (tables);
+}
+
 void
 gst_3d_mesh_upload_sphere (Gst3DMesh * self, float radius, unsigned stacks, unsigned slices)
 {
-  GLfloat *positions;
-  GLfloat *uvs;
-  GLushort *indices;
+  Gst3DVertexLayout layout;
 
-  GstGLFuncs *gl = self->context->gl_vtable;
+  gst_3d_vertex_layout_init (&layout);
+  gst_3d_vertex_layout_add (&layout, "position", 3, GL_FLOAT, GL_FALSE);
+  gst_3d_vertex_layout_add (&layout, "uv", 2, GL_FLOAT, GL_FALSE);
 
-  self->vertex_count = (slices + 1) * stacks;
-  const int component_size = sizeof (GLfloat) * self->vertex_count;
+  guint vertex_count = slices * stacks;
+  Gst3DSphereVertex *v = gst_3d_mesh_map_vertices (self, &layout, vertex_count);
+  gst_3d_mesh_generate_sphere (v, radius, stacks, slices);
+  gst_3d_mesh_unmap_vertices (self);
+  _set_radius_bounds (self, radius);
 
-  positions = (GLfloat *) malloc (component_size * 3);
-  uvs = (GLfloat *) malloc (component_size * 2);
+  /* index */
+  guint index_count = (slices - 1) * (stacks - 1) * 6;
+  GLenum index_type = gst_3d_mesh_index_type_for_vertex_count (vertex_count);
+  gpointer indices = gst_3d_mesh_map_indices (self, index_type, index_count);
 
-  GLfloat *v = positions;
-  GLfloat *t = uvs;
+  if (index_type == GL_UNSIGNED_SHORT)
+    _sphere_band_indices_16 (indices, stacks, slices);
+  else
+    _sphere_band_indices_32 (indices, stacks, slices);
 
-  float const J = 1. / (float) (stacks - 1);
-  float const I = 1. / (float) (slices - 1);
+  gst_3d_mesh_unmap_indices (self);
 
-  for (int i = 0; i < slices; i++) {
-    float const theta = M_PI * i * I;
-    for (int j = 0; j < stacks; j++) {
-      float const phi = 2 * M_PI * j * J + M_PI / 2.0;
+  self->draw_mode = GL_TRIANGLES;
+}
 
-      float const x = sin (theta) * cos (phi);
-      float const y = -cos (theta);
-      float const z = sin (phi) * sin (theta);
+/* Video frames are mapped with image right to +x, image down to +y and the
+ * frame center to -z, matching the equirectangular sphere. */
+static const gfloat front_lens_basis[3][3] = {
+  {1, 0, 0}, {0, 1, 0}, {0, 0, -1},
+};
 
-      *v++ = x * radius;
-      *v++ = y * radius;
-      *v++ = z * radius;
+static const gfloat back_lens_basis[3][3] = {
+  {-1, 0, 0}, {0, 1, 0}, {0, 0, 1},
+};
 
-      *t++ = j * J;
-      *t++ = i * I;
+static void
+_grid_indices (gpointer indices, GLenum index_type, guint * n, guint first,
+    guint columns, guint rows)
+{
+  for (guint i = 0; i < rows; i++) {
+    for (guint j = 0; j < columns; j++) {
+      guint a = first + i * (columns + 1) + j;
+      guint b = a + columns + 1;
+      _write_index (indices, index_type, (*n)++, a);
+      _write_index (indices, index_type, (*n)++, b);
+      _write_index (indices, index_type, (*n)++, a + 1);
+      _write_index (indices, index_type, (*n)++, a + 1);
+      _write_index (indices, index_type, (*n)++, b);
+      _write_index (indices, index_type, (*n)++, b + 1);
     }
   }
+}
 
-  gst_3d_mesh_append_attribute_buffer (self, "position", sizeof (GLfloat), 3,
-      positions);
-  gst_3d_mesh_append_attribute_buffer (self, "uv", sizeof (GLfloat), 2, uvs);
-
-  /* index */
-  self->index_size = (slices - 1) * stacks * 2;
-  // g_print ("gst_3d_mesh_upload_sphere index_size:%d.\n", self->index_size);
-  indices = (GLushort *) malloc (sizeof (GLushort) * self->index_size);
-  GLushort *indextemp = indices;
-
-  // -3 = minus caps slices - one to iterate over strips
-  for (int i = 0; i < slices - 1; i++) {
-    for (int j = 0; j < stacks; j++) {
-      *indextemp++ = i * stacks + j;
-      *indextemp++ = (i + 1) * stacks + j;
+/* A spherical cap around the optical axis of an equidistant lens, the
+ * distance from the lens center in the image grows linearly with the angle
+ * to the axis. */
+static Gst3DSphereVertex *
+_fisheye_cap (Gst3DSphereVertex * v, float radius, guint rings,
+    guint segments, const Gst3DFisheyeLens * lens,
+    const gfloat basis[3][3], gfloat max_angle)
+{
+  gfloat const half_fov = lens->fov * M_PI / 360.0;
+
+  for (guint k = 0; k <= rings; k++) {
+    gfloat const angle = max_angle * k / rings;
+    gfloat const r = angle / half_fov;
+    gfloat const sin_angle = sin (angle);
+    gfloat const cos_angle = cos (angle);
+
+    for (guint s = 0; s <= segments; s++) {
+      gfloat const alpha = 2 * M_PI * s / segments;
+      gfloat const right = sin_angle * cos (alpha);
+      gfloat const down = sin_angle * sin (alpha);
+
+      for (guint c = 0; c < 3; c++)
+        v->position[c] = radius * (right * basis[0][c] + down * basis[1][c]
+            + cos_angle * basis[2][c]);
+      v->uv[0] = lens->center[0] + r * lens->radius[0] * cos (alpha);
+      v->uv[1] = lens->center[1] + r * lens->radius[1] * sin (alpha);
+      v++;
     }
   }
 
-  /* linear index */
-  /*
-     self->index_size = (slices - 2) * stacks;
-     for (int i = 0; i < self->index_size; i++)
-     *indextemp++ = i;
-   */
+  return v;
+}
 
-  // upload index
-  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices);
-  gl->BufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof (GLushort) * self->index_size, indices, GL_STATIC_DRAW);
+/**
+ * gst_3d_mesh_upload_fisheye:
+ * @rings: subdivisions from the lens center to its rim
+ * @segments: subdivisions around the lens center
+ * @front: the lens looking at -z
+ * @back: (nullable): the lens looking at +z for dual fisheye video
+ *
+ * Uploads a sphere, or the part of it a single lens covers, whose texture
+ * coordinates sample fisheye video directly. Dual lenses with more than 180
+ * degrees field of view each only cover their hemisphere.
+ */
+void
+gst_3d_mesh_upload_fisheye (Gst3DMesh * self, float radius, guint rings,
+    guint segments, const Gst3DFisheyeLens * front,
+    const Gst3DFisheyeLens * back)
+{
+  Gst3DVertexLayout layout;
+  guint n_caps = back ? 2 : 1;
+  gfloat front_angle = front->fov * M_PI / 360.0;
+
+  if (back)
+    front_angle = MIN (front_angle, M_PI / 2.0);
+
+  gst_3d_vertex_layout_init (&layout);
+  gst_3d_vertex_layout_add (&layout, "position", 3, GL_FLOAT, GL_FALSE);
+  gst_3d_vertex_layout_add (&layout, "uv", 2, GL_FLOAT, GL_FALSE);
+
+  guint cap_vertices = (rings + 1) * (segments + 1);
+  guint vertex_count = n_caps * cap_vertices;
+  Gst3DSphereVertex *v = gst_3d_mesh_map_vertices (self, &layout, vertex_count);
+  v = _fisheye_cap (v, radius, rings, segments, front, front_lens_basis,
+      front_angle);
+  if (back)
+    _fisheye_cap (v, radius, rings, segments, back, back_lens_basis,
+        MIN (back->fov * M_PI / 360.0, M_PI / 2.0));
+  gst_3d_mesh_unmap_vertices (self);
+  _set_radius_bounds (self, radius);
+
+  guint index_count = n_caps * rings * segments * 6;
+  GLenum index_type = gst_3d_mesh_index_type_for_vertex_count (vertex_count);
+  gpointer indices = gst_3d_mesh_map_indices (self, index_type, index_count);
+  guint n = 0;
+  for (guint i = 0; i < n_caps; i++)
+    _grid_indices (indices, index_type, &n, i * cap_vertices, segments, rings);
+  gst_3d_mesh_unmap_indices (self);
 
-  self->draw_mode = GL_TRIANGLE_STRIP;
+  self->draw_mode = GL_TRIANGLES;
 }
 
-#include <assimp/cimport.h>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
-
+typedef struct
+{
+  /* tile in the 3x2 frame */
+  guint column, row;
+  gfloat normal[3];
+  /* directions of image right and image down on the face */
+  gfloat right[3];
+  gfloat down[3];
+} Gst3DCubeFace;
+
+/* The 3x2 layout of YouTube's equi-angular cubemaps: left, front and right
+ * on top, bottom, back and top below, rotated a quarter turn clockwise. */
+static const Gst3DCubeFace cube_faces[6] = {
+  {0, 0, {-1, 0, 0}, {0, 0, -1}, {0, 1, 0}},
+  {1, 0, {0, 0, -1}, {1, 0, 0}, {0, 1, 0}},
+  {2, 0, {1, 0, 0}, {0, 0, 1}, {0, 1, 0}},
+  {0, 1, {0, 1, 0}, {0, 0, -1}, {1, 0, 0}},
+  {1, 1, {0, 0, 1}, {0, -1, 0}, {-1, 0, 0}},
+  {2, 1, {0, -1, 0}, {0, 0, 1}, {1, 0, 0}},
+};
+
+/**
+ * gst_3d_mesh_upload_cubemap:
+ * @subdivisions: quads along each edge of a face
+ * @equiangular: whether the faces sample the video linearly in angle (EAC)
+ *   or linearly on the cube face
+ *
+ * Uploads a sphere made of six subdivided cube faces whose texture
+ * coordinates sample a 3x2 cubemap frame directly.
+ */
 void
-gst_3d_mesh_upload_assimp (Gst3DMesh * self, const char *file)
+gst_3d_mesh_upload_cubemap (Gst3DMesh * self, float radius,
+    guint subdivisions, gboolean equiangular)
 {
-  GstGLFuncs *gl = self->context->gl_vtable;
+  Gst3DVertexLayout layout;
+
+  gst_3d_vertex_layout_init (&layout);
+  gst_3d_vertex_layout_add (&layout, "position", 3, GL_FLOAT, GL_FALSE);
+  gst_3d_vertex_layout_add (&layout, "uv", 2, GL_FLOAT, GL_FALSE);
+
+  guint face_vertices = (subdivisions + 1) * (subdivisions + 1);
+  guint vertex_count = 6 * face_vertices;
+  Gst3DSphereVertex *v = gst_3d_mesh_map_vertices (self, &layout, vertex_count);
+
+  for (guint f = 0; f < 6; f++) {
+    const Gst3DCubeFace *face = &cube_faces[f];
+    for (guint i = 0; i <= subdivisions; i++) {
+      gfloat const t = (gfloat) i / subdivisions;
+      gfloat const b = equiangular ? tan ((t - 0.5) * M_PI / 2.0) : 2 * t - 1;
+      for (guint j = 0; j <= subdivisions; j++) {
+        gfloat const s = (gfloat) j / subdivisions;
+        gfloat const a = equiangular ? tan ((s - 0.5) * M_PI / 2.0) : 2 * s - 1;
+        graphene_vec3_t p;
+
+        graphene_vec3_init (&p,
+            face->normal[0] + a * face->right[0] + b * face->down[0],
+            face->normal[1] + a * face->right[1] + b * face->down[1],
+            face->normal[2] + a * face->right[2] + b * face->down[2]);
+        graphene_vec3_normalize (&p, &p);
+        graphene_vec3_scale (&p, radius, &p);
+
+        v->position[0] = graphene_vec3_get_x (&p);
+        v->position[1] = graphene_vec3_get_y (&p);
+        v->position[2] = graphene_vec3_get_z (&p);
+        v->uv[0] = (face->column + s) / 3.0;
+        v->uv[1] = (face->row + t) / 2.0;
+        v++;
+      }
+    }
+  }
 
-  const struct aiScene *scene = NULL;
-  scene = aiImportFile (file, 0);
+  gst_3d_mesh_unmap_vertices (self);
+  _set_radius_bounds (self, radius);
 
+  guint index_count = 6 * subdivisions * subdivisions * 6;
+  GLenum index_type = gst_3d_mesh_index_type_for_vertex_count (vertex_count);
+  gpointer indices = gst_3d_mesh_map_indices (self, index_type, index_count);
+  guint n = 0;
+  for (guint f = 0; f < 6; f++)
+    _grid_indices (indices, index_type, &n, f * face_vertices, subdivisions,
+        subdivisions);
+  gst_3d_mesh_unmap_indices (self);
 
-  const struct aiMesh *assimp_mesh = scene->mMeshes[scene->mRootNode->mChildren[0]->mMeshes[0]];
+  self->draw_mode = GL_TRIANGLES;
+}
 
-  GST_ERROR ("Uploading %s with %d verts", file, assimp_mesh->mNumVertices);
+#include <assimp/cimport.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
 
-  // GLfloat *normals = malloc(3 * mesh->mNumVertices *sizeof(float));
+typedef struct
+{
+  GLfloat position[3];
+  GLfloat uv[2];
+} Gst3DAssimpVertex;
 
-  GLfloat *positions = malloc (3 * assimp_mesh->mNumVertices * sizeof (GLfloat));
-  for (int i = 0; i < assimp_mesh->mNumVertices; ++i) {
-    positions[i * 3] = assimp_mesh->mVertices[i].x;
-    positions[i * 3 + 1] = assimp_mesh->mVertices[i].y;
-    positions[i * 3 + 2] = assimp_mesh->mVertices[i].z;
+void
+gst_3d_mesh_upload_assimp (Gst3DMesh * self, const char *file)
+{
+  const struct aiScene *scene = aiImportFile (file, aiProcess_Triangulate);
+  Gst3DVertexLayout layout;
+
+  if (!scene || !scene->mRootNode || scene->mRootNode->mNumChildren == 0
+      || scene->mRootNode->mChildren[0]->mNumMeshes == 0) {
+    GST_WARNING ("Unable to import a mesh from %s: %s", file,
+        aiGetErrorString ());
+    if (scene)
+      aiReleaseImport (scene);
+    return;
   }
 
-  GLfloat *uvs = malloc (2 * assimp_mesh->mNumVertices * sizeof (GLfloat));
-  for (int i = 0; i < assimp_mesh->mNumVertices; ++i) {
-    uvs[i * 2] = assimp_mesh->mTextureCoords[0][i].x;
-    uvs[i * 2 + 1] = assimp_mesh->mTextureCoords[0][i].y;
+  const struct aiMesh *assimp_mesh = scene->mMeshes[scene->mRootNode->mChildren[0]->mMeshes[0]];
+  guint vertex_count = assimp_mesh->mNumVertices;
+
+  GST_DEBUG ("Uploading %s with %d verts", file, vertex_count);
+
+  gst_3d_vertex_layout_init (&layout);
+  gst_3d_vertex_layout_add (&layout, "position", 3, GL_FLOAT, GL_FALSE);
+  gst_3d_vertex_layout_add (&layout, "uv", 2, GL_FLOAT, GL_FALSE);
+
+  graphene_box_t bounds;
+  graphene_box_init_from_box (&bounds, graphene_box_empty ());
+
+  Gst3DAssimpVertex *v = gst_3d_mesh_map_vertices (self, &layout, vertex_count);
+  for (int i = 0; i < vertex_count; ++i) {
+    graphene_point3d_t p;
+    graphene_point3d_init (&p, assimp_mesh->mVertices[i].x,
+        assimp_mesh->mVertices[i].y, assimp_mesh->mVertices[i].z);
+    graphene_box_expand (&bounds, &p, &bounds);
+
+    v[i].position[0] = p.x;
+    v[i].position[1] = p.y;
+    v[i].position[2] = p.z;
+    if (assimp_mesh->mTextureCoords[0]) {
+      v[i].uv[0] = assimp_mesh->mTextureCoords[0][i].x;
+      v[i].uv[1] = assimp_mesh->mTextureCoords[0][i].y;
+    } else {
+      v[i].uv[0] = v[i].uv[1] = 0.0;
+    }
   }
+  gst_3d_mesh_unmap_vertices (self);
+  gst_3d_mesh_set_bounds (self, &bounds);
 
-  GLushort *indices = malloc (3 * assimp_mesh->mNumFaces * sizeof (GLushort));
-
+  /* files list faces in authoring order, reorder them for the cache */
+  guint index_count = 3 * assimp_mesh->mNumFaces;
+  guint32 *face_indices = g_new (guint32, index_count);
   for (int i = 0; i < assimp_mesh->mNumFaces; ++i) {
-    indices[i * 3] = assimp_mesh->mFaces[i].mIndices[0];
-    indices[i * 3 + 1] = assimp_mesh->mFaces[i].mIndices[1];
-    indices[i * 3 + 2] = assimp_mesh->mFaces[i].mIndices[2];
+    const struct aiFace *face = &assimp_mesh->mFaces[i];
+    for (int j = 0; j < 3; j++)
+      face_indices[i * 3 + j] =
+          j < face->mNumIndices ? face->mIndices[j] : face->mIndices[0];
   }
+  gst_3d_mesh_optimize_vertex_cache (face_indices, index_count, vertex_count);
 
-  self->vertex_count = assimp_mesh->mNumVertices;
-  self->draw_mode = GL_TRIANGLES;
-  //mesh->draw_mode = GL_LINE_STRIP;
+  GLenum index_type = gst_3d_mesh_index_type_for_vertex_count (vertex_count);
+  gpointer indices = gst_3d_mesh_map_indices (self, index_type, index_count);
+  for (guint i = 0; i < index_count; i++)
+    _write_index (indices, index_type, i, face_indices[i]);
+  gst_3d_mesh_unmap_indices (self);
+  g_free (face_indices);
 
-  gst_3d_mesh_append_attribute_buffer (self, "position", sizeof (GLfloat), 3, positions);
-  gst_3d_mesh_append_attribute_buffer (self, "uv", sizeof (GLfloat), 2, uvs);
+  self->draw_mode = GL_TRIANGLES;
 
-  // index
-  self->index_size = 3 * assimp_mesh->mNumFaces * sizeof (GLushort);
-  gl->BindBuffer (GL_ELEMENT_ARRAY_BUFFER, self->vbo_indices);
-  gl->BufferData (GL_ELEMENT_ARRAY_BUFFER, self->index_size, indices, GL_STATIC_DRAW);
+  aiReleaseImport (scene);
 }
@@ -46,6 +46,115 @@ struct Gst3DAttributeBuffer
   guint vector_length;
 };
 
+#define GST_3D_VERTEX_LAYOUT_MAX_ATTRIBUTES 8
+#define GST_3D_VERTEX_ATTRIBUTE_NAME_LENGTH 16
+
+/* One attribute of an interleaved vertex, see Gst3DVertexLayout. */
+typedef struct _Gst3DVertexAttribute
+{
+  gchar name[GST_3D_VERTEX_ATTRIBUTE_NAME_LENGTH];
+  GLint components;
+  GLenum type;
+  GLboolean normalized;
+  guint offset;
+} Gst3DVertexAttribute;
+
+/* Describes the vertex format of a mesh that keeps all of its attributes
+ * interleaved in a single vertex buffer. */
+typedef struct _Gst3DVertexLayout
+{
+  Gst3DVertexAttribute attributes[GST_3D_VERTEX_LAYOUT_MAX_ATTRIBUTES];
+  guint n_attributes;
+  guint stride;
+} Gst3DVertexLayout;
+
+
+/* How often the geometry of a mesh changes, see gst_3d_mesh_set_usage(). */
+typedef enum
+{
+  GST_3D_MESH_USAGE_STATIC,
+  /* updated now and then, e.g. on caps changes */
+  GST_3D_MESH_USAGE_DYNAMIC,
+  /* updated every frame */
+  GST_3D_MESH_USAGE_STREAM,
+} Gst3DMeshUsage;
+
+/* copies of the vertices of streamed meshes, one is written while the GPU
+ * may still read the others */
+#define GST_3D_MESH_STREAM_REGIONS 3
+
+/* Sphere levels of detail, level n has 8 << n rings of latitude and twice
+ * as many segments of longitude, see gst_3d_mesh_sphere_lod_for_density() */
+#define GST_3D_MESH_SPHERE_LODS 7
+/* largest visible error of the faceted sphere in pixels */
+#define GST_3D_MESH_SPHERE_LOD_TOLERANCE 0.5
+
+/* vertex of gst_3d_mesh_upload_sphere(), uv keeps full precision since half
+ * floats can not address single texels of 8K video */
+typedef struct _Gst3DSphereVertex
+{
+  gfloat position[3];
+  gfloat uv[2];
+} Gst3DSphereVertex;
+
+/* layouts of 360 degree video the mesh texture coordinates can sample */
+typedef enum
+{
+  GST_3D_MESH_PROJECTION_EQUIRECTANGULAR,
+  GST_3D_MESH_PROJECTION_FISHEYE,
+  GST_3D_MESH_PROJECTION_DUAL_FISHEYE,
+  GST_3D_MESH_PROJECTION_EAC,
+  GST_3D_MESH_PROJECTION_CUBEMAP,
+} Gst3DMeshProjection;
+
+/* An equidistant fisheye lens, center and radius in texture coordinates and
+ * field of view in degrees. */
+typedef struct _Gst3DFisheyeLens
+{
+  gfloat center[2];
+  gfloat radius[2];
+  gfloat fov;
+} Gst3DFisheyeLens;
+
+/* A level of detail, a range of the index buffer. */
+typedef struct _Gst3DMeshLod
+{
+  guint first_index;
+  guint index_count;
+  /* geometric error of the level in model units */
+  gfloat error;
+} Gst3DMeshLod;
+
+/* A range of the index buffer that came from one source mesh of a batch,
+ * see gst_3d_mesh_data_batch(). */
+typedef struct _Gst3DMeshPart
+{
+  guint first_index;
+  guint index_count;
+  graphene_vec4_t diffuse_color;
+} Gst3DMeshPart;
+
+/* Geometry prepared on the CPU, e.g. on a loader thread, in the format it
+ * will have on the GPU. Upload it with gst_3d_mesh_upload_data(). */
+typedef struct _Gst3DMeshData
+{
+  Gst3DVertexLayout layout;
+  guint8 *vertices;
+  guint vertex_count;
+
+  guint32 *indices;
+  guint index_count;
+
+  /* Gst3DMeshLod ranges of indices, NULL for a single level */
+  GArray *lods;
+  /* Gst3DMeshPart ranges of indices, NULL if not batched */
+  GArray *parts;
+
+  GLenum draw_mode;
+
+  graphene_vec4_t diffuse_color;
+  gchar *diffuse_texture;
+} Gst3DMeshData;
 
 struct _Gst3DMesh
 {
@@ -56,13 +165,51 @@ struct _Gst3DMesh
 
   GList *attribute_buffers;
 
+  /* interleaved vertices, 0 when attribute_buffers are used */
+  Gst3DVertexLayout layout;
+  guint vbo_vertices;
+
+  /* material, not used by the built in shaders */
+  graphene_vec4_t diffuse_color;
+  gchar *diffuse_texture;
+
+  /* scratch memory while mapped without glMapBufferRange, NULL otherwise */
+  gpointer vertex_scratch;
+  gpointer index_scratch;
+
+  Gst3DMeshUsage usage;
+  /* CPU copy of the vertices of meshes that are not static */
+  guint8 *shadow_vertices;
+  /* region of the vertex buffer the vertex array points to, and fences
+   * for the draws reading each region */
+  guint stream_region;
+  GLsync stream_fences[GST_3D_MESH_STREAM_REGIONS];
+  /* shader locations of the layout attributes, -1 when unused */
+  GLint attribute_locations[GST_3D_VERTEX_LAYOUT_MAX_ATTRIBUTES];
+
   guint vao;
   guint vbo_indices;
 
-  guint index_size;
+  /* number of indices, not bytes */
+  guint index_count;
+  /* GL_UNSIGNED_SHORT or GL_UNSIGNED_INT */
+  GLenum index_type;
   guint vertex_count;
 
+  /* range of the index buffer that is drawn, see gst_3d_mesh_set_lod() */
+  guint first_index;
+  GArray *lods;
+  /* Gst3DMeshPart ranges of batched meshes, see gst_3d_mesh_draw_part() */
+  GArray *parts;
+
   GLenum draw_mode;
+
+  /* model space bounds, unknown meshes are never culled */
+  gboolean has_bounds;
+  graphene_box_t bounds;
+  graphene_sphere_t bounding_sphere;
+  /* changes with the bounds, nodes compare it to notice updates */
+  guint bounds_generation;
 };
 
 struct _Gst3DMeshClass
@@ -82,14 +229,28 @@ Gst3DMesh * gst_3d_mesh_new_cube (GstGLContext * context);
 
 Gst3DMesh * gst_3d_mesh_new_assimp (GstGLContext * context, const char *file);
 
+Gst3DMesh * gst_3d_mesh_cache_get_sphere (GstGLContext * context, float radius, unsigned stacks, unsigned slices);
+Gst3DMesh * gst_3d_mesh_cache_get_sphere_lod (GstGLContext * context, float radius, guint level);
+Gst3DMesh * gst_3d_mesh_cache_get_plane (GstGLContext * context, float aspect);
+Gst3DMesh * gst_3d_mesh_cache_get_cube (GstGLContext * context);
+
 void gst_3d_mesh_init_buffers (Gst3DMesh * self);
 void gst_3d_mesh_unbind_buffers (Gst3DMesh * self);
 void gst_3d_mesh_bind_shader (Gst3DMesh * self, Gst3DShader * shader);
 void gst_3d_mesh_bind (Gst3DMesh * self);
 void gst_3d_mesh_draw (Gst3DMesh * self);
 void gst_3d_mesh_draw_mode (Gst3DMesh * self, GLenum draw_mode);
+void gst_3d_mesh_draw_instanced (Gst3DMesh * self, GLenum draw_mode, guint instance_count);
+void gst_3d_mesh_set_bounds (Gst3DMesh * self, const graphene_box_t * bounds);
+void gst_3d_mesh_set_lods (Gst3DMesh * self, const Gst3DMeshLod * lods, guint n_lods);
+void gst_3d_mesh_set_lod (Gst3DMesh * self, guint level);
+void gst_3d_mesh_set_parts (Gst3DMesh * self, const Gst3DMeshPart * parts, guint n_parts);
+void gst_3d_mesh_draw_part (Gst3DMesh * self, GLenum draw_mode, guint part);
 
+void gst_3d_mesh_generate_sphere (Gst3DSphereVertex * vertices, float radius, guint stacks, guint slices);
 void gst_3d_mesh_upload_sphere (Gst3DMesh * self, float radius, unsigned stacks, unsigned slices);
+void gst_3d_mesh_upload_fisheye (Gst3DMesh * self, float radius, guint rings, guint segments, const Gst3DFisheyeLens * front, const Gst3DFisheyeLens * back);
+void gst_3d_mesh_upload_cubemap (Gst3DMesh * self, float radius, guint subdivisions, gboolean equiangular);
 void gst_3d_mesh_upload_plane (Gst3DMesh * self, float aspect);
 void gst_3d_mesh_upload_point_plane (Gst3DMesh * self, unsigned width, unsigned height);
 void gst_3d_mesh_upload_line (Gst3DMesh * self, graphene_vec3_t *from, graphene_vec3_t *to,  graphene_vec3_t *color);
@@ -101,6 +262,41 @@ void gst_3d_mesh_upload_assimp(Gst3DMesh * self, const char* file);
 void
 gst_3d_mesh_append_attribute_buffer(Gst3DMesh * self, const gchar* name, size_t element_size, guint vector_length, GLfloat *vertices);
 
+void gst_3d_mesh_upload_interleaved (Gst3DMesh * self, const Gst3DVertexLayout * layout, gconstpointer vertices, guint vertex_count);
+
+Gst3DMeshData * gst_3d_mesh_data_new (const Gst3DVertexLayout * layout, guint vertex_count, guint index_count, GLenum draw_mode);
+Gst3DMeshData * gst_3d_mesh_data_new_line (graphene_vec3_t * from, graphene_vec3_t * to, graphene_vec3_t * color);
+void gst_3d_mesh_data_free (Gst3DMeshData * data);
+gsize gst_3d_mesh_data_get_size (const Gst3DMeshData * data);
+void gst_3d_mesh_upload_data (Gst3DMesh * self, const Gst3DMeshData * data);
+
+gpointer gst_3d_mesh_map_vertices (Gst3DMesh * self, const Gst3DVertexLayout * layout, guint vertex_count);
+void gst_3d_mesh_unmap_vertices (Gst3DMesh * self);
+gpointer gst_3d_mesh_map_indices (Gst3DMesh * self, GLenum index_type, guint index_count);
+void gst_3d_mesh_unmap_indices (Gst3DMesh * self);
+
+void gst_3d_mesh_sphere_lod_get_size (guint level, guint * stacks, guint * slices);
+guint gst_3d_mesh_sphere_lod_for_density (gfloat pixels_per_radian, gfloat tolerance);
+
+void gst_3d_mesh_set_usage (Gst3DMesh * self, Gst3DMeshUsage usage);
+void gst_3d_mesh_update_vertices (Gst3DMesh * self, guint first_vertex, guint vertex_count, gconstpointer vertices);
+void gst_3d_mesh_update_attribute (Gst3DMesh * self, const gchar * name, guint first_vertex, guint vertex_count, gconstpointer values);
+void gst_3d_mesh_update_indices (Gst3DMesh * self, guint first_index, guint index_count, const guint32 * indices);
+void gst_3d_mesh_replace_indices (Gst3DMesh * self, guint index_count, const guint32 * indices);
+
+void gst_3d_vertex_layout_init (Gst3DVertexLayout * layout);
+void gst_3d_vertex_layout_add (Gst3DVertexLayout * layout, const gchar * name, GLint components, GLenum type, GLboolean normalized);
+const Gst3DVertexAttribute * gst_3d_vertex_layout_find (const Gst3DVertexLayout * layout, const gchar * name);
+gsize gst_3d_vertex_attribute_size (GLint components, GLenum type);
+
+guint32 gst_3d_vertex_pack_normal (gfloat x, gfloat y, gfloat z);
+guint16 gst_3d_vertex_pack_half (gfloat value);
+
+GLenum gst_3d_mesh_index_type_for_vertex_count (guint vertex_count);
+gsize gst_3d_mesh_index_type_size (GLenum index_type);
+void gst_3d_mesh_upload_index_buffer (Gst3DMesh * self, GLenum index_type, gconstpointer indices, guint index_count);
+void gst_3d_mesh_upload_indices (Gst3DMesh * self, guint32 * indices, guint index_count);
+
 GType gst_3d_mesh_get_type (void);
 
 G_END_DECLS
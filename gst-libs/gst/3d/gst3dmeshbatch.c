@@ -0,0 +1,197 @@
+/*
+ * GStreamer Plugins VR
+ * Copyright (C) 2016 Lubosz Sarnecki <lubosz.sarnecki@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#define GST_USE_UNSTABLE_API
+#include <gst/gl/gl.h>
+
+#include "gst3dmeshbatch.h"
+
+static gboolean
+_layouts_equal (const Gst3DVertexLayout * a, const Gst3DVertexLayout * b)
+{
+  if (a->stride != b->stride || a->n_attributes != b->n_attributes)
+    return FALSE;
+
+  for (guint i = 0; i < a->n_attributes; i++) {
+    const Gst3DVertexAttribute *attr_a = &a->attributes[i];
+    const Gst3DVertexAttribute *attr_b = &b->attributes[i];
+    if (g_strcmp0 (attr_a->name, attr_b->name) != 0
+        || attr_a->components != attr_b->components
+        || attr_a->type != attr_b->type
+        || attr_a->normalized != attr_b->normalized
+        || attr_a->offset != attr_b->offset)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * gst_3d_mesh_data_can_batch:
+ *
+ * Returns: %TRUE if @a and @b can be drawn as one mesh. Strips and levels
+ * of detail can not be concatenated.
+ */
+gboolean
+gst_3d_mesh_data_can_batch (const Gst3DMeshData * a, const Gst3DMeshData * b)
+{
+  if (a->draw_mode != b->draw_mode)
+    return FALSE;
+  if (a->draw_mode != GL_TRIANGLES && a->draw_mode != GL_LINES
+      && a->draw_mode != GL_POINTS)
+    return FALSE;
+  if (a->lods || b->lods)
+    return FALSE;
+  if (g_strcmp0 (a->diffuse_texture, b->diffuse_texture) != 0)
+    return FALSE;
+  return _layouts_equal (&a->layout, &b->layout);
+}
+
+/**
+ * gst_3d_mesh_data_batch:
+ * @meshes: (array length=n_meshes): meshes that can be batched with the
+ *   first one, see gst_3d_mesh_data_can_batch()
+ *
+ * Concatenates the vertices and indices of @meshes. Every mesh becomes a
+ * part of the result, already batched meshes keep their parts.
+ *
+ * Returns: (transfer full): the batched mesh
+ */
+Gst3DMeshData *
+gst_3d_mesh_data_batch (Gst3DMeshData * const *meshes, guint n_meshes)
+{
+  guint vertex_count = 0;
+  guint index_count = 0;
+  guint part_count = 0;
+
+  g_return_val_if_fail (n_meshes > 0, NULL);
+
+  for (guint i = 0; i < n_meshes; i++) {
+    g_return_val_if_fail (gst_3d_mesh_data_can_batch (meshes[0], meshes[i]),
+        NULL);
+    vertex_count += meshes[i]->vertex_count;
+    index_count += meshes[i]->index_count;
+    part_count += meshes[i]->parts ? meshes[i]->parts->len : 1;
+  }
+
+  const Gst3DMeshData *first = meshes[0];
+  gsize stride = first->layout.stride;
+  Gst3DMeshData *batch = gst_3d_mesh_data_new (&first->layout, vertex_count,
+      index_count, first->draw_mode);
+  batch->diffuse_color = first->diffuse_color;
+  batch->diffuse_texture = g_strdup (first->diffuse_texture);
+  batch->parts = g_array_sized_new (FALSE, FALSE, sizeof (Gst3DMeshPart),
+      part_count);
+
+  guint first_vertex = 0;
+  guint first_index = 0;
+  for (guint i = 0; i < n_meshes; i++) {
+    const Gst3DMeshData *mesh = meshes[i];
+
+    memcpy (batch->vertices + first_vertex * stride, mesh->vertices,
+        mesh->vertex_count * stride);
+    for (guint j = 0; j < mesh->index_count; j++)
+      batch->indices[first_index + j] = mesh->indices[j] + first_vertex;
+
+    if (mesh->parts) {
+      for (guint j = 0; j < mesh->parts->len; j++) {
+        Gst3DMeshPart part = g_array_index (mesh->parts, Gst3DMeshPart, j);
+        part.first_index += first_index;
+        g_array_append_val (batch->parts, part);
+      }
+    } else {
+      Gst3DMeshPart part = {
+        .first_index = first_index,
+        .index_count = mesh->index_count,
+        .diffuse_color = mesh->diffuse_color,
+      };
+      g_array_append_val (batch->parts, part);
+    }
+
+    first_vertex += mesh->vertex_count;
+    first_index += mesh->index_count;
+  }
+
+  return batch;
+}
+
+/**
+ * gst_3d_mesh_data_batch_all:
+ * @meshes: (transfer full) (element-type Gst3DMeshData): meshes of a node
+ *
+ * Groups @meshes into as few batches as possible, keeping the order of
+ * the first mesh of every group. Meshes that fit no batch are passed on
+ * unchanged.
+ *
+ * Returns: (transfer full) (element-type Gst3DMeshData): the batches
+ */
+GPtrArray *
+gst_3d_mesh_data_batch_all (GPtrArray * meshes)
+{
+  GPtrArray *batches =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) gst_3d_mesh_data_free);
+  GPtrArray *group = g_ptr_array_new ();
+  gboolean *taken = g_new0 (gboolean, meshes->len);
+
+  for (guint i = 0; i < meshes->len; i++) {
+    if (taken[i])
+      continue;
+
+    Gst3DMeshData *first = g_ptr_array_index (meshes, i);
+    guint vertex_count = first->vertex_count;
+
+    g_ptr_array_set_size (group, 0);
+    g_ptr_array_add (group, first);
+    for (guint j = i + 1; j < meshes->len; j++) {
+      Gst3DMeshData *mesh = g_ptr_array_index (meshes, j);
+      if (taken[j] || !gst_3d_mesh_data_can_batch (first, mesh)
+          || vertex_count + mesh->vertex_count >
+          GST_3D_MESH_BATCH_MAX_VERTICES)
+        continue;
+      g_ptr_array_add (group, mesh);
+      vertex_count += mesh->vertex_count;
+      taken[j] = TRUE;
+    }
+
+    if (group->len == 1) {
+      g_ptr_array_add (batches, first);
+      continue;
+    }
+
+    g_ptr_array_add (batches, gst_3d_mesh_data_batch ((Gst3DMeshData * const *)
+            group->pdata, group->len));
+    for (guint j = 0; j < group->len; j++)
+      gst_3d_mesh_data_free (g_ptr_array_index (group, j));
+  }
+
+  g_free (taken);
+  g_ptr_array_unref (group);
+  /* the meshes are owned by the batches or freed now */
+  g_ptr_array_set_free_func (meshes, NULL);
+  g_ptr_array_unref (meshes);
+
+  return batches;
+}
@@ -0,0 +1,44 @@
+/*
+ * GStreamer Plugins VR
+ * Copyright (C) 2016 Lubosz Sarnecki <lubosz.sarnecki@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_3D_MESH_BATCH_H__
+#define __GST_3D_MESH_BATCH_H__
+
+
+#include <gst/gst.h>
+
+#include "gst3dmesh.h"
+
+G_BEGIN_DECLS
+
+/* Static batching, done on the CPU when loading. Meshes with the same
+ * vertex layout, draw mode and texture are merged into one set of buffers
+ * that is drawn with a single call, each source mesh stays addressable as
+ * a Gst3DMeshPart. */
+
+/* batches stay small enough for 16 bit indices */
+#define GST_3D_MESH_BATCH_MAX_VERTICES (G_MAXUINT16 + 1)
+
+gboolean gst_3d_mesh_data_can_batch (const Gst3DMeshData * a, const Gst3DMeshData * b);
+Gst3DMeshData * gst_3d_mesh_data_batch (Gst3DMeshData * const * meshes, guint n_meshes);
+GPtrArray * gst_3d_mesh_data_batch_all (GPtrArray * meshes);
+
+G_END_DECLS
+#endif /* __GST_3D_MESH_BATCH_H__ */
@@ -0,0 +1,423 @@
+/*
+ * GStreamer Plugins VR
+ * Copyright (C) 2016 Lubosz Sarnecki <lubosz.sarnecki@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define GST_USE_UNSTABLE_API
+#include <gst/gl/gl.h>
+#include <gst/gl/gstglfuncs.h>
+
+#include <gio/gio.h>
+
+#include "gst3dmeshfile.h"
+
+#define GST_CAT_DEFAULT gst_3d_mesh_file_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+/* the format is read in place, so the structs must not depend on the
+ * compiler's padding */
+G_STATIC_ASSERT (sizeof (Gst3DMeshFileHeader) == 16);
+G_STATIC_ASSERT (sizeof (Gst3DMeshFileAttribute) == 32);
+G_STATIC_ASSERT (sizeof (Gst3DMeshFileLod) == 16);
+G_STATIC_ASSERT (sizeof (Gst3DMeshFileMesh) == 472);
+
+static void
+_init_debug (void)
+{
+  static gsize initialized = 0;
+  if (g_once_init_enter (&initialized)) {
+    GST_DEBUG_CATEGORY_INIT (gst_3d_mesh_file_debug, "3dmeshfile", 0,
+        "mesh file");
+    g_once_init_leave (&initialized, 1);
+  }
+}
+
+static gboolean
+_validate_mesh (const Gst3DMeshFileMesh * mesh, gsize size)
+{
+  gsize index_size;
+
+  if (mesh->n_attributes > GST_3D_VERTEX_LAYOUT_MAX_ATTRIBUTES
+      || mesh->n_lods > GST_3D_MESH_FILE_MAX_LODS || mesh->stride == 0)
+    return FALSE;
+
+  /* the vertices are uploaded as they are, attributes must stay inside
+   * their vertex */
+  for (guint i = 0; i < mesh->n_attributes; i++) {
+    const Gst3DMeshFileAttribute *attrib = &mesh->attributes[i];
+    gsize attrib_size = gst_3d_vertex_attribute_size (attrib->components,
+        attrib->type);
+    if (!memchr (attrib->name, '\0', sizeof (attrib->name))
+        || attrib->components > 4 || attrib_size == 0
+        || (guint64) attrib->offset + attrib_size > mesh->stride)
+      return FALSE;
+  }
+
+  switch (mesh->draw_mode) {
+    case GL_POINTS:
+    case GL_LINES:
+    case GL_LINE_LOOP:
+    case GL_LINE_STRIP:
+    case GL_TRIANGLES:
+    case GL_TRIANGLE_STRIP:
+    case GL_TRIANGLE_FAN:
+      break;
+    default:
+      return FALSE;
+  }
+
+  if (mesh->index_type == GL_UNSIGNED_SHORT)
+    index_size = sizeof (guint16);
+  else if (mesh->index_type == GL_UNSIGNED_INT)
+    index_size = sizeof (guint32);
+  else
+    return FALSE;
+
+  if (mesh->vertex_offset > size
+      || (guint64) mesh->vertex_count * mesh->stride >
+      size - mesh->vertex_offset)
+    return FALSE;
+
+  if (mesh->index_offset > size
+      || (guint64) mesh->index_count * index_size > size - mesh->index_offset)
+    return FALSE;
+
+  for (guint i = 0; i < mesh->n_lods; i++) {
+    const Gst3DMeshFileLod *lod = &mesh->lods[i];
+    if ((guint64) lod->first_index + lod->index_count > mesh->index_count)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * gst_3d_mesh_file_open:
+ *
+ * Maps a mesh file baked with gst-3d-bake. Only the header is read, the
+ * geometry is paged in when it is uploaded.
+ *
+ * Returns: the mesh file or %NULL on error
+ */
+Gst3DMeshFile *
+gst_3d_mesh_file_open (const gchar * path, GError ** error)
+{
+  Gst3DMeshFile *self;
+  GMappedFile *mapping;
+  const gchar *contents;
+  gsize size;
+
+  _init_debug ();
+
+  if (G_BYTE_ORDER != G_LITTLE_ENDIAN) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+        "Mesh files are only supported on little endian machines");
+    return NULL;
+  }
+
+  mapping = g_mapped_file_new (path, FALSE, error);
+  if (!mapping)
+    return NULL;
+
+  contents = g_mapped_file_get_contents (mapping);
+  size = g_mapped_file_get_length (mapping);
+
+  const Gst3DMeshFileHeader *header = (const Gst3DMeshFileHeader *) contents;
+
+  if (size < sizeof (Gst3DMeshFileHeader)
+      || memcmp (header->magic, GST_3D_MESH_FILE_MAGIC, 4) != 0) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "%s is not a mesh file", path);
+    goto error;
+  }
+
+  if (header->version != GST_3D_MESH_FILE_VERSION) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+        "%s has unsupported version %d", path, header->version);
+    goto error;
+  }
+
+  if ((guint64) header->n_meshes * sizeof (Gst3DMeshFileMesh) >
+      size - sizeof (Gst3DMeshFileHeader)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "%s is truncated", path);
+    goto error;
+  }
+
+  const Gst3DMeshFileMesh *meshes =
+      (const Gst3DMeshFileMesh *) (contents + sizeof (Gst3DMeshFileHeader));
+
+  for (guint i = 0; i < header->n_meshes; i++) {
+    if (!_validate_mesh (&meshes[i], size)) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+          "mesh %d of %s is invalid", i, path);
+      goto error;
+    }
+  }
+
+  self = g_new0 (Gst3DMeshFile, 1);
+  self->mapping = mapping;
+  self->header = header;
+  self->meshes = meshes;
+
+  GST_DEBUG ("mapped %s with %d meshes", path, header->n_meshes);
+
+  return self;
+
+error:
+  g_mapped_file_unref (mapping);
+  return NULL;
+}
+
+void
+gst_3d_mesh_file_free (Gst3DMeshFile * self)
+{
+  if (!self)
+    return;
+  g_mapped_file_unref (self->mapping);
+  g_free (self);
+}
+
+/* checks the magic only, to pick the loader for a file */
+gboolean
+gst_3d_mesh_file_is_mesh_file (const gchar * path)
+{
+  gchar magic[4];
+  gboolean ret = FALSE;
+  FILE *file = fopen (path, "rb");
+
+  if (file) {
+    ret = fread (magic, 1, sizeof (magic), file) == sizeof (magic)
+        && memcmp (magic, GST_3D_MESH_FILE_MAGIC, sizeof (magic)) == 0;
+    fclose (file);
+  }
+
+  return ret;
+}
+
+guint
+gst_3d_mesh_file_get_n_meshes (Gst3DMeshFile * self)
+{
+  return self->header->n_meshes;
+}
+
+void
+gst_3d_mesh_file_get_bounds (Gst3DMeshFile * self, guint index,
+    graphene_box_t * bounds)
+{
+  g_return_if_fail (index < self->header->n_meshes);
+  const Gst3DMeshFileMesh *mesh = &self->meshes[index];
+  graphene_point3d_t min, max;
+
+  graphene_point3d_init (&min, mesh->bounds_min[0], mesh->bounds_min[1],
+      mesh->bounds_min[2]);
+  graphene_point3d_init (&max, mesh->bounds_max[0], mesh->bounds_max[1],
+      mesh->bounds_max[2]);
+  graphene_box_init (bounds, &min, &max);
+}
+
+/**
+ * gst_3d_mesh_file_create_mesh:
+ *
+ * Uploads mesh @index of the file. The vertex and index blocks are handed
+ * to GL directly from the mapping, without a copy.
+ *
+ * Returns: (transfer full): the mesh
+ */
+Gst3DMesh *
+gst_3d_mesh_file_create_mesh (Gst3DMeshFile * self, GstGLContext * context,
+    guint index)
+{
+  g_return_val_if_fail (GST_IS_GL_CONTEXT (context), NULL);
+  g_return_val_if_fail (index < self->header->n_meshes, NULL);
+
+  const Gst3DMeshFileMesh *entry = &self->meshes[index];
+  const gchar *contents = g_mapped_file_get_contents (self->mapping);
+  Gst3DVertexLayout layout;
+  Gst3DMeshLod lods[GST_3D_MESH_FILE_MAX_LODS];
+
+  gst_3d_vertex_layout_init (&layout);
+  for (guint i = 0; i < entry->n_attributes; i++) {
+    const Gst3DMeshFileAttribute *attrib = &entry->attributes[i];
+    Gst3DVertexAttribute *dest = &layout.attributes[i];
+    g_strlcpy (dest->name, attrib->name, sizeof (dest->name));
+    dest->components = attrib->components;
+    dest->type = attrib->type;
+    dest->normalized = attrib->normalized;
+    dest->offset = attrib->offset;
+  }
+  layout.n_attributes = entry->n_attributes;
+  layout.stride = entry->stride;
+
+  Gst3DMesh *mesh = gst_3d_mesh_new (context);
+  gst_3d_mesh_init_buffers (mesh);
+  gst_3d_mesh_upload_interleaved (mesh, &layout,
+      contents + entry->vertex_offset, entry->vertex_count);
+  gst_3d_mesh_upload_index_buffer (mesh, entry->index_type,
+      contents + entry->index_offset, entry->index_count);
+
+  for (guint i = 0; i < entry->n_lods; i++) {
+    lods[i].first_index = entry->lods[i].first_index;
+    lods[i].index_count = entry->lods[i].index_count;
+    lods[i].error = entry->lods[i].error;
+  }
+  gst_3d_mesh_set_lods (mesh, lods, entry->n_lods);
+
+  mesh->draw_mode = entry->draw_mode;
+  graphene_vec4_init_from_float (&mesh->diffuse_color, entry->diffuse_color);
+
+  return mesh;
+}
+
+static void
+_pad (GByteArray * bytes)
+{
+  static const guint8 zeros[GST_3D_MESH_FILE_ALIGNMENT] = { 0 };
+  gsize padding = GST_ROUND_UP_16 (bytes->len) - bytes->len;
+  g_byte_array_append (bytes, zeros, padding);
+}
+
+static void
+_compute_bounds (const Gst3DMeshData * data, Gst3DMeshFileMesh * entry)
+{
+  const Gst3DVertexAttribute *position =
+      gst_3d_vertex_layout_find (&data->layout, "position");
+
+  memset (entry->bounds_min, 0, sizeof (entry->bounds_min));
+  memset (entry->bounds_max, 0, sizeof (entry->bounds_max));
+
+  if (!position || position->type != GL_FLOAT || data->vertex_count == 0)
+    return;
+
+  for (guint c = 0; c < 3; c++) {
+    entry->bounds_min[c] = G_MAXFLOAT;
+    entry->bounds_max[c] = -G_MAXFLOAT;
+  }
+
+  for (guint i = 0; i < data->vertex_count; i++) {
+    const GLfloat *p = (const GLfloat *) (data->vertices +
+        i * data->layout.stride + position->offset);
+    for (guint c = 0; c < MIN (position->components, 3); c++) {
+      entry->bounds_min[c] = MIN (entry->bounds_min[c], p[c]);
+      entry->bounds_max[c] = MAX (entry->bounds_max[c], p[c]);
+    }
+  }
+}
+
+/**
+ * gst_3d_mesh_file_save:
+ * @meshes: (element-type Gst3DMeshData): meshes to store
+ *
+ * Writes @meshes in the format read by gst_3d_mesh_file_open().
+ */
+gboolean
+gst_3d_mesh_file_save (const gchar * path, GPtrArray * meshes,
+    GError ** error)
+{
+  GByteArray *bytes = g_byte_array_new ();
+  Gst3DMeshFileHeader header = { {0}, GST_3D_MESH_FILE_VERSION, meshes->len,
+    0
+  };
+  gboolean ret;
+
+  _init_debug ();
+
+  memcpy (header.magic, GST_3D_MESH_FILE_MAGIC, sizeof (header.magic));
+  g_byte_array_append (bytes, (const guint8 *) &header, sizeof (header));
+
+  /* the table is filled in after the data offsets are known */
+  g_byte_array_set_size (bytes,
+      sizeof (header) + meshes->len * sizeof (Gst3DMeshFileMesh));
+  memset (bytes->data + sizeof (header), 0,
+      meshes->len * sizeof (Gst3DMeshFileMesh));
+
+  for (guint i = 0; i < meshes->len; i++) {
+    const Gst3DMeshData *data = g_ptr_array_index (meshes, i);
+    Gst3DMeshFileMesh entry;
+
+    memset (&entry, 0, sizeof (entry));
+
+    for (guint a = 0; a < data->layout.n_attributes; a++) {
+      const Gst3DVertexAttribute *attrib = &data->layout.attributes[a];
+      g_strlcpy (entry.attributes[a].name, attrib->name,
+          sizeof (entry.attributes[a].name));
+      entry.attributes[a].components = attrib->components;
+      entry.attributes[a].type = attrib->type;
+      entry.attributes[a].normalized = attrib->normalized;
+      entry.attributes[a].offset = attrib->offset;
+    }
+    entry.n_attributes = data->layout.n_attributes;
+    entry.stride = data->layout.stride;
+    entry.draw_mode = data->draw_mode;
+    entry.index_type =
+        gst_3d_mesh_index_type_for_vertex_count (data->vertex_count);
+    entry.vertex_count = data->vertex_count;
+    entry.index_count = data->index_count;
+
+    _compute_bounds (data, &entry);
+    graphene_vec4_to_float (&data->diffuse_color, entry.diffuse_color);
+
+    if (data->lods) {
+      entry.n_lods = MIN (data->lods->len, GST_3D_MESH_FILE_MAX_LODS);
+      for (guint l = 0; l < entry.n_lods; l++) {
+        const Gst3DMeshLod *lod = &g_array_index (data->lods, Gst3DMeshLod, l);
+        entry.lods[l].first_index = lod->first_index;
+        entry.lods[l].index_count = lod->index_count;
+        entry.lods[l].error = lod->error;
+      }
+    }
+
+    _pad (bytes);
+    entry.vertex_offset = bytes->len;
+    g_byte_array_append (bytes, data->vertices,
+        data->vertex_count * data->layout.stride);
+
+    _pad (bytes);
+    entry.index_offset = bytes->len;
+    if (entry.index_type == GL_UNSIGNED_INT) {
+      g_byte_array_append (bytes, (const guint8 *) data->indices,
+          data->index_count * sizeof (guint32));
+    } else {
+      for (guint n = 0; n < data->index_count; n++) {
+        guint16 index = data->indices[n];
+        g_byte_array_append (bytes, (const guint8 *) &index, sizeof (index));
+      }
+    }
+
+    memcpy (bytes->data + sizeof (header) + i * sizeof (Gst3DMeshFileMesh),
+        &entry, sizeof (entry));
+  }
+
+  GST_DEBUG ("writing %d meshes, %d bytes to %s", meshes->len, bytes->len,
+      path);
+
+  ret = g_file_set_contents (path, (const gchar *) bytes->data, bytes->len,
+      error);
+  g_byte_array_unref (bytes);
+
+  return ret;
+}
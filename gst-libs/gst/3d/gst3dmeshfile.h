@@ -0,0 +1,112 @@
+/*
+ * GStreamer Plugins VR
+ * Copyright (C) 2016 Lubosz Sarnecki <lubosz.sarnecki@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_3D_MESH_FILE_H__
+#define __GST_3D_MESH_FILE_H__
+
+
+#include <gst/gst.h>
+#include <gst/gl/gstgl_fwd.h>
+#include <graphene.h>
+
+#include "gst3dmesh.h"
+
+G_BEGIN_DECLS
+
+/* Prebaked meshes that are uploaded straight from a file mapping.
+ *
+ * All values are little endian. The file starts with a header and a table
+ * of Gst3DMeshFileMesh entries. Vertex and index data follow, each block
+ * aligned to GST_3D_MESH_FILE_ALIGNMENT. Indices are stored in the type
+ * they are drawn with, and the levels of detail of a mesh are ranges of its
+ * index block. */
+#define GST_3D_MESH_FILE_MAGIC "G3DM"
+#define GST_3D_MESH_FILE_VERSION 1
+#define GST_3D_MESH_FILE_ALIGNMENT 16
+#define GST_3D_MESH_FILE_MAX_LODS 8
+
+typedef struct _Gst3DMeshFileHeader
+{
+  gchar magic[4];
+  guint32 version;
+  guint32 n_meshes;
+  guint32 reserved;
+} Gst3DMeshFileHeader;
+
+typedef struct _Gst3DMeshFileAttribute
+{
+  gchar name[GST_3D_VERTEX_ATTRIBUTE_NAME_LENGTH];
+  guint32 components;
+  guint32 type;
+  guint32 normalized;
+  guint32 offset;
+} Gst3DMeshFileAttribute;
+
+typedef struct _Gst3DMeshFileLod
+{
+  guint32 first_index;
+  guint32 index_count;
+  gfloat error;
+  guint32 reserved;
+} Gst3DMeshFileLod;
+
+typedef struct _Gst3DMeshFileMesh
+{
+  Gst3DMeshFileAttribute attributes[GST_3D_VERTEX_LAYOUT_MAX_ATTRIBUTES];
+  guint32 n_attributes;
+  guint32 stride;
+  guint32 draw_mode;
+  guint32 index_type;
+
+  guint32 vertex_count;
+  guint32 index_count;
+  guint64 vertex_offset;
+  guint64 index_offset;
+
+  gfloat bounds_min[3];
+  gfloat bounds_max[3];
+  gfloat diffuse_color[4];
+
+  guint32 n_lods;
+  guint32 reserved;
+  Gst3DMeshFileLod lods[GST_3D_MESH_FILE_MAX_LODS];
+} Gst3DMeshFileMesh;
+
+typedef struct _Gst3DMeshFile
+{
+  GMappedFile *mapping;
+  const Gst3DMeshFileHeader *header;
+  const Gst3DMeshFileMesh *meshes;
+} Gst3DMeshFile;
+
+Gst3DMeshFile *gst_3d_mesh_file_open (const gchar * path, GError ** error);
+void gst_3d_mesh_file_free (Gst3DMeshFile * self);
+
+gboolean gst_3d_mesh_file_is_mesh_file (const gchar * path);
+
+guint gst_3d_mesh_file_get_n_meshes (Gst3DMeshFile * self);
+void gst_3d_mesh_file_get_bounds (Gst3DMeshFile * self, guint index, graphene_box_t * bounds);
+Gst3DMesh *gst_3d_mesh_file_create_mesh (Gst3DMeshFile * self, GstGLContext * context, guint index);
+
+gboolean gst_3d_mesh_file_save (const gchar * path, GPtrArray * meshes, GError ** error);
+
+G_END_DECLS
+#endif /* __GST_3D_MESH_FILE_H__ */
@@ -0,0 +1,569 @@
+/*
+ * GStreamer Plugins VR
+ * Copyright (C) 2016 Lubosz Sarnecki <lubosz.sarnecki@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define GST_USE_UNSTABLE_API
+#include <gst/gl/gl.h>
+
+#include "gst3dmeshoptimize.h"
+
+#define GST_CAT_DEFAULT gst_3d_mesh_optimize_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+static void
+_init_debug (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized)) {
+    GST_DEBUG_CATEGORY_INIT (gst_3d_mesh_optimize_debug, "3dmeshoptimize", 0,
+        "mesh optimization");
+    g_once_init_leave (&initialized, 1);
+  }
+}
+
+/* scores of the Forsyth ordering, the cache is modelled as LRU */
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRIANGLE_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+#define MAX_VALENCE_SCORES 32
+
+static gfloat cache_scores[GST_3D_MESH_OPTIMIZE_CACHE_SIZE];
+static gfloat valence_scores[MAX_VALENCE_SCORES];
+
+static void
+_init_scores (void)
+{
+  static gsize initialized = 0;
+
+  if (!g_once_init_enter (&initialized))
+    return;
+
+  for (guint i = 0; i < GST_3D_MESH_OPTIMIZE_CACHE_SIZE; i++) {
+    /* the last triangle's vertices get a fixed score, so the next one does
+     * not simply reuse its most recent edge */
+    if (i < 3)
+      cache_scores[i] = LAST_TRIANGLE_SCORE;
+    else
+      cache_scores[i] = powf (1.f - (gfloat) (i - 3) /
+          (GST_3D_MESH_OPTIMIZE_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+  }
+
+  /* vertices with few triangles left are finished first */
+  for (guint i = 1; i < MAX_VALENCE_SCORES; i++)
+    valence_scores[i] = VALENCE_BOOST_SCALE * powf (i, -VALENCE_BOOST_POWER);
+  valence_scores[0] = 0.f;
+
+  g_once_init_leave (&initialized, 1);
+}
+
+static inline gfloat
+_vertex_score (gint cache_position, guint remaining)
+{
+  if (remaining == 0)
+    return -1.f;
+
+  gfloat score = cache_position >= 0 ? cache_scores[cache_position] : 0.f;
+  if (remaining < MAX_VALENCE_SCORES)
+    score += valence_scores[remaining];
+  else
+    score += VALENCE_BOOST_SCALE * powf (remaining, -VALENCE_BOOST_POWER);
+
+  return score;
+}
+
+/**
+ * gst_3d_mesh_optimize_vertex_cache:
+ * @indices: (inout): a triangle list
+ *
+ * Reorders the triangles of @indices so vertices are reused while they are
+ * still in the post-transform cache. The triangles and their winding are
+ * kept. Runs in time linear to the number of triangles.
+ */
+void
+gst_3d_mesh_optimize_vertex_cache (guint32 * indices, guint index_count,
+    guint vertex_count)
+{
+  guint triangle_count = index_count / 3;
+
+  if (triangle_count == 0)
+    return;
+
+  _init_scores ();
+
+  /* triangles of every vertex, the first remaining[v] are not emitted */
+  guint *remaining = g_new0 (guint, vertex_count);
+  for (guint i = 0; i < triangle_count * 3; i++)
+    remaining[indices[i]]++;
+
+  guint *offsets = g_new (guint, vertex_count);
+  guint offset = 0;
+  for (guint v = 0; v < vertex_count; v++) {
+    offsets[v] = offset;
+    offset += remaining[v];
+  }
+
+  guint *adjacency = g_new (guint, triangle_count * 3);
+  guint *filled = g_new0 (guint, vertex_count);
+  for (guint t = 0; t < triangle_count; t++)
+    for (guint k = 0; k < 3; k++) {
+      guint v = indices[t * 3 + k];
+      adjacency[offsets[v] + filled[v]++] = t;
+    }
+  g_free (filled);
+
+  gint *cache_positions = g_new (gint, vertex_count);
+  gfloat *vertex_scores = g_new (gfloat, vertex_count);
+  for (guint v = 0; v < vertex_count; v++) {
+    cache_positions[v] = -1;
+    vertex_scores[v] = _vertex_score (-1, remaining[v]);
+  }
+
+  gfloat *triangle_scores = g_new (gfloat, triangle_count);
+  guint8 *emitted = g_new0 (guint8, triangle_count);
+  gint best = 0;
+  for (guint t = 0; t < triangle_count; t++) {
+    const guint32 *tri = &indices[t * 3];
+    triangle_scores[t] = vertex_scores[tri[0]] + vertex_scores[tri[1]] +
+        vertex_scores[tri[2]];
+    if (triangle_scores[t] > triangle_scores[best])
+      best = t;
+  }
+
+  guint32 *output = g_new (guint32, triangle_count * 3);
+  guint cache[GST_3D_MESH_OPTIMIZE_CACHE_SIZE + 3];
+  guint cache_count = 0;
+  guint scan = 0;
+
+  for (guint n = 0; n < triangle_count; n++) {
+    /* nothing in the cache is connected to what is left, continue with
+     * the next triangle in input order */
+    if (best < 0) {
+      while (emitted[scan])
+        scan++;
+      best = scan;
+    }
+
+    const guint32 *tri = &indices[best * 3];
+    emitted[best] = 1;
+    memcpy (&output[n * 3], tri, 3 * sizeof (guint32));
+
+    guint new_cache[GST_3D_MESH_OPTIMIZE_CACHE_SIZE + 3];
+    guint new_count = 0;
+
+    for (guint k = 0; k < 3; k++) {
+      guint v = tri[k];
+      guint *list = &adjacency[offsets[v]];
+
+      for (guint i = 0; i < remaining[v]; i++) {
+        if (list[i] == (guint) best) {
+          list[i] = list[remaining[v] - 1];
+          list[remaining[v] - 1] = best;
+          remaining[v]--;
+          break;
+        }
+      }
+
+      /* degenerate triangles repeat vertices */
+      if (k > 0 && (v == tri[0] || (k == 2 && v == tri[1])))
+        continue;
+      new_cache[new_count++] = v;
+    }
+
+    for (guint i = 0; i < cache_count; i++)
+      if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+        new_cache[new_count++] = cache[i];
+
+    /* rescore the vertices that moved, including the evicted ones */
+    for (guint i = 0; i < new_count; i++) {
+      guint v = new_cache[i];
+      cache_positions[v] = i < GST_3D_MESH_OPTIMIZE_CACHE_SIZE ? (gint) i : -1;
+      vertex_scores[v] = _vertex_score (cache_positions[v], remaining[v]);
+    }
+
+    best = -1;
+    gfloat best_score = -1.f;
+    for (guint i = 0; i < new_count; i++) {
+      guint v = new_cache[i];
+      const guint *list = &adjacency[offsets[v]];
+
+      for (guint j = 0; j < remaining[v]; j++) {
+        guint t = list[j];
+        const guint32 *other = &indices[t * 3];
+        triangle_scores[t] = vertex_scores[other[0]] +
+            vertex_scores[other[1]] + vertex_scores[other[2]];
+        if (triangle_scores[t] > best_score) {
+          best_score = triangle_scores[t];
+          best = t;
+        }
+      }
+    }
+
+    cache_count = MIN (new_count, GST_3D_MESH_OPTIMIZE_CACHE_SIZE);
+    memcpy (cache, new_cache, cache_count * sizeof (guint));
+  }
+
+  memcpy (indices, output, triangle_count * 3 * sizeof (guint32));
+
+  g_free (output);
+  g_free (emitted);
+  g_free (triangle_scores);
+  g_free (vertex_scores);
+  g_free (cache_positions);
+  g_free (adjacency);
+  g_free (offsets);
+  g_free (remaining);
+}
+
+typedef struct
+{
+  guint first_triangle;
+  guint triangle_count;
+  gfloat sort_key;
+} Gst3DTriangleCluster;
+
+static gint
+_compare_clusters (gconstpointer a, gconstpointer b)
+{
+  const Gst3DTriangleCluster *ca = a;
+  const Gst3DTriangleCluster *cb = b;
+
+  if (ca->sort_key > cb->sort_key)
+    return -1;
+  return ca->sort_key < cb->sort_key ? 1 : 0;
+}
+
+/* FIFO cache simulation, a vertex is cached if it missed less than
+ * cache_size misses ago */
+typedef struct
+{
+  guint *timestamps;
+  guint time;
+  guint cache_size;
+} Gst3DCacheSimulation;
+
+static void
+_cache_simulation_init (Gst3DCacheSimulation * sim, guint vertex_count,
+    guint cache_size)
+{
+  sim->timestamps = g_new0 (guint, vertex_count);
+  sim->time = cache_size + 1;
+  sim->cache_size = cache_size;
+}
+
+static void
+_cache_simulation_flush (Gst3DCacheSimulation * sim)
+{
+  sim->time += sim->cache_size + 1;
+}
+
+static guint
+_cache_simulation_triangle (Gst3DCacheSimulation * sim, const guint32 * tri)
+{
+  guint misses = 0;
+
+  for (guint k = 0; k < 3; k++) {
+    if (sim->time - sim->timestamps[tri[k]] > sim->cache_size) {
+      sim->timestamps[tri[k]] = sim->time++;
+      misses++;
+    }
+  }
+
+  return misses;
+}
+
+/**
+ * gst_3d_mesh_optimize_overdraw:
+ * @indices: (inout): a triangle list in vertex cache order
+ * @threshold: how much the cache efficiency may get worse, 1.05 allows 5%
+ *
+ * Splits @indices into clusters where it starts over in the vertex cache
+ * anyway, or where splitting costs less than @threshold, and sorts them so
+ * the clusters facing away from the mesh center are drawn first. These
+ * usually cover the others, so fewer hidden fragments get shaded. Needs a
+ * float "position" attribute in @layout.
+ */
+void
+gst_3d_mesh_optimize_overdraw (guint32 * indices, guint index_count,
+    const Gst3DVertexLayout * layout, const guint8 * vertices,
+    guint vertex_count, gfloat threshold)
+{
+  guint triangle_count = index_count / 3;
+  const Gst3DVertexAttribute *position =
+      gst_3d_vertex_layout_find (layout, "position");
+
+  if (triangle_count < 2 || !position || position->type != GL_FLOAT
+      || position->components < 3)
+    return;
+
+  _init_debug ();
+
+#define POSITION(v) \
+    ((const gfloat *) (vertices + (v) * layout->stride + position->offset))
+
+  /* the mesh center, weighted by area */
+  gdouble center[3] = { 0, 0, 0 };
+  gdouble total_area = 0;
+  gfloat *normals = g_new (gfloat, triangle_count * 4);
+  for (guint t = 0; t < triangle_count; t++) {
+    const gfloat *a = POSITION (indices[t * 3]);
+    const gfloat *b = POSITION (indices[t * 3 + 1]);
+    const gfloat *c = POSITION (indices[t * 3 + 2]);
+    gfloat e0[3], e1[3], *n = &normals[t * 4];
+
+    for (guint i = 0; i < 3; i++) {
+      e0[i] = b[i] - a[i];
+      e1[i] = c[i] - a[i];
+    }
+    n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+    n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+    n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+    /* twice the area, the length of the unnormalized normal */
+    n[3] = sqrtf (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+    for (guint i = 0; i < 3; i++)
+      center[i] += n[3] * (a[i] + b[i] + c[i]) / 3.0;
+    total_area += n[3];
+  }
+  for (guint i = 0; i < 3; i++)
+    center[i] = total_area > 0 ? center[i] / total_area : 0;
+
+  /* hard boundaries are triangles that miss the cache completely */
+  Gst3DCacheSimulation sim;
+  _cache_simulation_init (&sim, vertex_count, GST_3D_MESH_OPTIMIZE_CACHE_SIZE);
+  GArray *hard = g_array_new (FALSE, FALSE, sizeof (guint));
+  guint *misses = g_new (guint, triangle_count);
+  for (guint t = 0; t < triangle_count; t++) {
+    misses[t] = _cache_simulation_triangle (&sim, &indices[t * 3]);
+    if (t == 0 || misses[t] == 3)
+      g_array_append_val (hard, t);
+  }
+
+  /* soft boundaries split hard clusters where restarting the cache keeps
+   * the misses of the part so far within threshold of the whole cluster */
+  GArray *clusters = g_array_new (FALSE, FALSE, sizeof (Gst3DTriangleCluster));
+  for (guint h = 0; h < hard->len; h++) {
+    guint start = g_array_index (hard, guint, h);
+    guint end = h + 1 < hard->len ?
+        g_array_index (hard, guint, h + 1) : triangle_count;
+    guint cluster_misses = 0;
+
+    for (guint t = start; t < end; t++)
+      cluster_misses += misses[t];
+    gfloat cluster_acmr = (gfloat) cluster_misses / (end - start);
+
+    guint first = start;
+    guint part_misses = 0;
+    _cache_simulation_flush (&sim);
+    for (guint t = start; t < end; t++) {
+      part_misses += _cache_simulation_triangle (&sim, &indices[t * 3]);
+      guint part_triangles = t + 1 - first;
+      if (t + 1 < end && part_triangles >= 16 &&
+          (gfloat) part_misses / part_triangles <= threshold * cluster_acmr) {
+        Gst3DTriangleCluster cluster = { first, part_triangles, 0 };
+        g_array_append_val (clusters, cluster);
+        first = t + 1;
+        part_misses = 0;
+        _cache_simulation_flush (&sim);
+      }
+    }
+    Gst3DTriangleCluster cluster = { first, end - first, 0 };
+    g_array_append_val (clusters, cluster);
+  }
+
+  /* clusters far out along their own normal occlude the rest */
+  for (guint i = 0; i < clusters->len; i++) {
+    Gst3DTriangleCluster *cluster =
+        &g_array_index (clusters, Gst3DTriangleCluster, i);
+    gdouble centroid[3] = { 0, 0, 0 }, normal[3] = { 0, 0, 0 };
+    gdouble area = 0;
+
+    for (guint t = cluster->first_triangle;
+        t < cluster->first_triangle + cluster->triangle_count; t++) {
+      const gfloat *n = &normals[t * 4];
+      for (guint k = 0; k < 3; k++) {
+        const gfloat *p = POSITION (indices[t * 3 + k]);
+        for (guint c = 0; c < 3; c++)
+          centroid[c] += n[3] * p[c] / 3.0;
+      }
+      for (guint c = 0; c < 3; c++)
+        normal[c] += n[c];
+      area += n[3];
+    }
+
+    gdouble length = sqrt (normal[0] * normal[0] + normal[1] * normal[1] +
+        normal[2] * normal[2]);
+    cluster->sort_key = 0;
+    if (area > 0 && length > 0)
+      for (guint c = 0; c < 3; c++)
+        cluster->sort_key += (centroid[c] / area - center[c]) * normal[c]
+            / length;
+  }
+
+#undef POSITION
+
+  g_array_sort (clusters, _compare_clusters);
+
+  guint32 *output = g_new (guint32, triangle_count * 3);
+  guint32 *dest = output;
+  for (guint i = 0; i < clusters->len; i++) {
+    const Gst3DTriangleCluster *cluster =
+        &g_array_index (clusters, Gst3DTriangleCluster, i);
+    memcpy (dest, &indices[cluster->first_triangle * 3],
+        cluster->triangle_count * 3 * sizeof (guint32));
+    dest += cluster->triangle_count * 3;
+  }
+  memcpy (indices, output, triangle_count * 3 * sizeof (guint32));
+
+  GST_DEBUG ("sorted %u triangles in %u clusters", triangle_count,
+      clusters->len);
+
+  g_free (output);
+  g_array_unref (clusters);
+  g_free (misses);
+  g_array_unref (hard);
+  g_free (sim.timestamps);
+  g_free (normals);
+}
+
+/**
+ * gst_3d_mesh_optimize_vertex_fetch:
+ * @vertices: (inout): @vertex_count vertices of @stride bytes
+ * @indices: (inout): indices into @vertices
+ *
+ * Reorders the vertices in the order the indices first use them, so the
+ * vertex fetch reads memory mostly sequentially, and drops vertices no
+ * index refers to.
+ *
+ * Returns: the number of vertices left
+ */
+guint
+gst_3d_mesh_optimize_vertex_fetch (guint8 * vertices, guint vertex_count,
+    gsize stride, guint32 * indices, guint index_count)
+{
+  guint32 *remap = g_new (guint32, vertex_count);
+  guint next = 0;
+
+  memset (remap, 0xff, vertex_count * sizeof (guint32));
+
+  for (guint i = 0; i < index_count; i++) {
+    guint32 v = indices[i];
+    if (remap[v] == G_MAXUINT32)
+      remap[v] = next++;
+    indices[i] = remap[v];
+  }
+
+  guint8 *reordered = g_malloc (next * stride);
+  for (guint v = 0; v < vertex_count; v++)
+    if (remap[v] != G_MAXUINT32)
+      memcpy (reordered + remap[v] * stride, vertices + v * stride, stride);
+  memcpy (vertices, reordered, next * stride);
+
+  g_free (reordered);
+  g_free (remap);
+
+  return next;
+}
+
+/**
+ * gst_3d_mesh_compute_acmr:
+ * @cache_size: entries of the simulated FIFO cache
+ *
+ * Returns: the average cache miss ratio, vertices transformed per triangle.
+ * 3 is the worst, about 0.5 the best a regular grid can get.
+ */
+gfloat
+gst_3d_mesh_compute_acmr (const guint32 * indices, guint index_count,
+    guint vertex_count, guint cache_size)
+{
+  guint triangle_count = index_count / 3;
+  Gst3DCacheSimulation sim;
+  guint misses = 0;
+
+  if (triangle_count == 0)
+    return 0.f;
+
+  _cache_simulation_init (&sim, vertex_count, cache_size);
+  for (guint t = 0; t < triangle_count; t++)
+    misses += _cache_simulation_triangle (&sim, &indices[t * 3]);
+  g_free (sim.timestamps);
+
+  return (gfloat) misses / triangle_count;
+}
+
+static void
+_optimize_range (Gst3DMeshData * data, guint first_index, guint index_count,
+    gfloat overdraw_threshold)
+{
+  guint32 *indices = data->indices + first_index;
+
+  gst_3d_mesh_optimize_vertex_cache (indices, index_count, data->vertex_count);
+  if (overdraw_threshold > 0)
+    gst_3d_mesh_optimize_overdraw (indices, index_count, &data->layout,
+        data->vertices, data->vertex_count, overdraw_threshold);
+}
+
+/**
+ * gst_3d_mesh_data_optimize:
+ * @overdraw_threshold: see gst_3d_mesh_optimize_overdraw(), 0 keeps the
+ *   vertex cache order
+ *
+ * Runs all optimizations on a triangle list, every level of detail is
+ * ordered on its own. Other primitives are left as they are.
+ */
+void
+gst_3d_mesh_data_optimize (Gst3DMeshData * data, gfloat overdraw_threshold)
+{
+  if (data->draw_mode != GL_TRIANGLES || data->index_count < 3)
+    return;
+
+  _init_debug ();
+
+  gfloat acmr_before = gst_3d_mesh_compute_acmr (data->indices,
+      data->index_count, data->vertex_count, GST_3D_MESH_OPTIMIZE_CACHE_SIZE);
+
+  if (data->lods) {
+    for (guint i = 0; i < data->lods->len; i++) {
+      const Gst3DMeshLod *lod = &g_array_index (data->lods, Gst3DMeshLod, i);
+      _optimize_range (data, lod->first_index, lod->index_count,
+          overdraw_threshold);
+    }
+  } else {
+    _optimize_range (data, 0, data->index_count, overdraw_threshold);
+  }
+
+  data->vertex_count = gst_3d_mesh_optimize_vertex_fetch (data->vertices,
+      data->vertex_count, data->layout.stride, data->indices,
+      data->index_count);
+
+  GST_DEBUG ("ACMR %.3f before, %.3f after optimization", acmr_before,
+      gst_3d_mesh_compute_acmr (data->indices, data->index_count,
+          data->vertex_count, GST_3D_MESH_OPTIMIZE_CACHE_SIZE));
+}
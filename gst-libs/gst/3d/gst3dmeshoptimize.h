@@ -0,0 +1,51 @@
+/*
+ * GStreamer Plugins VR
+ * Copyright (C) 2016 Lubosz Sarnecki <lubosz.sarnecki@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef __GST_3D_MESH_OPTIMIZE_H__
+#define __GST_3D_MESH_OPTIMIZE_H__
+
+
+#include <gst/gst.h>
+
+#include "gst3dmesh.h"
+
+G_BEGIN_DECLS
+
+/* Reordering of triangle lists for the GPU, done on the CPU when loading or
+ * baking. The vertex cache order follows Tom Forsyth's "Linear-Speed Vertex
+ * Cache Optimisation", the overdraw order sorts clusters of it front to
+ * back as seen from outside the mesh. */
+
+/* cache size the ordering optimizes for */
+#define GST_3D_MESH_OPTIMIZE_CACHE_SIZE 32
+/* how much worse than the cache order the overdraw order may get */
+#define GST_3D_MESH_OPTIMIZE_OVERDRAW_THRESHOLD 1.05
+
+void gst_3d_mesh_optimize_vertex_cache (guint32 * indices, guint index_count, guint vertex_count);
+void gst_3d_mesh_optimize_overdraw (guint32 * indices, guint index_count, const Gst3DVertexLayout * layout, const guint8 * vertices, guint vertex_count, gfloat threshold);
+guint gst_3d_mesh_optimize_vertex_fetch (guint8 * vertices, guint vertex_count, gsize stride, guint32 * indices, guint index_count);
+
+gfloat gst_3d_mesh_compute_acmr (const guint32 * indices, guint index_count, guint vertex_count, guint cache_size);
+
+void gst_3d_mesh_data_optimize (Gst3DMeshData * data, gfloat overdraw_threshold);
+
+G_END_DECLS
+#endif /* __GST_3D_MESH_OPTIMIZE_H__ */
@@ -31,6 +31,7 @@
 
 #include "gst3dnode.h"
 #include "gst3dmesh.h"
+#include "gst3dmeshbatch.h"
 
 #define GST_CAT_DEFAULT gst_3d_node_debug
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
@@ -42,6 +43,22 @@ void
 gst_3d_node_init (Gst3DNode * self)
 {
   self->context = NULL;
+  self->octree = NULL;
+  self->meshes = NULL;
+  self->texture = 0;
+  graphene_vec4_init (&self->color, 1.f, 1.f, 1.f, 1.f);
+  self->children = NULL;
+  self->parent = NULL;
+  graphene_matrix_init_identity (&self->transform);
+  self->transform_dirty = TRUE;
+  self->subtree_dirty = FALSE;
+  self->hierarchy_dirty = FALSE;
+  self->bounds_dirty = TRUE;
+  self->world_index = 0;
+  self->bounds_known = TRUE;
+  self->has_bounds = FALSE;
+  graphene_box_init_from_box (&self->bounds, graphene_box_empty ());
+  graphene_sphere_init (&self->bounding_sphere, NULL, 0.f);
 }
 
 Gst3DNode *
@@ -53,23 +70,63 @@ gst_3d_node_new (GstGLContext * context)
   return node;
 }
 
+/**
+ * gst_3d_node_new_from_mesh_shader:
+ * @mesh: (transfer none): mesh to draw, the node keeps a reference
+ * @shader: (transfer none): shader to draw the mesh with, not owned by the
+ *   node and must outlive it
+ *
+ * Nodes own their meshes and octree, they are unreffed when the node is
+ * finalized. Shaders are shared between nodes and owned by the caller.
+ */
 Gst3DNode *
 gst_3d_node_new_from_mesh_shader (GstGLContext * context, Gst3DMesh * mesh, Gst3DShader * shader)
 {
   Gst3DNode *node = gst_3d_node_new (context);
-  node->meshes = g_list_append (node->meshes, mesh);
+  node->meshes = g_list_append (node->meshes, gst_object_ref (mesh));
   node->shader = shader;
-  gst_gl_shader_use (shader->shader);
+  gst_3d_shader_bind (shader);
   gst_3d_mesh_bind_shader (mesh, shader);
   return node;
 }
 
+/**
+ * gst_3d_node_new_from_octree:
+ * @octree: (transfer none): octree to draw, the node keeps a reference
+ * @shader: (transfer none): not owned by the node, see
+ *   gst_3d_node_new_from_mesh_shader()
+ *
+ * Creates a node that draws a point cloud octree. The scene selects the
+ * visible levels of detail from the view of each eye, see
+ * gst_3d_octree_draw().
+ */
+Gst3DNode *
+gst_3d_node_new_from_octree (GstGLContext * context, Gst3DOctree * octree, Gst3DShader * shader)
+{
+  Gst3DNode *node = gst_3d_node_new (context);
+  node->octree = gst_object_ref (octree);
+  node->shader = shader;
+  gst_3d_octree_bind_shader (octree, shader);
+  return node;
+}
+
 static void
 gst_3d_node_finalize (GObject * object)
 {
   Gst3DNode *self = GST_3D_NODE (object);
   g_return_if_fail (self != NULL);
 
+  if (self->octree) {
+    gst_object_unref (self->octree);
+    self->octree = NULL;
+  }
+
+  g_list_free_full (self->children, gst_object_unref);
+  self->children = NULL;
+
+  g_list_free_full (self->meshes, gst_object_unref);
+  self->meshes = NULL;
+
   if (self->context) {
     gst_object_unref (self->context);
     self->context = NULL;
@@ -85,6 +142,167 @@ gst_3d_node_class_init (Gst3DNodeClass * klass)
   obj_class->finalize = gst_3d_node_finalize;
 }
 
+/* Ancestors that are already flagged have their own ancestors flagged
+ * too. The scene clears transform flags from the root down and bounds
+ * flags from the leaves up, so this holds between frames. */
+static void
+_flag_ancestors (Gst3DNode * self, gsize flag_offset)
+{
+  Gst3DNode *node;
+  for (node = self->parent; node != NULL; node = node->parent) {
+    gboolean *flag = G_STRUCT_MEMBER_P (node, flag_offset);
+    if (*flag)
+      break;
+    *flag = TRUE;
+  }
+}
+
+/**
+ * gst_3d_node_append_child:
+ * @child: (transfer full): node drawn after @self, transformed relative
+ *   to it
+ */
+void
+gst_3d_node_append_child (Gst3DNode * self, Gst3DNode * child)
+{
+  g_return_if_fail (child->parent == NULL);
+
+  self->children = g_list_append (self->children, child);
+  child->parent = self;
+  child->transform_dirty = TRUE;
+  self->hierarchy_dirty = TRUE;
+  _flag_ancestors (self, G_STRUCT_OFFSET (Gst3DNode, hierarchy_dirty));
+}
+
+/**
+ * gst_3d_node_set_transform:
+ * @transform: transformation from the node to its parent
+ *
+ * Moves the node and its children. The world transforms of the changed
+ * subtrees are recomputed once before the next frame, the meshes are not
+ * touched.
+ */
+void
+gst_3d_node_set_transform (Gst3DNode * self,
+    const graphene_matrix_t * transform)
+{
+  graphene_matrix_init_from_matrix (&self->transform, transform);
+  if (self->transform_dirty)
+    return;
+  self->transform_dirty = TRUE;
+  _flag_ancestors (self, G_STRUCT_OFFSET (Gst3DNode, subtree_dirty));
+  gst_3d_node_invalidate_bounds (self);
+}
+
+/**
+ * gst_3d_node_invalidate_bounds:
+ *
+ * Has the scene recompute the bounds of the node and its ancestors before
+ * the next frame, e.g. after its meshes were replaced. Moving nodes does
+ * this already.
+ */
+void
+gst_3d_node_invalidate_bounds (Gst3DNode * self)
+{
+  self->bounds_dirty = TRUE;
+  _flag_ancestors (self, G_STRUCT_OFFSET (Gst3DNode, bounds_dirty));
+}
+
+static guint
+_mesh_bounds_generation (Gst3DNode * self)
+{
+  guint generation = 0;
+  GList *l;
+  for (l = self->meshes; l != NULL; l = l->next)
+    generation += ((Gst3DMesh *) l->data)->bounds_generation;
+  return generation;
+}
+
+/**
+ * gst_3d_node_check_mesh_bounds:
+ *
+ * Invalidates the bounds of the node if the bounds of one of its meshes
+ * changed since they were computed, e.g. by gst_3d_mesh_update_vertices().
+ * Generations only grow, so any change also changes their sum.
+ */
+void
+gst_3d_node_check_mesh_bounds (Gst3DNode * self)
+{
+  if (!self->bounds_dirty
+      && _mesh_bounds_generation (self) != self->mesh_bounds_generation)
+    gst_3d_node_invalidate_bounds (self);
+}
+
+/**
+ * gst_3d_node_update_bounds:
+ * @world: world transform of the node
+ *
+ * Recomputes the world space bounds of the node from its meshes and the
+ * bounds of its children, which have to be updated first. A node
+ * containing anything of unknown size gets no bounds and is never culled
+ * as a whole, its children still can be.
+ *
+ * Returns: FALSE if the size of anything in the node is unknown
+ */
+gboolean
+gst_3d_node_update_bounds (Gst3DNode * self, const graphene_matrix_t * world)
+{
+  gboolean known = TRUE;
+  gboolean empty = TRUE;
+  graphene_box_t local, bounds;
+  GList *l;
+
+  graphene_box_init_from_box (&local, graphene_box_empty ());
+  self->mesh_bounds_generation = _mesh_bounds_generation (self);
+
+  for (l = self->meshes; l != NULL; l = l->next) {
+    Gst3DMesh *mesh = (Gst3DMesh *) l->data;
+    if (mesh->has_bounds) {
+      graphene_box_union (&local, &mesh->bounds, &local);
+      empty = FALSE;
+    } else {
+      known = FALSE;
+    }
+  }
+
+  if (self->octree) {
+    Gst3DOctreeNode *root =
+        &g_array_index (self->octree->nodes, Gst3DOctreeNode, 0);
+    graphene_point3d_t max;
+    graphene_box_t octree_bounds;
+    graphene_point3d_init (&max, root->min.x + root->size,
+        root->min.y + root->size, root->min.z + root->size);
+    graphene_box_init (&octree_bounds, &root->min, &max);
+    graphene_box_union (&local, &octree_bounds, &local);
+    empty = FALSE;
+  }
+
+  if (empty)
+    graphene_box_init_from_box (&bounds, graphene_box_empty ());
+  else
+    graphene_matrix_transform_box (world, &local, &bounds);
+
+  for (l = self->children; l != NULL; l = l->next) {
+    Gst3DNode *child = (Gst3DNode *) l->data;
+    if (!child->bounds_known) {
+      known = FALSE;
+    } else if (child->has_bounds) {
+      graphene_box_union (&bounds, &child->bounds, &bounds);
+      empty = FALSE;
+    }
+  }
+
+  /* empty nodes, e.g. models that are still loading, draw nothing anyway */
+  self->bounds_known = known;
+  self->has_bounds = known && !empty;
+  if (self->has_bounds) {
+    graphene_box_init_from_box (&self->bounds, &bounds);
+    graphene_box_get_bounding_sphere (&self->bounds, &self->bounding_sphere);
+  }
+
+  return known;
+}
+
 Gst3DNode *
 gst_3d_node_new_debug_axes (GstGLContext * context)
 {
@@ -96,7 +314,7 @@ gst_3d_node_new_debug_axes (GstGLContext * context)
   node = g_object_new (GST_3D_TYPE_NODE, NULL);
   node->context = gst_object_ref (context);
 
-  node->shader = gst_3d_shader_new_vert_frag (context, "mvp_color.vert", "color.frag", &error);
+  node->shader = gst_3d_shader_new_vert_frag (context, "view_color.vert", "color.frag", &error);
   if (node->shader == NULL) {
     GST_WARNING ("Failed to create shaders. Error: %s", error->message);
     g_clear_error (&error);
@@ -104,29 +322,28 @@ gst_3d_node_new_debug_axes (GstGLContext * context)
     return NULL;
   }
 
-  gst_gl_shader_use (node->shader->shader);
+  gst_3d_shader_bind (node->shader);
 
   graphene_vec3_t from, to, color;
+  Gst3DMeshData *axes[3];
   graphene_vec3_init (&from, 0.f, 0.f, 0.f);
-  graphene_vec3_init (&to, 1.f, 0.f, 0.f);
-  graphene_vec3_init (&color, 1.f, 0.f, 0.f);
-  Gst3DMesh *x_axis = gst_3d_mesh_new_line (context, &from, &to, &color);
-  gst_3d_mesh_bind_shader (x_axis, node->shader);
-  node->meshes = g_list_append (node->meshes, x_axis);
+  for (guint i = 0; i < 3; i++) {
+    graphene_vec3_init (&to, i == 0, i == 1, i == 2);
+    graphene_vec3_init (&color, i == 0, i == 1, i == 2);
+    axes[i] = gst_3d_mesh_data_new_line (&from, &to, &color);
+  }
 
-  graphene_vec3_init (&from, 0.f, 0.f, 0.f);
-  graphene_vec3_init (&to, 0.f, 1.f, 0.f);
-  graphene_vec3_init (&color, 0.f, 1.f, 0.f);
-  Gst3DMesh *y_axis = gst_3d_mesh_new_line (context, &from, &to, &color);
-  gst_3d_mesh_bind_shader (y_axis, node->shader);
-  node->meshes = g_list_append (node->meshes, y_axis);
+  /* one vertex array and draw call for all axes */
+  Gst3DMeshData *batch = gst_3d_mesh_data_batch (axes, 3);
+  Gst3DMesh *mesh = gst_3d_mesh_new (context);
+  gst_3d_mesh_init_buffers (mesh);
+  gst_3d_mesh_upload_data (mesh, batch);
+  gst_3d_mesh_bind_shader (mesh, node->shader);
+  node->meshes = g_list_append (node->meshes, mesh);
 
-  graphene_vec3_init (&from, 0.f, 0.f, 0.f);
-  graphene_vec3_init (&to, 0.f, 0.f, 1.f);
-  graphene_vec3_init (&color, 0.f, 0.f, 1.f);
-  Gst3DMesh *z_axis = gst_3d_mesh_new_line (context, &from, &to, &color);
-  gst_3d_mesh_bind_shader (z_axis, node->shader);
-  node->meshes = g_list_append (node->meshes, z_axis);
+  gst_3d_mesh_data_free (batch);
+  for (guint i = 0; i < 3; i++)
+    gst_3d_mesh_data_free (axes[i]);
 
   return node;
 }
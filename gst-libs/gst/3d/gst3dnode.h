@@ -26,6 +26,7 @@
 #include <gst/gl/gstgl_fwd.h>
 #include "gst3dshader.h"
 #include "gst3dmesh.h"
+#include "gst3doctree.h"
 
 G_BEGIN_DECLS
 #define GST_3D_TYPE_NODE            (gst_3d_node_get_type ())
@@ -45,6 +46,39 @@ struct _Gst3DNode
   
   GList *meshes;
   Gst3DShader *shader;
+
+  Gst3DOctree *octree;
+
+  /* bound to unit 0 while drawing, 0 keeps the bound texture */
+  GLuint texture;
+  /* multiplies the vertex colors of instanced shaders */
+  graphene_vec4_t color;
+
+  GList *children;
+  Gst3DNode *parent;
+
+  /* relative to the parent, see gst_3d_node_set_transform() */
+  graphene_matrix_t transform;
+  gboolean transform_dirty;
+  /* a transform below this node changed */
+  gboolean subtree_dirty;
+  /* nodes were added below this node */
+  gboolean hierarchy_dirty;
+  /* the bounds of this node or a node below it changed, see
+   * gst_3d_node_invalidate_bounds() */
+  gboolean bounds_dirty;
+  /* world transform of the node in the scene */
+  guint world_index;
+
+  /* world space bounds of the meshes and children, see
+   * gst_3d_node_update_bounds() */
+  gboolean bounds_known;
+  gboolean has_bounds;
+  graphene_box_t bounds;
+  graphene_sphere_t bounding_sphere;
+  /* sum of the bounds generations of the meshes when the bounds were
+   * computed, see gst_3d_node_check_mesh_bounds() */
+  guint mesh_bounds_generation;
 };
 
 struct _Gst3DNodeClass
@@ -57,11 +91,20 @@ GType gst_3d_node_get_type (void);
 
 Gst3DNode *gst_3d_node_new_debug_axes (GstGLContext * context);
 
+void gst_3d_node_append_child (Gst3DNode * self, Gst3DNode * child);
+void gst_3d_node_set_transform (Gst3DNode * self, const graphene_matrix_t * transform);
+void gst_3d_node_invalidate_bounds (Gst3DNode * self);
+void gst_3d_node_check_mesh_bounds (Gst3DNode * self);
+
+gboolean gst_3d_node_update_bounds (Gst3DNode * self, const graphene_matrix_t * world);
+
 void gst_3d_node_draw (Gst3DNode * self);
 void gst_3d_node_draw_wireframe (Gst3DNode * self);
 
 Gst3DNode *
 gst_3d_node_new_from_mesh_shader (GstGLContext * context, Gst3DMesh * mesh, Gst3DShader * shader);
+Gst3DNode *
+gst_3d_node_new_from_octree (GstGLContext * context, Gst3DOctree * octree, Gst3DShader * shader);
 
 G_END_DECLS
 #endif /* __GST_3D_NODE_H__ */
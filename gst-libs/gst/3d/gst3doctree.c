@@ -0,0 +1,448 @@
+/*
+ * GStreamer Plugins VR
+ * Copyright (C) 2016 Lubosz Sarnecki <lubosz.sarnecki@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define GST_USE_UNSTABLE_API
+#include <gst/gl/gl.h>
+#include <gst/gl/gstglfuncs.h>
+
+#include "gst3doctree.h"
+
+#define GST_CAT_DEFAULT gst_3d_octree_debug
+GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
+
+G_DEFINE_TYPE_WITH_CODE (Gst3DOctree, gst_3d_octree, GST_TYPE_OBJECT,
+    GST_DEBUG_CATEGORY_INIT (gst_3d_octree_debug, "3doctree", 0, "octree"));
+
+#define OCCUPANCY_BYTES \
+    (GST_3D_OCTREE_GRID * GST_3D_OCTREE_GRID * GST_3D_OCTREE_GRID / 8)
+
+static void
+_node_init (Gst3DOctreeNode * node, const graphene_point3d_t * min, gfloat size,
+    guint depth)
+{
+  node->min = *min;
+  node->size = size;
+  node->depth = depth;
+  for (int i = 0; i < 8; i++)
+    node->children[i] = -1;
+  node->points = g_array_new (FALSE, FALSE, sizeof (Gst3DOctreePoint));
+  node->occupancy = g_malloc0 (OCCUPANCY_BYTES);
+  node->uploaded_count = 0;
+}
+
+static void
+_node_clear (gpointer data)
+{
+  Gst3DOctreeNode *node = (Gst3DOctreeNode *) data;
+  g_array_free (node->points, TRUE);
+  g_free (node->occupancy);
+}
+
+void
+gst_3d_octree_init (Gst3DOctree * self)
+{
+  self->nodes = g_array_new (FALSE, FALSE, sizeof (Gst3DOctreeNode));
+  g_array_set_clear_func (self->nodes, _node_clear);
+  self->max_depth = 8;
+  self->vao = 0;
+  self->vbo = 0;
+  self->slot_count = 0;
+  self->needs_realloc = FALSE;
+  self->error_threshold = 1.0f;
+  self->point_budget = 2000000;
+  self->drawn_nodes = 0;
+  self->drawn_points = 0;
+  self->dropped_points = 0;
+}
+
+/**
+ * gst_3d_octree_new:
+ * @context: the #GstGLContext the vertex buffer will be created in
+ * @bounds: the volume the cloud is expected to occupy, points outside
+ *   of it are dropped
+ * @max_depth: deepest level points are refined to
+ *
+ * Needs to be called from the GL thread.
+ */
+Gst3DOctree *
+gst_3d_octree_new (GstGLContext * context, const graphene_box_t * bounds,
+    guint max_depth)
+{
+  g_return_val_if_fail (GST_IS_GL_CONTEXT (context), NULL);
+  g_return_val_if_fail (bounds != NULL, NULL);
+
+  Gst3DOctree *octree = g_object_new (GST_3D_TYPE_OCTREE, NULL);
+  octree->context = gst_object_ref (context);
+  octree->max_depth = max_depth;
+
+  /* the root is a cube around the requested bounds */
+  graphene_point3d_t min;
+  graphene_vec3_t size;
+  graphene_box_get_min (bounds, &min);
+  graphene_box_get_size (bounds, &size);
+  gfloat edge = MAX (graphene_vec3_get_x (&size),
+      MAX (graphene_vec3_get_y (&size), graphene_vec3_get_z (&size)));
+
+  Gst3DOctreeNode root;
+  _node_init (&root, &min, edge, 0);
+  g_array_append_val (octree->nodes, root);
+
+  GstGLFuncs *gl = context->gl_vtable;
+  gl->GenVertexArrays (1, &octree->vao);
+  gl->GenBuffers (1, &octree->vbo);
+  octree->needs_realloc = TRUE;
+
+  return octree;
+}
+
+static void
+gst_3d_octree_finalize (GObject * object)
+{
+  Gst3DOctree *self = GST_3D_OCTREE (object);
+  g_return_if_fail (self != NULL);
+
+  if (self->context) {
+    GstGLFuncs *gl = self->context->gl_vtable;
+    if (self->vao) {
+      gl->DeleteVertexArrays (1, &self->vao);
+      self->vao = 0;
+    }
+    if (self->vbo) {
+      gl->DeleteBuffers (1, &self->vbo);
+      self->vbo = 0;
+    }
+    gst_object_unref (self->context);
+    self->context = NULL;
+  }
+
+  g_array_free (self->nodes, TRUE);
+
+  G_OBJECT_CLASS (gst_3d_octree_parent_class)->finalize (object);
+}
+
+static void
+gst_3d_octree_class_init (Gst3DOctreeClass * klass)
+{
+  GObjectClass *obj_class = G_OBJECT_CLASS (klass);
+  obj_class->finalize = gst_3d_octree_finalize;
+}
+
+static inline guint
+_grid_coord (gfloat value, gfloat min, gfloat size, guint grid)
+{
+  gint c = (gint) ((value - min) / size * grid);
+  return CLAMP (c, 0, (gint) grid - 1);
+}
+
+static gboolean
+_insert_point (Gst3DOctree * self, const Gst3DOctreePoint * point)
+{
+  guint index = 0;
+
+  while (TRUE) {
+    Gst3DOctreeNode *node =
+        &g_array_index (self->nodes, Gst3DOctreeNode, index);
+
+    guint gx = _grid_coord (point->position[0], node->min.x, node->size,
+        GST_3D_OCTREE_GRID);
+    guint gy = _grid_coord (point->position[1], node->min.y, node->size,
+        GST_3D_OCTREE_GRID);
+    guint gz = _grid_coord (point->position[2], node->min.z, node->size,
+        GST_3D_OCTREE_GRID);
+    guint cell = (gz * GST_3D_OCTREE_GRID + gy) * GST_3D_OCTREE_GRID + gx;
+
+    /* one point per grid cell keeps every level a uniform subsample */
+    if (!(node->occupancy[cell / 8] & (1 << (cell % 8)))
+        && node->points->len < GST_3D_OCTREE_NODE_CAPACITY) {
+      node->occupancy[cell / 8] |= 1 << (cell % 8);
+      g_array_append_val (node->points, *point);
+      return TRUE;
+    }
+
+    if (node->depth >= self->max_depth)
+      return FALSE;
+
+    gfloat half = node->size / 2.0f;
+    guint octant = (gx >= GST_3D_OCTREE_GRID / 2 ? 1 : 0)
+        | (gy >= GST_3D_OCTREE_GRID / 2 ? 2 : 0)
+        | (gz >= GST_3D_OCTREE_GRID / 2 ? 4 : 0);
+
+    if (node->children[octant] == -1) {
+      Gst3DOctreeNode child;
+      graphene_point3d_t child_min;
+      graphene_point3d_init (&child_min,
+          node->min.x + (octant & 1 ? half : 0),
+          node->min.y + (octant & 2 ? half : 0),
+          node->min.z + (octant & 4 ? half : 0));
+      _node_init (&child, &child_min, half, node->depth + 1);
+
+      node->children[octant] = self->nodes->len;
+      /* appending can move the array, node is invalid after this */
+      g_array_append_val (self->nodes, child);
+
+      if (self->nodes->len > self->slot_count)
+        self->needs_realloc = TRUE;
+    }
+
+    node = &g_array_index (self->nodes, Gst3DOctreeNode, index);
+    index = node->children[octant];
+  }
+}
+
+/**
+ * gst_3d_octree_insert_points:
+ *
+ * Adds points to the tree on the CPU. Only the touched nodes will be
+ * uploaded on the next gst_3d_octree_upload(), so this can be called
+ * incrementally for every new depth frame.
+ *
+ * Returns: the number of points that were stored.
+ */
+guint
+gst_3d_octree_insert_points (Gst3DOctree * self,
+    const Gst3DOctreePoint * points, guint count)
+{
+  Gst3DOctreeNode *root = &g_array_index (self->nodes, Gst3DOctreeNode, 0);
+  gfloat max_x = root->min.x + root->size;
+  gfloat max_y = root->min.y + root->size;
+  gfloat max_z = root->min.z + root->size;
+  guint stored = 0;
+
+  for (guint i = 0; i < count; i++) {
+    const GLfloat *p = points[i].position;
+    if (p[0] < root->min.x || p[1] < root->min.y || p[2] < root->min.z
+        || p[0] > max_x || p[1] > max_y || p[2] > max_z) {
+      self->dropped_points++;
+      continue;
+    }
+    if (_insert_point (self, &points[i]))
+      stored++;
+    else
+      self->dropped_points++;
+    root = &g_array_index (self->nodes, Gst3DOctreeNode, 0);
+  }
+
+  GST_LOG ("stored %d of %d points in %d nodes", stored, count,
+      self->nodes->len);
+
+  return stored;
+}
+
+void
+gst_3d_octree_clear (Gst3DOctree * self)
+{
+  Gst3DOctreeNode *root = &g_array_index (self->nodes, Gst3DOctreeNode, 0);
+  graphene_point3d_t min = root->min;
+  gfloat size = root->size;
+
+  g_array_set_size (self->nodes, 0);
+
+  Gst3DOctreeNode new_root;
+  _node_init (&new_root, &min, size, 0);
+  g_array_append_val (self->nodes, new_root);
+  self->dropped_points = 0;
+}
+
+/**
+ * gst_3d_octree_upload:
+ *
+ * Uploads the points added since the last upload. Each node owns a slot of
+ * GST_3D_OCTREE_NODE_CAPACITY points in one vertex buffer, so new points are
+ * appended to their slot with BufferSubData. The buffer is only respecified
+ * when the node count outgrows the slots.
+ */
+void
+gst_3d_octree_upload (Gst3DOctree * self)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  const gsize slot_size = GST_3D_OCTREE_NODE_CAPACITY * sizeof (Gst3DOctreePoint);
+
+  gl->BindBuffer (GL_ARRAY_BUFFER, self->vbo);
+
+  if (self->needs_realloc) {
+    guint slots = MAX (self->slot_count, 8);
+    while (slots < self->nodes->len)
+      slots *= 2;
+
+    GST_DEBUG ("growing point buffer to %d slots (%" G_GSIZE_FORMAT " bytes)",
+        slots, slots * slot_size);
+
+    gl->BufferData (GL_ARRAY_BUFFER, slots * slot_size, NULL, GL_DYNAMIC_DRAW);
+    self->slot_count = slots;
+    self->needs_realloc = FALSE;
+
+    for (guint i = 0; i < self->nodes->len; i++)
+      g_array_index (self->nodes, Gst3DOctreeNode, i).uploaded_count = 0;
+  }
+
+  for (guint i = 0; i < self->nodes->len; i++) {
+    Gst3DOctreeNode *node = &g_array_index (self->nodes, Gst3DOctreeNode, i);
+    guint pending = node->points->len - node->uploaded_count;
+    if (pending == 0)
+      continue;
+
+    gl->BufferSubData (GL_ARRAY_BUFFER,
+        i * slot_size + node->uploaded_count * sizeof (Gst3DOctreePoint),
+        pending * sizeof (Gst3DOctreePoint),
+        &g_array_index (node->points, Gst3DOctreePoint, node->uploaded_count));
+    node->uploaded_count = node->points->len;
+  }
+
+  gl->BindBuffer (GL_ARRAY_BUFFER, 0);
+}
+
+void
+gst_3d_octree_bind_shader (Gst3DOctree * self, Gst3DShader * shader)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  gst_3d_shader_bind (shader);
+
+  gl->BindVertexArray (self->vao);
+  gl->BindBuffer (GL_ARRAY_BUFFER, self->vbo);
+
+  GLint position = gst_3d_shader_get_attribute_location (shader,
+      "position");
+  if (position != -1) {
+    gl->VertexAttribPointer (position, 3, GL_FLOAT, GL_FALSE,
+        sizeof (Gst3DOctreePoint),
+        (gpointer) G_STRUCT_OFFSET (Gst3DOctreePoint, position));
+    gl->EnableVertexAttribArray (position);
+  } else {
+    GST_WARNING ("could not find attribute position in shader.");
+  }
+
+  GLint color = gst_3d_shader_get_attribute_location (shader, "color");
+  if (color != -1) {
+    gl->VertexAttribPointer (color, 3, GL_FLOAT, GL_FALSE,
+        sizeof (Gst3DOctreePoint),
+        (gpointer) G_STRUCT_OFFSET (Gst3DOctreePoint, color));
+    gl->EnableVertexAttribArray (color);
+  }
+
+  gl->BindVertexArray (0);
+  gl->BindBuffer (GL_ARRAY_BUFFER, 0);
+}
+
+void
+gst_3d_octree_set_lod (Gst3DOctree * self, gfloat error_threshold,
+    guint point_budget)
+{
+  self->error_threshold = error_threshold;
+  self->point_budget = point_budget;
+}
+
+/* Length of the projected y axis, the focal length when the mvp has no
+ * model scale. Only depends on the matrix, not the node. */
+static gfloat
+_projection_scale (const graphene_matrix_t * mvp)
+{
+  gfloat x = graphene_matrix_get_value (mvp, 0, 1);
+  gfloat y = graphene_matrix_get_value (mvp, 1, 1);
+  gfloat z = graphene_matrix_get_value (mvp, 2, 1);
+  return sqrtf (x * x + y * y + z * z);
+}
+
+/**
+ * gst_3d_octree_draw:
+ *
+ * Draws the nodes that are inside the frustum of @mvp, refining from the
+ * root until the projected point spacing of a node drops below the error
+ * threshold in pixels or the point budget is used up. Levels are drawn
+ * breadth first, so running out of budget only drops the finest detail.
+ */
+void
+gst_3d_octree_draw (Gst3DOctree * self, graphene_matrix_t * mvp)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  gst_3d_octree_upload (self);
+
+  GLint viewport[4];
+  gl->GetIntegerv (GL_VIEWPORT, viewport);
+
+  graphene_frustum_t frustum;
+  graphene_frustum_init_from_matrix (&frustum, mvp);
+  gfloat pixel_scale = _projection_scale (mvp) * viewport[3] / 2.0f;
+
+  self->drawn_nodes = 0;
+  self->drawn_points = 0;
+
+  gl->BindVertexArray (self->vao);
+
+  GQueue queue = G_QUEUE_INIT;
+  g_queue_push_tail (&queue, GINT_TO_POINTER (0));
+
+  while (!g_queue_is_empty (&queue)) {
+    guint index = GPOINTER_TO_INT (g_queue_pop_head (&queue));
+    Gst3DOctreeNode *node = &g_array_index (self->nodes, Gst3DOctreeNode, index);
+
+    if (node->uploaded_count == 0)
+      continue;
+
+    graphene_point3d_t max;
+    graphene_box_t box;
+    graphene_point3d_init (&max, node->min.x + node->size,
+        node->min.y + node->size, node->min.z + node->size);
+    graphene_box_init (&box, &node->min, &max);
+
+    if (!graphene_frustum_intersects_box (&frustum, &box))
+      continue;
+
+    if (self->drawn_points + node->uploaded_count > self->point_budget)
+      break;
+
+    gl->DrawArrays (GL_POINTS, index * GST_3D_OCTREE_NODE_CAPACITY,
+        node->uploaded_count);
+    self->drawn_nodes++;
+    self->drawn_points += node->uploaded_count;
+
+    /* screen space error: point spacing of this level in pixels */
+    graphene_vec4_t center, clip;
+    graphene_vec4_init (&center, node->min.x + node->size / 2.0f,
+        node->min.y + node->size / 2.0f, node->min.z + node->size / 2.0f, 1.0f);
+    graphene_matrix_transform_vec4 (mvp, &center, &clip);
+
+    gfloat distance = graphene_vec4_get_w (&clip) - node->size;
+    gfloat spacing = node->size / GST_3D_OCTREE_GRID;
+    gfloat error = distance > 0 ?
+        spacing * pixel_scale / distance : self->error_threshold + 1.0f;
+
+    if (error <= self->error_threshold)
+      continue;
+
+    for (int i = 0; i < 8; i++)
+      if (node->children[i] != -1)
+        g_queue_push_tail (&queue, GINT_TO_POINTER (node->children[i]));
+  }
+
+  g_queue_clear (&queue);
+
+  GST_LOG ("drew %d points in %d of %d nodes", self->drawn_points,
+      self->drawn_nodes, self->nodes->len);
+}
@@ -0,0 +1,110 @@
+/*
+ * GStreamer Plugins VR
+ * Copyright (C) 2016 Lubosz Sarnecki <lubosz.sarnecki@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_3D_OCTREE_H__
+#define __GST_3D_OCTREE_H__
+
+
+#include <gst/gst.h>
+#include <gst/gl/gstgl_fwd.h>
+#include <graphene.h>
+
+#include "gst3dshader.h"
+
+G_BEGIN_DECLS
+#define GST_3D_TYPE_OCTREE            (gst_3d_octree_get_type ())
+#define GST_3D_OCTREE(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_3D_TYPE_OCTREE, Gst3DOctree))
+#define GST_3D_OCTREE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), GST_3D_TYPE_OCTREE, Gst3DOctreeClass))
+#define GST_IS_3D_OCTREE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_3D_TYPE_OCTREE))
+#define GST_IS_3D_OCTREE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_3D_TYPE_OCTREE))
+#define GST_3D_OCTREE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_3D_TYPE_OCTREE, Gst3DOctreeClass))
+typedef struct _Gst3DOctree Gst3DOctree;
+typedef struct _Gst3DOctreeClass Gst3DOctreeClass;
+
+/* Every node subsamples its volume with a GRID^3 occupancy grid and keeps at
+ * most NODE_CAPACITY points, so it can live in a fixed size slot of the
+ * vertex buffer. Points that do not fit are pushed down to the children. */
+#define GST_3D_OCTREE_GRID 16
+#define GST_3D_OCTREE_NODE_CAPACITY 1024
+
+typedef struct _Gst3DOctreePoint
+{
+  GLfloat position[3];
+  GLfloat color[3];
+} Gst3DOctreePoint;
+
+typedef struct _Gst3DOctreeNode
+{
+  graphene_point3d_t min;
+  gfloat size;
+  guint depth;
+
+  gint children[8];
+
+  /* points are kept on the CPU so the vertex buffer can be regrown */
+  GArray *points;
+  guint8 *occupancy;
+  guint uploaded_count;
+} Gst3DOctreeNode;
+
+struct _Gst3DOctree
+{
+  /*< private > */
+  GstObject parent;
+
+  GstGLContext *context;
+
+  GArray *nodes;
+  guint max_depth;
+
+  guint vao;
+  guint vbo;
+  guint slot_count;
+  gboolean needs_realloc;
+
+  /* lod */
+  gfloat error_threshold;
+  guint point_budget;
+
+  /* statistics of the last draw */
+  guint drawn_nodes;
+  guint drawn_points;
+  guint dropped_points;
+};
+
+struct _Gst3DOctreeClass
+{
+  GstObjectClass parent_class;
+};
+
+Gst3DOctree *gst_3d_octree_new (GstGLContext * context, const graphene_box_t * bounds, guint max_depth);
+GType gst_3d_octree_get_type (void);
+
+guint gst_3d_octree_insert_points (Gst3DOctree * self, const Gst3DOctreePoint * points, guint count);
+void gst_3d_octree_clear (Gst3DOctree * self);
+
+void gst_3d_octree_upload (Gst3DOctree * self);
+void gst_3d_octree_bind_shader (Gst3DOctree * self, Gst3DShader * shader);
+void gst_3d_octree_draw (Gst3DOctree * self, graphene_matrix_t * mvp);
+
+void gst_3d_octree_set_lod (Gst3DOctree * self, gfloat error_threshold, guint point_budget);
+
+G_END_DECLS
+#endif /* __GST_3D_OCTREE_H__ */
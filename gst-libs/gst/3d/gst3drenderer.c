@@ -61,15 +61,46 @@ _insert_gl_debug_marker (GstGLContext * context, const gchar * message)
                           1, GL_DEBUG_SEVERITY_HIGH, strlen (message), message);
 }
 
+static void
+_delete_fbo (GstGLFuncs * gl, GLuint * fbo, GLuint * color_tex)
+{
+  if (!*fbo)
+    return;
+  gl->DeleteFramebuffers (1, fbo);
+  gl->DeleteTextures (1, color_tex);
+  *fbo = *color_tex = 0;
+}
+
+static void
+_delete_targets (Gst3DRenderer * self, Gst3DEyeTargets * targets)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  _delete_fbo (gl, &targets->left_fbo, &targets->left_color_tex);
+  _delete_fbo (gl, &targets->right_fbo, &targets->right_color_tex);
+  _delete_fbo (gl, &targets->stereo_fbo, &targets->stereo_color_tex);
+}
+
 void
 gst_3d_renderer_init (Gst3DRenderer * self)
 {
   self->context = NULL;
   self->shader = NULL;
-  self->left_color_tex = 0;
-  self->left_fbo = 0;
-  self->right_color_tex = 0;
-  self->right_fbo = 0;
+  self->render_plane = NULL;
+  memset (self->targets, 0, sizeof (self->targets));
+  self->single_pass = FALSE;
+  self->allow_direct = TRUE;
+  self->direct = FALSE;
+  self->dynamic_resolution = FALSE;
+  self->min_scale_level = GST_3D_RENDERER_SCALE_LEVELS - 1;
+  self->frame_budget = GST_SECOND / 60;
+  self->scale_level = 0;
+  self->eye_scale = 1.0f;
+  self->frames_at_scale = 0;
+  self->gpu_time = 0;
+  memset (self->timer_queries, 0, sizeof (self->timer_queries));
+  self->timers_started = 0;
+  self->timers_read = 0;
   self->eye_width = 1;
   self->eye_height = 1;
   self->filter_aspect = 1.0f;
@@ -93,6 +124,20 @@ gst_3d_renderer_finalize (GObject * object)
   if (self->shader)
     gst_3d_shader_delete (self->shader);
 
+  if (self->render_plane) {
+    gst_object_unref (self->render_plane);
+    self->render_plane = NULL;
+  }
+
+  if (self->context) {
+    for (guint i = 0; i < GST_3D_RENDERER_SCALE_LEVELS; i++)
+      _delete_targets (self, &self->targets[i]);
+    if (self->timer_queries[0]) {
+      GstGLFuncs *gl = self->context->gl_vtable;
+      gl->DeleteQueries (GST_3D_RENDERER_TIMER_QUERIES, self->timer_queries);
+    }
+  }
+
   if (self->context) {
     gst_object_unref (self->context);
     self->context = NULL;
@@ -131,6 +176,44 @@ _create_fbo (GstGLFuncs * gl, GLuint * fbo, GLuint * color_tex, int width, int h
   }
 }
 
+static gfloat
+_level_scale (guint level)
+{
+  return 1.0f - level * GST_3D_RENDERER_SCALE_STEP;
+}
+
+/* The framebuffers of the current scale, the ones the current mode draws
+ * to are created on first use. Sizes are kept in a small pool, so going
+ * back to a scale does not reallocate. */
+static Gst3DEyeTargets *
+_get_targets (Gst3DRenderer * self)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  Gst3DEyeTargets *targets = &self->targets[self->scale_level];
+  gfloat scale = _level_scale (self->scale_level);
+  guint width = MAX (1, roundf (self->eye_width * scale));
+  guint height = MAX (1, roundf (self->eye_height * scale));
+
+  if (targets->width != width || targets->height != height) {
+    _delete_targets (self, targets);
+    targets->width = width;
+    targets->height = height;
+  }
+
+  if (self->single_pass) {
+    if (!targets->stereo_fbo)
+      _create_fbo (gl, &targets->stereo_fbo, &targets->stereo_color_tex,
+          width * 2, height);
+  } else if (!targets->left_fbo) {
+    _create_fbo (gl, &targets->left_fbo, &targets->left_color_tex, width,
+        height);
+    _create_fbo (gl, &targets->right_fbo, &targets->right_color_tex, width,
+        height);
+  }
+
+  return targets;
+}
+
 /* stereo rendering */
 #ifdef HAVE_OPENHMD
 gboolean
@@ -187,18 +270,20 @@ gst_3d_renderer_stero_init_from_screen (Gst3DRenderer * self)
 }
 
 static void
-_draw_eye (Gst3DRenderer * self, GLuint fbo, Gst3DScene * scene, graphene_matrix_t * mvp)
+_draw_eye (Gst3DRenderer * self, Gst3DEyeTargets * targets, GLuint fbo,
+    Gst3DScene * scene, guint view)
 {
   GstGLFuncs *gl = self->context->gl_vtable;
   _insert_gl_debug_marker (self->context, "_draw_eye");
   gl->BindFramebuffer (GL_FRAMEBUFFER, fbo);
-  gl->Viewport (0, 0, self->eye_width, self->eye_height);
+  gl->Viewport (0, 0, targets->width, targets->height);
   gl->Clear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  gst_3d_scene_draw_nodes (scene, mvp);
+  gst_3d_scene_draw_view (scene, view);
 }
 
+/* scaled eyes are upsampled by the linear filter of their textures */
 static void
-_draw_framebuffers_on_planes (Gst3DRenderer * self)
+_draw_framebuffers_on_planes (Gst3DRenderer * self, Gst3DEyeTargets * targets)
 {
   GstGLFuncs *gl = self->context->gl_vtable;
 
@@ -211,12 +296,12 @@ _draw_framebuffers_on_planes (Gst3DRenderer * self)
 
   /* left framebuffer */
   gl->Viewport (0, 0, self->eye_width, self->eye_height);
-  gl->BindTexture (GL_TEXTURE_2D, self->left_color_tex);
+  gl->BindTexture (GL_TEXTURE_2D, targets->left_color_tex);
   gst_3d_mesh_draw (self->render_plane);
 
   /* right framebuffer */
   gl->Viewport (self->eye_width, 0, self->eye_width, self->eye_height);
-  gl->BindTexture (GL_TEXTURE_2D, self->right_color_tex);
+  gl->BindTexture (GL_TEXTURE_2D, targets->right_color_tex);
   gst_3d_mesh_draw (self->render_plane);
 }
 
@@ -252,13 +337,51 @@ _draw_framebuffers_on_planes_shader_proj (Gst3DRenderer * self, Gst3DCamera * ca
 }
 #endif
 
+/**
+ * gst_3d_renderer_set_single_pass:
+ * @single_pass: draw both eyes in one pass over the scene
+ *
+ * Single pass stereo draws the eyes side by side into one framebuffer,
+ * instanced shaders submit each draw call once for both eyes. It needs
+ * clip distances, the renderer falls back to one pass per eye without
+ * them.
+ *
+ * Returns: whether single pass stereo is used
+ */
+gboolean
+gst_3d_renderer_set_single_pass (Gst3DRenderer * self, gboolean single_pass)
+{
+  if (single_pass && !gst_gl_context_check_gl_version (self->context,
+          GST_GL_API_OPENGL3, 3, 0)) {
+    GST_INFO ("no clip distances, drawing stereo in two passes");
+    single_pass = FALSE;
+  }
+
+  self->single_pass = single_pass;
+  return single_pass;
+}
+
+/**
+ * gst_3d_renderer_set_direct:
+ * @allow_direct: draw the eyes straight into the output framebuffer
+ *
+ * The eye framebuffers are only copied to the output, so when the output
+ * viewport holds both eyes they are drawn into it directly, saving the
+ * copy and the fill rate of the intermediate framebuffers. Allowed by
+ * default, the renderer decides every frame whether it can be used.
+ */
+void
+gst_3d_renderer_set_direct (Gst3DRenderer * self, gboolean allow_direct)
+{
+  self->allow_direct = allow_direct;
+}
+
 void
 gst_3d_renderer_init_stereo (Gst3DRenderer * self, Gst3DCamera * cam)
 {
   // g_print ("gst_3d_renderer_init_stereo.\n");
   GError *error = NULL;
 
-  GstGLFuncs *gl = self->context->gl_vtable;
 #ifdef HAVE_OPENHMD
   Gst3DCameraHmd *hmd_cam = GST_3D_CAMERA_HMD (cam);
   Gst3DHmd *hmd = hmd_cam->hmd;
@@ -267,7 +390,11 @@ gst_3d_renderer_init_stereo (Gst3DRenderer * self, Gst3DCamera * cam)
   // Gst3DCameraArcball * arcball_cam = GST_3D_CAMERA_ARCBALL(cam);
   float aspect_ratio = self->eye_width / self->eye_height;
 #endif
-  self->render_plane = gst_3d_mesh_new_plane (self->context, aspect_ratio);
+  /* the old plane keeps the cached one alive when the aspect is the same */
+  Gst3DMesh *plane = gst_3d_mesh_cache_get_plane (self->context, aspect_ratio);
+  if (self->render_plane)
+    gst_object_unref (self->render_plane);
+  self->render_plane = plane;
   self->shader = gst_3d_shader_new_vert_frag (self->context, "mvp_uv.vert", "texture_uv.frag", &error);
 
   if (self->shader == NULL) {
@@ -278,13 +405,12 @@ gst_3d_renderer_init_stereo (Gst3DRenderer * self, Gst3DCamera * cam)
 
   gst_3d_mesh_bind_shader (self->render_plane, self->shader);
 
-  // 创建framebuffer ，将id保存在left_fbo/ right_fbo 中， 创建 texture ，将id保存在left_color_tex/right_color_tex中
-  _create_fbo (gl, &self->left_fbo, &self->left_color_tex, self->eye_width, self->eye_height);
-  _create_fbo (gl, &self->right_fbo, &self->right_color_tex, self->eye_width, self->eye_height);
+  /* the eye framebuffers are created on the first draw, see _get_targets() */
+  gst_3d_renderer_set_single_pass (self, TRUE);
   // g_print ("eye_width eye_height (%d, %d).\n", self->eye_width, self->eye_height);
 
   gst_3d_shader_bind (self->shader);
-  gst_gl_shader_set_uniform_1i (self->shader->shader, "texture", 0);
+  gst_3d_shader_upload_1i (self->shader, "texture", 0);
 }
 
 #ifdef HAVE_OPENHMD
@@ -296,10 +422,15 @@ gst_3d_renderer_init_stereo_shader_proj (Gst3DRenderer * self, Gst3DCamera * cam
   Gst3DCameraHmd *hmd_cam = GST_3D_CAMERA_HMD (cam);
   Gst3DHmd *hmd = hmd_cam->hmd;
   float aspect_ratio = hmd->left_aspect;
-  self->render_plane = gst_3d_mesh_new_plane (self->context, aspect_ratio);
+  /* the old plane keeps the cached one alive when the aspect is the same */
+  Gst3DMesh *plane = gst_3d_mesh_cache_get_plane (self->context, aspect_ratio);
+  if (self->render_plane)
+    gst_object_unref (self->render_plane);
+  self->render_plane = plane;
 
-  self->shader = gst_3d_shader_new_vert_frag (self->context, "mvp_uv.vert",
-                 "texture_equirectangular_sphere.frag", &error);
+  const gchar *defines[] = { "EQUIRECTANGULAR", NULL };
+  self->shader = gst_3d_shader_new_vert_frag_defines (self->context,
+      "mvp_uv.vert", "texture_uv.frag", defines, &error);
 
   if (self->shader == NULL) {
     GST_WARNING ("Failed to create shaders. Error: %s", error->message);
@@ -310,14 +441,211 @@ gst_3d_renderer_init_stereo_shader_proj (Gst3DRenderer * self, Gst3DCamera * cam
   gst_3d_mesh_bind_shader (self->render_plane, self->shader);
 
   gst_3d_shader_bind (self->shader);
-  gst_gl_shader_set_uniform_1i (self->shader->shader, "texture", 0);
+  gst_3d_shader_upload_1i (self->shader, "texture", 0);
 }
 #endif
 
+/* Both eyes are already side by side, so they are copied to the output
+ * as is, scaled ones are upsampled by the blit. */
+static void
+_draw_single_pass (Gst3DRenderer * self, Gst3DScene * scene, GLint bound_fbo)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  Gst3DEyeTargets *targets = _get_targets (self);
+  GLint width = targets->width * 2;
+
+  _insert_gl_debug_marker (self->context, "_draw_single_pass");
+  gl->BindFramebuffer (GL_FRAMEBUFFER, targets->stereo_fbo);
+  gl->Viewport (0, 0, width, targets->height);
+  gl->Clear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  gst_3d_scene_draw_stereo (scene);
+  gst_3d_scene_clear_state (scene);
+
+  gl->BindFramebuffer (GL_DRAW_FRAMEBUFFER, bound_fbo);
+  gl->Clear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  gl->BindFramebuffer (GL_READ_FRAMEBUFFER, targets->stereo_fbo);
+  gl->BlitFramebuffer (0, 0, width, targets->height, 0, 0,
+      self->eye_width * 2, self->eye_height, GL_COLOR_BUFFER_BIT,
+      self->scale_level ? GL_LINEAR : GL_NEAREST);
+  gl->BindFramebuffer (GL_FRAMEBUFFER, bound_fbo);
+}
+
+/* Each eye is scissored to its half of the output, so nothing drawn for
+ * one eye spills into the other. */
+static void
+_draw_direct (Gst3DRenderer * self, Gst3DScene * scene)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  GLint width = self->eye_width * 2;
+
+  _insert_gl_debug_marker (self->context, "_draw_direct");
+  gl->Viewport (0, 0, width, self->eye_height);
+  gl->Clear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  gl->Enable (GL_SCISSOR_TEST);
+
+  if (self->single_pass) {
+    gl->Scissor (0, 0, width, self->eye_height);
+    gst_3d_scene_draw_stereo (scene);
+  } else {
+    for (guint eye = 0; eye < 2; eye++) {
+      gl->Viewport (eye * self->eye_width, 0, self->eye_width,
+          self->eye_height);
+      gl->Scissor (eye * self->eye_width, 0, self->eye_width,
+          self->eye_height);
+      gst_3d_scene_draw_view (scene, eye);
+    }
+  }
+
+  gl->Disable (GL_SCISSOR_TEST);
+  gst_3d_scene_clear_state (scene);
+}
+
+/* The eyes are composed 1:1 into the left and right half of the output, so
+ * they can be drawn there directly when the output is large enough.
+ * Scaled eyes need the upsampling of the composition. */
+static gboolean
+_can_draw_direct (Gst3DRenderer * self, const GLint * viewport)
+{
+  return self->allow_direct && self->scale_level == 0
+      && viewport[0] == 0 && viewport[1] == 0
+      && viewport[2] >= (GLint) self->eye_width * 2
+      && viewport[3] >= (GLint) self->eye_height;
+}
+
+/**
+ * gst_3d_renderer_set_dynamic_resolution:
+ * @enable: scale the eyes with the GPU time of the frames
+ * @min_eye_scale: lowest fraction of the eye size to draw at
+ * @frame_budget: GPU time a frame may take, e.g. its duration
+ *
+ * The eyes are drawn at a lower resolution while the frames take longer
+ * than the budget on the GPU, and go back up when there is headroom. They
+ * are upsampled to the full eye size in the composition. Needs timer
+ * queries.
+ *
+ * Returns: whether dynamic resolution is used
+ */
+gboolean
+gst_3d_renderer_set_dynamic_resolution (Gst3DRenderer * self, gboolean enable,
+    gfloat min_eye_scale, GstClockTime frame_budget)
+{
+  if (enable && !gst_gl_context_check_gl_version (self->context,
+          GST_GL_API_OPENGL3, 3, 3)
+      && !gst_gl_context_check_feature (self->context, "GL_ARB_timer_query")) {
+    GST_INFO ("no timer queries, drawing the eyes at full resolution");
+    enable = FALSE;
+  }
+
+  self->dynamic_resolution = enable;
+  self->min_scale_level = CLAMP ((1.0f - min_eye_scale) /
+      GST_3D_RENDERER_SCALE_STEP + 0.001f, 0,
+      GST_3D_RENDERER_SCALE_LEVELS - 1);
+  if (frame_budget > 0)
+    self->frame_budget = frame_budget;
+
+  if (!enable || self->scale_level > self->min_scale_level) {
+    self->scale_level = enable ? self->min_scale_level : 0;
+    self->eye_scale = _level_scale (self->scale_level);
+    self->frames_at_scale = 0;
+  }
+
+  return enable;
+}
+
+/* Frames over 90% of the budget lower the scale. It goes back up when the
+ * frame time, grown by the pixel ratio of the larger scale, stays below
+ * 75% of it. A change is held for a while, as the timers lag behind. */
+#define SCALE_DOWN_LOAD 0.9
+#define SCALE_UP_LOAD 0.75
+#define SCALE_HOLD_FRAMES 30
+
+static void
+_update_scale (Gst3DRenderer * self, GstClockTime gpu_time)
+{
+  gdouble budget = self->frame_budget;
+  guint level = self->scale_level;
+
+  if (self->frames_at_scale == 0)
+    self->gpu_time = gpu_time;
+  else
+    self->gpu_time = 0.8 * self->gpu_time + 0.2 * gpu_time;
+
+  if (++self->frames_at_scale < SCALE_HOLD_FRAMES)
+    return;
+
+  if (self->gpu_time > SCALE_DOWN_LOAD * budget) {
+    if (level < self->min_scale_level)
+      level++;
+  } else if (level > 0) {
+    gfloat ratio = _level_scale (level - 1) / _level_scale (level);
+    if (self->gpu_time * ratio * ratio < SCALE_UP_LOAD * budget)
+      level--;
+  }
+
+  if (level == self->scale_level)
+    return;
+
+  GST_DEBUG ("GPU time %.2f ms of %.2f ms, eye scale %.3f -> %.3f",
+      self->gpu_time / GST_MSECOND, budget / GST_MSECOND,
+      _level_scale (self->scale_level), _level_scale (level));
+  self->scale_level = level;
+  self->eye_scale = _level_scale (level);
+  self->frames_at_scale = 0;
+}
+
+/* reads the finished timers, without waiting for the pending ones */
+static void
+_read_timers (Gst3DRenderer * self)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  while (self->timers_read != self->timers_started) {
+    GLuint query = self->timer_queries[self->timers_read %
+        GST_3D_RENDERER_TIMER_QUERIES];
+    GLuint available = 0;
+    GLuint64 elapsed;
+
+    gl->GetQueryObjectuiv (query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      break;
+    gl->GetQueryObjectui64v (query, GL_QUERY_RESULT, &elapsed);
+    self->timers_read++;
+    _update_scale (self, elapsed);
+  }
+}
+
+static void _draw_stereo (Gst3DRenderer * self, Gst3DScene * scene);
+
 void
 gst_3d_renderer_draw_stereo (Gst3DRenderer * self, Gst3DScene * scene)
 {
-  // g_print ("gst_3d_renderer_draw_stereo.\n");
+  GstGLFuncs *gl = self->context->gl_vtable;
+  gboolean timed = FALSE;
+
+  if (self->dynamic_resolution) {
+    if (!self->timer_queries[0])
+      gl->GenQueries (GST_3D_RENDERER_TIMER_QUERIES, self->timer_queries);
+    _read_timers (self);
+    /* all timers in flight, this frame goes untimed */
+    timed = self->timers_started - self->timers_read <
+        GST_3D_RENDERER_TIMER_QUERIES;
+  }
+
+  if (timed)
+    gl->BeginQuery (GL_TIME_ELAPSED, self->timer_queries[self->timers_started
+            % GST_3D_RENDERER_TIMER_QUERIES]);
+
+  _draw_stereo (self, scene);
+
+  if (timed) {
+    gl->EndQuery (GL_TIME_ELAPSED);
+    self->timers_started++;
+  }
+}
+
+static void
+_draw_stereo (Gst3DRenderer * self, Gst3DScene * scene)
+{
   GstGLFuncs *gl = self->context->gl_vtable;
 
   _insert_gl_debug_marker (self->context, "gst_3d_renderer_draw_stereo");
@@ -332,11 +660,38 @@ gst_3d_renderer_draw_stereo (Gst3DRenderer * self, Gst3DScene * scene)
 #else
   Gst3DCameraArcball * hmd_cam = GST_3D_CAMERA_ARCBALL(scene->camera);
 #endif
+  /* both view blocks in one upload */
+  graphene_matrix_t views[2] = { hmd_cam->left_vp_matrix,
+    hmd_cam->right_vp_matrix
+  };
+  gst_3d_scene_set_views (scene, views, 2);
+
+  GLint viewport[4];
+  gl->GetIntegerv (GL_VIEWPORT, viewport);
+  gboolean direct = _can_draw_direct (self, viewport);
+  if (direct != self->direct) {
+    GST_INFO ("drawing eyes %s", direct ? "directly into the output" :
+        "through eye framebuffers");
+    self->direct = direct;
+  }
+
+  if (direct) {
+    _draw_direct (self, scene);
+    return;
+  }
+
+  if (self->single_pass) {
+    _draw_single_pass (self, scene, bound_fbo);
+    return;
+  }
+
+  Gst3DEyeTargets *targets = _get_targets (self);
+
   /* left eye */
-  _draw_eye (self, self->left_fbo, scene, &hmd_cam->left_vp_matrix);
+  _draw_eye (self, targets, targets->left_fbo, scene, 0);
 
   /* right eye */
-  _draw_eye (self, self->right_fbo, scene, &hmd_cam->right_vp_matrix);
+  _draw_eye (self, targets, targets->right_fbo, scene, 1);
 
   gst_3d_scene_clear_state (scene);
 
@@ -344,7 +699,7 @@ gst_3d_renderer_draw_stereo (Gst3DRenderer * self, Gst3DScene * scene)
   gl->BindFramebuffer (GL_FRAMEBUFFER, bound_fbo);
   gl->Clear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  _draw_framebuffers_on_planes (self);
+  _draw_framebuffers_on_planes (self, targets);
   gst_3d_scene_clear_state (scene);
 }
 
@@ -46,6 +46,25 @@ typedef struct _Gst3DRendererClass Gst3DRendererClass;
 
 typedef struct _Gst3DScene Gst3DScene;
 
+/* Eye resolutions of the dynamic resolution, from the full size down to
+ * 1 - (LEVELS - 1) * STEP of it. */
+#define GST_3D_RENDERER_SCALE_LEVELS 7
+#define GST_3D_RENDERER_SCALE_STEP 0.125f
+/* GPU timers in flight, results are read a few frames late to not stall */
+#define GST_3D_RENDERER_TIMER_QUERIES 4
+
+/* Framebuffers of the eyes at one scale, created when first drawn to. */
+typedef struct _Gst3DEyeTargets
+{
+  guint width;
+  guint height;
+
+  GLuint left_color_tex, left_fbo;
+  GLuint right_color_tex, right_fbo;
+  /* both eyes side by side, for single pass stereo */
+  GLuint stereo_color_tex, stereo_fbo;
+} Gst3DEyeTargets;
+
 struct _Gst3DRenderer
 {
   /*< private > */
@@ -55,9 +74,29 @@ struct _Gst3DRenderer
   Gst3DMesh *render_plane;
 
   Gst3DShader *shader;
-  
-  GLuint left_color_tex, left_fbo;
-  GLuint right_color_tex, right_fbo;
+
+  /* one set per scale level, see gst_3d_renderer_set_dynamic_resolution() */
+  Gst3DEyeTargets targets[GST_3D_RENDERER_SCALE_LEVELS];
+
+  /* both eyes side by side, see gst_3d_renderer_set_single_pass() */
+  gboolean single_pass;
+
+  /* eyes drawn into the output, see gst_3d_renderer_set_direct() */
+  gboolean allow_direct;
+  gboolean direct;
+
+  /* dynamic resolution */
+  gboolean dynamic_resolution;
+  guint min_scale_level;
+  GstClockTime frame_budget;
+  guint scale_level;
+  gfloat eye_scale;
+  guint frames_at_scale;
+  /* smoothed GPU time of a frame in ns */
+  gdouble gpu_time;
+  GLuint timer_queries[GST_3D_RENDERER_TIMER_QUERIES];
+  guint timers_started;
+  guint timers_read;
   
   guint eye_width;
   guint eye_height;
@@ -75,6 +114,10 @@ GType gst_3d_renderer_get_type (void);
 void gst_3d_renderer_create_fbo (GstGLFuncs *gl, GLuint * fbo, GLuint * color_tex, int width, int height);
 void gst_3d_renderer_init_stereo (Gst3DRenderer * self, Gst3DCamera *cam);
 void gst_3d_renderer_draw_stereo (Gst3DRenderer * self, Gst3DScene *scene);
+gboolean gst_3d_renderer_set_single_pass (Gst3DRenderer * self, gboolean single_pass);
+void gst_3d_renderer_set_direct (Gst3DRenderer * self, gboolean allow_direct);
+gboolean gst_3d_renderer_set_dynamic_resolution (Gst3DRenderer * self,
+    gboolean enable, gfloat min_eye_scale, GstClockTime frame_budget);
 
 void gst_3d_renderer_draw_stereo_shader_proj (Gst3DRenderer * self, Gst3DScene * scene);
 void gst_3d_renderer_init_stereo_shader_proj (Gst3DRenderer * self, Gst3DCamera * cam);
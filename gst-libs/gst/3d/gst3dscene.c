@@ -45,6 +45,35 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 G_DEFINE_TYPE_WITH_CODE (Gst3DScene, gst_3d_scene, GST_TYPE_OBJECT,
                          GST_DEBUG_CATEGORY_INIT (gst_3d_scene_debug, "3dscene", 0, "scene"));
 
+/* An entry of the render queue, sorted by the state it needs so the state
+ * changes between consecutive entries are minimal. */
+typedef struct
+{
+  GLuint program;
+  GLuint texture;
+  GLuint vertex_array;
+  Gst3DNode *node;
+  /* NULL for octrees, which bind their own buffers */
+  Gst3DMesh *mesh;
+  /* index in the instance buffer, for instanced shaders */
+  guint instance;
+} Gst3DRenderItem;
+
+/* A node of the flattened trees. Descendants directly follow their node,
+ * so a subtree is the range up to end. */
+typedef struct
+{
+  Gst3DNode *node;
+  /* -1 for the root nodes */
+  gint parent;
+  guint end;
+  /* the world transform was recomputed this frame */
+  gboolean changed;
+} Gst3DSceneEntry;
+
+/* the tracked state is unknown, e.g. after foreign GL calls */
+#define GST_3D_SCENE_STATE_UNKNOWN G_MAXUINT
+
 void
 gst_3d_scene_init (Gst3DScene * self)
 {
@@ -52,8 +81,28 @@ gst_3d_scene_init (Gst3DScene * self)
   self->camera = NULL;
   self->renderer = NULL;
   self->context = NULL;
+  self->loader = NULL;
+  self->view_buffer = 0;
+  self->view_stride = 0;
+  self->n_views = 0;
+  self->drawn_nodes = 0;
+  self->culled_nodes = 0;
+  self->updated_transforms = 0;
+  self->draw_calls = 0;
+  self->state_changes = 0;
+  self->state_changes_saved = 0;
+  self->instances = g_array_new (FALSE, FALSE, sizeof (Gst3DInstance));
+  self->instance_buffer = 0;
+  self->entries = g_array_new (FALSE, FALSE, sizeof (Gst3DSceneEntry));
+  self->world_transforms =
+      g_array_new (FALSE, FALSE, sizeof (graphene_matrix_t));
+  self->hierarchy_dirty = FALSE;
+  self->dirty_bounds = g_array_new (FALSE, FALSE, sizeof (guint));
+  self->render_queue = g_array_new (FALSE, FALSE, sizeof (Gst3DRenderItem));
+  self->bound_program = GST_3D_SCENE_STATE_UNKNOWN;
+  self->bound_texture = GST_3D_SCENE_STATE_UNKNOWN;
+  self->bound_vertex_array = GST_3D_SCENE_STATE_UNKNOWN;
   self->gl_initialized = FALSE;
-  self->node_draw_func = &gst_3d_node_draw;
 }
 
 Gst3DScene *
@@ -78,7 +127,16 @@ gst_3d_scene_finalize (GObject * object)
     self->camera = NULL;
   }
 
+  if (self->loader) {
+    gst_object_unref (self->loader);
+    self->loader = NULL;
+  }
+
   if (self->context) {
+    if (self->view_buffer)
+      self->context->gl_vtable->DeleteBuffers (1, &self->view_buffer);
+    if (self->instance_buffer)
+      self->context->gl_vtable->DeleteBuffers (1, &self->instance_buffer);
     gst_object_unref (self->context);
     self->context = NULL;
   }
@@ -89,6 +147,12 @@ gst_3d_scene_finalize (GObject * object)
     gst_object_unref (node);
   }
 
+  g_array_free (self->render_queue, TRUE);
+  g_array_free (self->instances, TRUE);
+  g_array_free (self->entries, TRUE);
+  g_array_free (self->world_transforms, TRUE);
+  g_array_free (self->dirty_bounds, TRUE);
+
   G_OBJECT_CLASS (gst_3d_scene_parent_class)->finalize (object);
 }
 
@@ -113,21 +177,525 @@ gst_3d_scene_init_gl (Gst3DScene * self, GstGLContext * context)
 // #endif
 }
 
+/* the cheap sphere test rejects most invisible nodes, the box is tighter
+ * for the rest */
+static gboolean
+_node_visible (Gst3DNode * node, const graphene_frustum_t * frustum)
+{
+  if (!node->has_bounds)
+    return TRUE;
+  if (!graphene_frustum_intersects_sphere (frustum, &node->bounding_sphere))
+    return FALSE;
+  return graphene_frustum_intersects_box (frustum, &node->bounds);
+}
+
+static gboolean
+_node_visible_in_any (Gst3DNode * node, const graphene_frustum_t * frusta,
+    guint n_frusta)
+{
+  for (guint i = 0; i < n_frusta; i++)
+    if (_node_visible (node, &frusta[i]))
+      return TRUE;
+  return FALSE;
+}
+
+static void
+_queue_item (Gst3DScene * self, Gst3DNode * node, Gst3DMesh * mesh)
+{
+  Gst3DRenderItem item = {
+    .program = node->shader->program,
+    .texture = node->texture,
+    .vertex_array = mesh ? mesh->vao : 0,
+    .node = node,
+    .mesh = mesh,
+  };
+  g_array_append_val (self->render_queue, item);
+}
+
+static void
+_queue_nodes (Gst3DScene * self, const graphene_frustum_t * frusta,
+    guint n_frusta)
+{
+  guint i = 0;
+
+  while (i < self->entries->len) {
+    Gst3DSceneEntry *entry =
+        &g_array_index (self->entries, Gst3DSceneEntry, i);
+    Gst3DNode *node = entry->node;
+
+    if (!_node_visible_in_any (node, frusta, n_frusta)) {
+      self->culled_nodes++;
+      i = entry->end;
+      continue;
+    }
+
+    /* group nodes, e.g. of loaded models, have no geometry of their own */
+    if (node->shader && (node->meshes || node->octree)) {
+      gst_3d_shader_update (node->shader);
+      /* skipped while compiling without a program to draw with meanwhile */
+      if (node->shader->program) {
+        self->drawn_nodes++;
+        if (node->octree)
+          _queue_item (self, node, NULL);
+        GList *l;
+        for (l = node->meshes; l != NULL; l = l->next)
+          _queue_item (self, node, (Gst3DMesh *) l->data);
+      }
+    }
+    i++;
+  }
+}
+
+static gint
+_compare_render_items (gconstpointer a, gconstpointer b)
+{
+  const Gst3DRenderItem *item_a = a;
+  const Gst3DRenderItem *item_b = b;
+
+  /* programs are the most expensive to switch */
+  if (item_a->program != item_b->program)
+    return item_a->program < item_b->program ? -1 : 1;
+  if (item_a->texture != item_b->texture)
+    return item_a->texture < item_b->texture ? -1 : 1;
+  if (item_a->vertex_array != item_b->vertex_array)
+    return item_a->vertex_array < item_b->vertex_array ? -1 : 1;
+  /* keeps the meshes of a node together for its transform */
+  if (item_a->node->world_index != item_b->node->world_index)
+    return item_a->node->world_index < item_b->node->world_index ? -1 : 1;
+  return 0;
+}
+
+/* Returns TRUE if the state has to be set. */
+static gboolean
+_state_changes (Gst3DScene * self, GLuint * bound, GLuint value)
+{
+  if (*bound == value) {
+    self->state_changes_saved++;
+    return FALSE;
+  }
+  *bound = value;
+  self->state_changes++;
+  return TRUE;
+}
+
+/* Writes the instances of the sorted queue, so the items of a batch are
+ * consecutive in the instance buffer. */
+static void
+_upload_instances (Gst3DScene * self)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  g_array_set_size (self->instances, 0);
+  for (guint i = 0; i < self->render_queue->len; i++) {
+    Gst3DRenderItem *item =
+        &g_array_index (self->render_queue, Gst3DRenderItem, i);
+    if (!item->mesh || !item->node->shader->instanced)
+      continue;
+
+    Gst3DInstance instance;
+    graphene_matrix_to_float (&g_array_index (self->world_transforms,
+            graphene_matrix_t, item->node->world_index), instance.model);
+    graphene_vec4_to_float (&item->node->color, instance.color);
+    item->instance = self->instances->len;
+    g_array_append_val (self->instances, instance);
+  }
+
+  if (self->instances->len == 0)
+    return;
+
+  if (!self->instance_buffer)
+    gl->GenBuffers (1, &self->instance_buffer);
+  /* a new store every view, the previous one may still be read */
+  gl->BindBuffer (GL_ARRAY_BUFFER, self->instance_buffer);
+  gl->BufferData (GL_ARRAY_BUFFER,
+      self->instances->len * sizeof (Gst3DInstance), self->instances->data,
+      GL_STREAM_DRAW);
+}
+
+/* Points the instance attributes of the bound vertex array at a batch,
+ * every instance is drawn @eyes times. */
+static void
+_bind_instances (Gst3DScene * self, guint first, guint eyes)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  gsize offset = first * sizeof (Gst3DInstance);
+
+  gl->BindBuffer (GL_ARRAY_BUFFER, self->instance_buffer);
+  for (guint column = 0; column < 4; column++) {
+    GLuint location = GST_3D_ATTRIBUTE_MODEL + column;
+    gl->VertexAttribPointer (location, 4, GL_FLOAT, GL_FALSE,
+        sizeof (Gst3DInstance), (gpointer) (offset +
+            G_STRUCT_OFFSET (Gst3DInstance, model) +
+            column * 4 * sizeof (GLfloat)));
+    gl->EnableVertexAttribArray (location);
+    gl->VertexAttribDivisor (location, eyes);
+  }
+  gl->VertexAttribPointer (GST_3D_ATTRIBUTE_INSTANCE_COLOR, 4, GL_FLOAT,
+      GL_FALSE, sizeof (Gst3DInstance), (gpointer) (offset +
+          G_STRUCT_OFFSET (Gst3DInstance, color)));
+  gl->EnableVertexAttribArray (GST_3D_ATTRIBUTE_INSTANCE_COLOR);
+  gl->VertexAttribDivisor (GST_3D_ATTRIBUTE_INSTANCE_COLOR, eyes);
+}
+
+/* Draws the items of the queue whose shader is instanced if @instanced, the
+ * others otherwise. Instanced shaders draw every instance for @eyes eyes
+ * of the bound view block, the others use @view_projection. Octrees select
+ * their nodes with the mvp, so they are always drawn in the second pass. */
+static void
+_draw_queue (Gst3DScene * self, const graphene_matrix_t * view_projection,
+    gboolean instanced, guint eyes)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  Gst3DNode *transform_node = NULL;
+  graphene_matrix_t mvp;
+  guint i = 0;
+
+  while (i < self->render_queue->len) {
+    Gst3DRenderItem *item =
+        &g_array_index (self->render_queue, Gst3DRenderItem, i);
+    Gst3DShader *shader = item->node->shader;
+    gboolean item_instanced = item->mesh && shader->instanced;
+
+    if (item_instanced != instanced) {
+      i++;
+      continue;
+    }
+
+    gboolean program_changed =
+        _state_changes (self, &self->bound_program, item->program);
+
+    if (program_changed)
+      gl->UseProgram (item->program);
+
+    /* instanced shaders read the transforms from the instance buffer */
+    if (!item_instanced
+        && (program_changed || item->node != transform_node)) {
+      graphene_matrix_t *world = &g_array_index (self->world_transforms,
+          graphene_matrix_t, item->node->world_index);
+      transform_node = item->node;
+      graphene_matrix_multiply (world, view_projection, &mvp);
+      if (gst_3d_shader_get_uniform_location (shader, "mvp") >= 0)
+        gst_3d_shader_upload_matrix (shader, &mvp, "mvp");
+    }
+
+    if (item->texture
+        && _state_changes (self, &self->bound_texture, item->texture))
+      gl->BindTexture (GL_TEXTURE_2D, item->texture);
+
+    if (!item->mesh) {
+      gst_3d_octree_draw (item->node->octree, &mvp);
+      self->bound_vertex_array = GST_3D_SCENE_STATE_UNKNOWN;
+      self->draw_calls += item->node->octree->drawn_nodes;
+      i++;
+      continue;
+    }
+
+    if (_state_changes (self, &self->bound_vertex_array, item->vertex_array))
+      gl->BindVertexArray (item->vertex_array);
+
+    GLenum draw_mode =
+        self->wireframe_mode ? GL_LINE_STRIP : item->mesh->draw_mode;
+
+    if (item_instanced) {
+      /* the queue is sorted, so all nodes drawing the same mesh with the
+       * same state follow each other */
+      guint count = 1;
+      while (i + count < self->render_queue->len) {
+        Gst3DRenderItem *next =
+            &g_array_index (self->render_queue, Gst3DRenderItem, i + count);
+        if (next->mesh != item->mesh || next->program != item->program
+            || next->texture != item->texture)
+          break;
+        count++;
+      }
+      _bind_instances (self, item->instance, eyes);
+      gst_3d_mesh_draw_instanced (item->mesh, draw_mode, count * eyes);
+      i += count;
+    } else {
+      gst_3d_mesh_draw_mode (item->mesh, draw_mode);
+      i++;
+    }
+    self->draw_calls++;
+  }
+}
+
+/**
+ * gst_3d_scene_set_views:
+ * @view_projections: (array length=n_views): view projection matrix of
+ *   each eye
+ *
+ * Uploads the view block of every eye at once, once per frame. The eyes
+ * are then drawn with gst_3d_scene_draw_view().
+ */
+void
+gst_3d_scene_set_views (Gst3DScene * self,
+    const graphene_matrix_t * view_projections, guint n_views)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  g_return_if_fail (n_views > 0 && n_views <= GST_3D_SCENE_MAX_VIEWS);
+
+  if (!self->view_buffer) {
+    GLint alignment = 1;
+    gl->GetIntegerv (GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = MAX (alignment, 1);
+    self->view_stride = (sizeof (Gst3DViewBlock) + alignment - 1)
+        / alignment * alignment;
+
+    gl->GenBuffers (1, &self->view_buffer);
+    gl->BindBuffer (GL_UNIFORM_BUFFER, self->view_buffer);
+    gl->BufferData (GL_UNIFORM_BUFFER,
+        self->view_stride * (GST_3D_SCENE_STEREO_VIEW + 1), NULL,
+        GL_DYNAMIC_DRAW);
+  } else {
+    gl->BindBuffer (GL_UNIFORM_BUFFER, self->view_buffer);
+  }
+
+  guint8 *data = g_alloca (self->view_stride * (GST_3D_SCENE_STEREO_VIEW + 1));
+  for (guint i = 0; i < n_views; i++) {
+    Gst3DViewBlock *block = (Gst3DViewBlock *) (data + self->view_stride * i);
+    graphene_matrix_to_float (&view_projections[i],
+        block->view_projection[0]);
+    block->eye_count = 1;
+    self->views[i] = view_projections[i];
+  }
+  self->n_views = n_views;
+
+  /* both eyes after the single views, for gst_3d_scene_draw_stereo() */
+  guint n_blocks = n_views;
+  if (n_views == 2) {
+    Gst3DViewBlock *block = (Gst3DViewBlock *) (data +
+        self->view_stride * GST_3D_SCENE_STEREO_VIEW);
+    graphene_matrix_to_float (&view_projections[0],
+        block->view_projection[0]);
+    graphene_matrix_to_float (&view_projections[1],
+        block->view_projection[1]);
+    block->eye_count = 2;
+    n_blocks = GST_3D_SCENE_STEREO_VIEW + 1;
+  }
+
+  gl->BufferSubData (GL_UNIFORM_BUFFER, 0, self->view_stride * n_blocks,
+      data);
+  gl->BindBuffer (GL_UNIFORM_BUFFER, 0);
+
+  /* other elements on the context may have changed it since the last
+   * frame */
+  self->bound_program = GST_3D_SCENE_STATE_UNKNOWN;
+  self->bound_texture = GST_3D_SCENE_STATE_UNKNOWN;
+  self->bound_vertex_array = GST_3D_SCENE_STATE_UNKNOWN;
+}
+
+/**
+ * gst_3d_scene_draw_view:
+ * @view: index of the view set with gst_3d_scene_set_views()
+ *
+ * Draws the nodes whose bounds intersect the view frustum, sorted by
+ * program, texture and vertex array. Nodes sharing a mesh and an instanced
+ * shader, one with a "model" attribute, are drawn with a single instanced
+ * draw call. The GL state is kept between views,
+ * gst_3d_scene_clear_state() resets it.
+ */
+void
+gst_3d_scene_draw_view (Gst3DScene * self, guint view)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  graphene_frustum_t frustum;
+
+  g_return_if_fail (view < self->n_views);
+
+  gl->BindBufferRange (GL_UNIFORM_BUFFER, GST_3D_SHADER_VIEW_BINDING,
+      self->view_buffer, self->view_stride * view, sizeof (Gst3DViewBlock));
+
+  graphene_matrix_t *view_projection = &self->views[view];
+  graphene_frustum_init_from_matrix (&frustum, view_projection);
+
+  g_array_set_size (self->render_queue, 0);
+  _queue_nodes (self, &frustum, 1);
+
+  g_array_sort (self->render_queue, _compare_render_items);
+  _upload_instances (self);
+  /* rebinding the first program uploads the transforms of this view */
+  self->bound_program = GST_3D_SCENE_STATE_UNKNOWN;
+  _draw_queue (self, view_projection, TRUE, 1);
+  _draw_queue (self, view_projection, FALSE, 1);
+}
+
+/**
+ * gst_3d_scene_draw_stereo:
+ *
+ * Draws both views set with gst_3d_scene_set_views() in a single pass, the
+ * left eye into the left half of the viewport and the right eye into the
+ * right half. Instanced shaders draw both eyes with the same draw calls,
+ * nodes with other shaders are drawn once per eye.
+ */
+void
+gst_3d_scene_draw_stereo (Gst3DScene * self)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  graphene_frustum_t frusta[2];
+  GLint viewport[4];
+
+  g_return_if_fail (self->n_views == 2);
+
+  gl->BindBufferRange (GL_UNIFORM_BUFFER, GST_3D_SHADER_VIEW_BINDING,
+      self->view_buffer, self->view_stride * GST_3D_SCENE_STEREO_VIEW,
+      sizeof (Gst3DViewBlock));
+
+  /* nodes in either eye are drawn, the shaders clip to the eyes */
+  for (guint i = 0; i < 2; i++)
+    graphene_frustum_init_from_matrix (&frusta[i], &self->views[i]);
+
+  g_array_set_size (self->render_queue, 0);
+  _queue_nodes (self, frusta, 2);
+
+  g_array_sort (self->render_queue, _compare_render_items);
+  _upload_instances (self);
+  self->bound_program = GST_3D_SCENE_STATE_UNKNOWN;
+
+  gl->Enable (GL_CLIP_DISTANCE0);
+  _draw_queue (self, NULL, TRUE, 2);
+  gl->Disable (GL_CLIP_DISTANCE0);
+
+  /* a scissor set by the caller is narrowed to the eye as well */
+  gboolean scissor = gl->IsEnabled (GL_SCISSOR_TEST);
+  gl->GetIntegerv (GL_VIEWPORT, viewport);
+  for (guint i = 0; i < 2; i++) {
+    gl->Viewport (viewport[0] + i * viewport[2] / 2, viewport[1],
+        viewport[2] / 2, viewport[3]);
+    if (scissor)
+      gl->Scissor (viewport[0] + i * viewport[2] / 2, viewport[1],
+          viewport[2] / 2, viewport[3]);
+    gl->BindBufferRange (GL_UNIFORM_BUFFER, GST_3D_SHADER_VIEW_BINDING,
+        self->view_buffer, self->view_stride * i, sizeof (Gst3DViewBlock));
+    _draw_queue (self, &self->views[i], FALSE, 1);
+  }
+  gl->Viewport (viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+/**
+ * gst_3d_scene_draw_nodes:
+ * @mvp: view projection matrix of the eye
+ *
+ * Draws the nodes of a single view, see gst_3d_scene_set_views() for
+ * stereo.
+ */
 void
 gst_3d_scene_draw_nodes (Gst3DScene * self, graphene_matrix_t * mvp)
 {
+  gst_3d_scene_set_views (self, mvp, 1);
+  gst_3d_scene_draw_view (self, 0);
+}
+
+static void
+_flatten_node (Gst3DScene * self, Gst3DNode * node, gint parent)
+{
+  Gst3DSceneEntry entry = {.node = node,.parent = parent };
+  guint index = self->entries->len;
   GList *l;
-  for (l = self->nodes; l != NULL; l = l->next) {
-    Gst3DNode *node = (Gst3DNode *) l->data;
-    gst_3d_shader_bind (node->shader);
-    gst_3d_shader_upload_matrix (node->shader, mvp, "mvp");
-    self->node_draw_func (node);
+
+  g_array_append_val (self->entries, entry);
+  node->world_index = index;
+  node->hierarchy_dirty = FALSE;
+
+  for (l = node->children; l != NULL; l = l->next)
+    _flatten_node (self, (Gst3DNode *) l->data, index);
+
+  g_array_index (self->entries, Gst3DSceneEntry, index).end =
+      self->entries->len;
+}
+
+/* Recomputes the world transforms of the subtrees whose transforms
+ * changed, in one pass over the flattened trees. Parents come before
+ * their children, so their world transform is always up to date. Nodes
+ * whose bounds need to be recomputed are collected on the way, their
+ * ancestors are flagged already, see gst_3d_node_invalidate_bounds().
+ * Meshes updated in place do not know their nodes, those are found by
+ * comparing bounds generations first. */
+static void
+_update_transforms (Gst3DScene * self)
+{
+  gboolean rebuild = self->hierarchy_dirty;
+  GList *l;
+
+  for (l = self->nodes; l != NULL; l = l->next)
+    rebuild |= ((Gst3DNode *) l->data)->hierarchy_dirty;
+
+  if (rebuild) {
+    g_array_set_size (self->entries, 0);
+    for (l = self->nodes; l != NULL; l = l->next)
+      _flatten_node (self, (Gst3DNode *) l->data, -1);
+    g_array_set_size (self->world_transforms, self->entries->len);
+    self->hierarchy_dirty = FALSE;
+  }
+
+  g_array_set_size (self->dirty_bounds, 0);
+
+  for (guint e = 0; e < self->entries->len; e++)
+    gst_3d_node_check_mesh_bounds (g_array_index (self->entries,
+            Gst3DSceneEntry, e).node);
+
+  guint i = 0;
+  while (i < self->entries->len) {
+    Gst3DSceneEntry *entry =
+        &g_array_index (self->entries, Gst3DSceneEntry, i);
+    Gst3DNode *node = entry->node;
+    gboolean parent_changed = entry->parent >= 0
+        && g_array_index (self->entries, Gst3DSceneEntry,
+        entry->parent).changed;
+
+    if (!rebuild && !parent_changed && !node->transform_dirty
+        && !node->subtree_dirty && !node->bounds_dirty) {
+      i = entry->end;
+      continue;
+    }
+
+    entry->changed = rebuild || parent_changed || node->transform_dirty;
+    if (entry->changed) {
+      graphene_matrix_t *world =
+          &g_array_index (self->world_transforms, graphene_matrix_t, i);
+      if (entry->parent >= 0)
+        graphene_matrix_multiply (&node->transform,
+            &g_array_index (self->world_transforms, graphene_matrix_t,
+                entry->parent), world);
+      else
+        graphene_matrix_init_from_matrix (world, &node->transform);
+      self->updated_transforms++;
+      node->bounds_dirty = TRUE;
+    }
+
+    if (node->bounds_dirty)
+      g_array_append_val (self->dirty_bounds, i);
+
+    node->transform_dirty = FALSE;
+    node->subtree_dirty = FALSE;
+    i++;
   }
 }
 
 void
 gst_3d_scene_draw (Gst3DScene * self)
 {
+  if (self->loader)
+    gst_3d_loader_process (self->loader);
+
+  self->drawn_nodes = 0;
+  self->culled_nodes = 0;
+  self->updated_transforms = 0;
+  self->draw_calls = 0;
+  self->state_changes = 0;
+  self->state_changes_saved = 0;
+
+  /* once per frame, transforms and bounds are shared by both eyes */
+  _update_transforms (self);
+  /* backwards, so children are updated before their parents */
+  for (guint d = self->dirty_bounds->len; d > 0; d--) {
+    guint i = g_array_index (self->dirty_bounds, guint, d - 1);
+    Gst3DNode *node = g_array_index (self->entries, Gst3DSceneEntry, i).node;
+    gst_3d_node_update_bounds (node,
+        &g_array_index (self->world_transforms, graphene_matrix_t, i));
+    node->bounds_dirty = FALSE;
+  }
+
   gst_3d_camera_update_view (self->camera);
 
 #ifdef HAVE_OPENHMD
@@ -143,24 +711,47 @@ gst_3d_scene_draw (Gst3DScene * self)
   // gst_3d_scene_draw_nodes (self, &self->camera->mvp);
 #endif
   gst_3d_scene_clear_state (self);
+
+  GST_LOG ("drew %u nodes in %u draw calls, culled %u, updated %u "
+      "transforms, %u state changes, %u saved", self->drawn_nodes,
+      self->draw_calls, self->culled_nodes, self->updated_transforms,
+      self->state_changes, self->state_changes_saved);
 }
 
 void
 gst_3d_scene_append_node (Gst3DScene * self, Gst3DNode * node)
 {
   self->nodes = g_list_append (self->nodes, node);
+  self->hierarchy_dirty = TRUE;
+}
+
+/**
+ * gst_3d_scene_load_model:
+ *
+ * Loads a model in the background and appends it to the scene. It shows up
+ * once it is fully uploaded, the scene keeps rendering meanwhile. Must be
+ * called after the GL context is set, e.g. from the gl init function.
+ *
+ * Returns: (transfer none): the root node of the model
+ */
+Gst3DNode *
+gst_3d_scene_load_model (Gst3DScene * self, const gchar * file,
+    Gst3DShader * shader)
+{
+  g_return_val_if_fail (GST_IS_GL_CONTEXT (self->context), NULL);
+
+  if (!self->loader)
+    self->loader = gst_3d_loader_new (self->context);
+
+  Gst3DNode *node = gst_3d_loader_load (self->loader, file, shader);
+  gst_3d_scene_append_node (self, node);
+  return node;
 }
 
 void
 gst_3d_scene_toggle_wireframe_mode (Gst3DScene * self)
 {
-  if (self->wireframe_mode) {
-    self->wireframe_mode = FALSE;
-    self->node_draw_func = &gst_3d_node_draw;
-  } else {
-    self->wireframe_mode = TRUE;
-    self->node_draw_func = &gst_3d_node_draw_wireframe;
-  }
+  self->wireframe_mode = !self->wireframe_mode;
 }
 
 void
@@ -183,13 +774,23 @@ gst_3d_scene_navigation_event (Gst3DScene * self, GstEvent * event)
   }
 }
 
+/**
+ * gst_3d_scene_clear_state:
+ *
+ * Unbinds the state of the render queue, e.g. before other code draws.
+ */
 void
 gst_3d_scene_clear_state (Gst3DScene * self)
 {
   GstGLFuncs *gl = self->context->gl_vtable;
   gl->BindVertexArray (0);
+  gl->BindBuffer (GL_ARRAY_BUFFER, 0);
   gl->BindTexture (GL_TEXTURE_2D, 0);
   gst_gl_context_clear_shader (self->context);
+
+  self->bound_program = GST_3D_SCENE_STATE_UNKNOWN;
+  self->bound_texture = GST_3D_SCENE_STATE_UNKNOWN;
+  self->bound_vertex_array = GST_3D_SCENE_STATE_UNKNOWN;
 }
 
 
@@ -28,6 +28,7 @@
 #include "gst3dnode.h"
 #include "gst3dcamera.h"
 #include "gst3drenderer.h"
+#include "gst3dloader.h"
 
 G_BEGIN_DECLS
 #define GST_3D_TYPE_SCENE            (gst_3d_scene_get_type ())
@@ -39,6 +40,10 @@ G_BEGIN_DECLS
 typedef struct _Gst3DScene Gst3DScene;
 typedef struct _Gst3DSceneClass Gst3DSceneClass;
 
+#define GST_3D_SCENE_MAX_VIEWS 2
+/* slot of the view buffer with both eyes, see gst_3d_scene_draw_stereo() */
+#define GST_3D_SCENE_STEREO_VIEW GST_3D_SCENE_MAX_VIEWS
+
 struct _Gst3DScene
 {
   /*< private > */
@@ -47,12 +52,45 @@ struct _Gst3DScene
   gboolean gl_initialized;
   
   gboolean wireframe_mode;
-  void (*node_draw_func) (Gst3DNode *);
   void (*gl_init_func) (Gst3DScene *);
 
   Gst3DCamera *camera;
   Gst3DRenderer *renderer;
   GList *nodes;
+
+  Gst3DLoader *loader;
+
+  /* the node trees flattened depth first, see _update_transforms() */
+  GArray *entries;
+  GArray *world_transforms;
+  gboolean hierarchy_dirty;
+  /* entries with bounds_dirty nodes in ascending order, parents first */
+  GArray *dirty_bounds;
+
+  /* one Gst3DViewBlock per view, each at an aligned offset */
+  GLuint view_buffer;
+  GLint view_stride;
+  graphene_matrix_t views[GST_3D_SCENE_MAX_VIEWS];
+  guint n_views;
+
+  /* visible meshes of the current view, sorted by state */
+  GArray *render_queue;
+  /* Gst3DInstance of the queued items with instanced shaders */
+  GArray *instances;
+  GLuint instance_buffer;
+
+  /* GL state as set by the render queue */
+  GLuint bound_program;
+  GLuint bound_texture;
+  GLuint bound_vertex_array;
+
+  /* statistics of the last frame, summed over the eyes */
+  guint drawn_nodes;
+  guint culled_nodes;
+  guint updated_transforms;
+  guint draw_calls;
+  guint state_changes;
+  guint state_changes_saved;
 };
 
 struct _Gst3DSceneClass
@@ -62,11 +100,15 @@ struct _Gst3DSceneClass
 
 Gst3DScene *gst_3d_scene_new (Gst3DCamera * camera, void (*_init_func)(Gst3DScene *));
 void gst_3d_scene_append_node(Gst3DScene *self, Gst3DNode * node);
+Gst3DNode *gst_3d_scene_load_model (Gst3DScene * self, const gchar * file, Gst3DShader * shader);
 void gst_3d_scene_toggle_wireframe_mode (Gst3DScene *self);
 void gst_3d_scene_navigation_event (Gst3DScene *self, GstEvent * event);
 
 void gst_3d_scene_init_gl(Gst3DScene *self, GstGLContext *context);
 
+void gst_3d_scene_set_views (Gst3DScene * self, const graphene_matrix_t * view_projections, guint n_views);
+void gst_3d_scene_draw_view (Gst3DScene * self, guint view);
+void gst_3d_scene_draw_stereo (Gst3DScene * self);
 void gst_3d_scene_draw_nodes (Gst3DScene * self, graphene_matrix_t * mvp);
 void gst_3d_scene_draw (Gst3DScene * self);
 
@@ -31,6 +31,7 @@
 #include <gst/gl/gstglfuncs.h>
 
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 
 #include "gst3dshader.h"
 
@@ -40,10 +41,73 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 G_DEFINE_TYPE_WITH_CODE (Gst3DShader, gst_3d_shader, GST_TYPE_OBJECT,
     GST_DEBUG_CATEGORY_INIT (gst_3d_shader_debug, "3dshader", 0, "shader"));
 
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef enum
+{
+  GST_3D_SHADER_PROGRAM_COMPILING,
+  /* compiled and linked, waiting for _program_poll() on the GL thread */
+  GST_3D_SHADER_PROGRAM_COMPILED,
+  GST_3D_SHADER_PROGRAM_LINKED,
+  GST_3D_SHADER_PROGRAM_FAILED,
+} Gst3DShaderProgramState;
+
+/* A GL program. Gst3DShaders built from the same sources on one context
+ * share it through the program cache. */
+typedef struct
+{
+  gint ref_count;
+  GstGLContext *context;
+  gchar *key;
+  GLuint program;
+  /* owns the program if it was compiled, NULL if it was loaded from the
+   * binary cache or linked by the driver threads */
+  GstGLShader *shader;
+  /* uniform name -> location + 1, filled once after linking */
+  GHashTable *uniforms;
+  gboolean instanced;
+
+  /* Gst3DShaderProgramState, written by the compile worker */
+  gint state;
+  GError *error;
+  /* where the binary is stored once linked */
+  gchar *binary_path;
+  /* sources for the compile worker */
+  gchar *vertex_src;
+  gchar *fragment_src;
+  /* stages of a KHR_parallel_shader_compile link */
+  GLuint stages[2];
+} Gst3DShaderProgram;
+
+/* Attribute locations bound before linking, see GST_3D_ATTRIBUTE_POSITION */
+static const struct
+{
+  const gchar *name;
+  GLuint location;
+} bound_attributes[] = {
+  {"position", GST_3D_ATTRIBUTE_POSITION},
+  {"uv", GST_3D_ATTRIBUTE_UV},
+  {"color", GST_3D_ATTRIBUTE_COLOR},
+  {"normal", GST_3D_ATTRIBUTE_NORMAL},
+  {"model", GST_3D_ATTRIBUTE_MODEL},
+  {"instance_color", GST_3D_ATTRIBUTE_INSTANCE_COLOR},
+};
+
 void
 gst_3d_shader_init (Gst3DShader * self)
 {
-  self->shader = NULL;
+  self->cached_program = NULL;
+  self->pending_program = NULL;
+  self->program = 0;
+  self->ready = FALSE;
+  self->reloading = FALSE;
+  self->instanced = FALSE;
+  self->vertex = NULL;
+  self->fragment = NULL;
+  self->defines = NULL;
+  self->generation = 0;
 }
 
 Gst3DShader *
@@ -57,10 +121,20 @@ gst_3d_shader_new (GstGLContext * context)
 
 Gst3DShader *
 gst_3d_shader_new_vert_frag (GstGLContext * context, const gchar * vertex, const gchar * fragment, GError **error)
+{
+  return gst_3d_shader_new_vert_frag_defines (context, vertex, fragment, NULL,
+      error);
+}
+
+Gst3DShader *
+gst_3d_shader_new_vert_frag_defines (GstGLContext * context,
+    const gchar * vertex, const gchar * fragment, const gchar * const *defines,
+    GError ** error)
 {
   g_return_val_if_fail (GST_IS_GL_CONTEXT (context), NULL);
   Gst3DShader *shader = gst_3d_shader_new (context);
-  if (!gst_3d_shader_from_vert_frag (shader, vertex, fragment, error)) {
+  if (!gst_3d_shader_from_vert_frag_defines (shader, vertex, fragment,
+          defines, error)) {
     gst_object_unref (shader);
     return NULL;
   }
@@ -74,6 +148,12 @@ gst_3d_shader_finalize (GObject * object)
   Gst3DShader *self = GST_3D_SHADER (object);
   g_return_if_fail (self != NULL);
 
+  gst_3d_shader_delete (self);
+
+  g_free (self->vertex);
+  g_free (self->fragment);
+  g_strfreev (self->defines);
+
   if (self->context) {
     gst_object_unref (self->context);
     self->context = NULL;
@@ -87,12 +167,161 @@ gst_3d_shader_class_init (Gst3DShaderClass * klass)
 {
   GObjectClass *obj_class = G_OBJECT_CLASS (klass);
   obj_class->finalize = gst_3d_shader_finalize;
+
+  const gchar *dir = g_getenv ("GST_VR_SHADER_DIR");
+  if (dir)
+    gst_3d_shader_set_directory (dir);
+}
+
+/* shader directory */
+
+G_LOCK_DEFINE_STATIC (shader_dir);
+static gchar *shader_dir = NULL;
+static GFileMonitor *shader_dir_monitor = NULL;
+/* file name -> generation of its last change */
+static GHashTable *changed_files = NULL;
+/* bumped on every change in the directory */
+static gint shader_generation = 0;
+
+static void
+_shader_dir_changed (GFileMonitor * monitor, GFile * file, GFile * other,
+    GFileMonitorEvent event, gpointer user_data)
+{
+  if (event != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT
+      && event != G_FILE_MONITOR_EVENT_CREATED)
+    return;
+
+  gchar *name = g_file_get_basename (file);
+  GST_INFO ("shader %s changed", name);
+
+  G_LOCK (shader_dir);
+  gint generation = g_atomic_int_add (&shader_generation, 1) + 1;
+  g_hash_table_replace (changed_files, name, GINT_TO_POINTER (generation));
+  G_UNLOCK (shader_dir);
+}
+
+/**
+ * gst_3d_shader_set_directory:
+ * @dir: (nullable): directory with the shader sources, %NULL for the built
+ *   in ones
+ *
+ * Development mode. Shaders are read from @dir before the built in
+ * resources, and shaders using a file that changes in @dir are relinked on
+ * their next bind, keeping the old program if that fails. The directory is
+ * watched from the default main context, which has to be running. Set from
+ * GST_VR_SHADER_DIR at startup.
+ */
+void
+gst_3d_shader_set_directory (const gchar * dir)
+{
+  GError *error = NULL;
+
+  G_LOCK (shader_dir);
+  if (!changed_files)
+    changed_files = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        NULL);
+
+  g_clear_object (&shader_dir_monitor);
+  g_free (shader_dir);
+  shader_dir = g_strdup (dir);
+
+  if (dir) {
+    GFile *file = g_file_new_for_path (dir);
+    shader_dir_monitor = g_file_monitor_directory (file, G_FILE_MONITOR_NONE,
+        NULL, &error);
+    g_object_unref (file);
+
+    if (shader_dir_monitor) {
+      g_signal_connect (shader_dir_monitor, "changed",
+          G_CALLBACK (_shader_dir_changed), NULL);
+      GST_INFO ("loading shaders from %s", dir);
+    } else {
+      GST_WARNING ("Unable to watch %s: %s", dir, error->message);
+      g_clear_error (&error);
+    }
+  }
+  G_UNLOCK (shader_dir);
+}
+
+/**
+ * gst_3d_shader_get_directory:
+ *
+ * Returns: (transfer full) (nullable): the directory set with
+ *   gst_3d_shader_set_directory()
+ */
+gchar *
+gst_3d_shader_get_directory (void)
+{
+  G_LOCK (shader_dir);
+  gchar *dir = g_strdup (shader_dir);
+  G_UNLOCK (shader_dir);
+  return dir;
+}
+
+static gint
+_source_generation (const gchar * file)
+{
+  gint generation = 0;
+
+  G_LOCK (shader_dir);
+  if (changed_files)
+    generation = GPOINTER_TO_INT (g_hash_table_lookup (changed_files, file));
+  G_UNLOCK (shader_dir);
+
+  return generation;
+}
+
+/* Returns the source from the shader directory, or from the resources. */
+static GBytes *
+_read_source (const gchar * file)
+{
+  G_LOCK (shader_dir);
+  gchar *path = shader_dir ? g_build_filename (shader_dir, file, NULL) : NULL;
+  G_UNLOCK (shader_dir);
+
+  if (path) {
+    gchar *contents;
+    gsize length;
+    gboolean found = g_file_get_contents (path, &contents, &length, NULL);
+    GST_LOG ("Loading shader from file: %s", path);
+    g_free (path);
+    /* the contents stay null terminated */
+    if (found)
+      return g_bytes_new_take (contents, length);
+  }
+
+  path = g_strjoin ("", "/gpu/", file, NULL);
+  GBytes *bytes = g_resources_lookup_data (path, 0, NULL);
+  if (!bytes)
+    GST_ERROR ("Unable to read shader %s", file);
+  g_free (path);
+
+  return bytes;
+}
+
+static void _shader_poll (Gst3DShader * self, GError ** error);
+static void _shader_reload (Gst3DShader * self);
+
+/**
+ * gst_3d_shader_update:
+ *
+ * Switches to the pending program if it is linked, and starts relinking
+ * changed sources. Done by gst_3d_shader_bind() as well, for callers that
+ * bind the program themselves.
+ */
+void
+gst_3d_shader_update (Gst3DShader * self)
+{
+  _shader_reload (self);
+  _shader_poll (self, NULL);
 }
 
 void
 gst_3d_shader_bind (Gst3DShader * self)
 {
-  gst_gl_shader_use (self->shader);
+  GstGLFuncs *gl = self->context->gl_vtable;
+  gst_3d_shader_update (self);
+  gl->UseProgram (self->program);
 }
 
 const char *
@@ -120,83 +349,955 @@ gst_3d_shader_read (const char *file)
   return shader;
 }
 
+/* binary cache */
+
+/* Programs are stored by the hash of the driver strings and the sources, a
+ * driver update or a changed shader simply misses the cache. */
+#define GST_3D_SHADER_BINARY_MAGIC "G3DP"
+
+typedef struct
+{
+  gchar magic[4];
+  guint32 format;
+} Gst3DShaderBinaryHeader;
+
+static gchar *
+_binary_cache_path (GstGLContext * context, const gchar * vertex_src,
+    const gchar * fragment_src, const gchar * defines)
+{
+  GstGLFuncs *gl = context->gl_vtable;
+  const gchar *parts[] = {
+    (const gchar *) gl->GetString (GL_VENDOR),
+    (const gchar *) gl->GetString (GL_RENDERER),
+    (const gchar *) gl->GetString (GL_VERSION),
+    vertex_src, fragment_src, defines,
+  };
+  GChecksum *checksum = g_checksum_new (G_CHECKSUM_SHA1);
+
+  for (guint i = 0; i < G_N_ELEMENTS (parts); i++) {
+    const gchar *part = parts[i] ? parts[i] : "";
+    /* the terminator separates the parts */
+    g_checksum_update (checksum, (const guchar *) part, strlen (part) + 1);
+  }
+
+  gchar *name = g_strconcat (g_checksum_get_string (checksum), ".bin", NULL);
+  gchar *path = g_build_filename (g_get_user_cache_dir (), "gst-plugins-vr",
+      "programs", name, NULL);
+
+  g_free (name);
+  g_checksum_free (checksum);
+  return path;
+}
+
+static gboolean
+_binary_cache_supported (GstGLContext * context)
+{
+  GstGLFuncs *gl = context->gl_vtable;
+  GLint n_formats = 0;
+
+  if (!gl->GetProgramBinary || !gl->ProgramBinary)
+    return FALSE;
+
+  gl->GetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats);
+  return n_formats > 0;
+}
+
+static GLuint
+_binary_cache_load (GstGLContext * context, const gchar * path)
+{
+  GstGLFuncs *gl = context->gl_vtable;
+  gchar *contents;
+  gsize length;
+  GLint linked = GL_FALSE;
+
+  if (!g_file_get_contents (path, &contents, &length, NULL))
+    return 0;
+
+  const Gst3DShaderBinaryHeader *header =
+      (const Gst3DShaderBinaryHeader *) contents;
+  if (length <= sizeof (*header)
+      || memcmp (header->magic, GST_3D_SHADER_BINARY_MAGIC, 4) != 0) {
+    g_free (contents);
+    return 0;
+  }
+
+  GLuint program = gl->CreateProgram ();
+  gl->ProgramBinary (program, header->format, contents + sizeof (*header),
+      length - sizeof (*header));
+  gl->GetProgramiv (program, GL_LINK_STATUS, &linked);
+  g_free (contents);
+
+  /* drivers reject binaries of other versions, compile again */
+  if (!linked) {
+    GST_DEBUG ("Program binary %s was rejected", path);
+    gl->DeleteProgram (program);
+    g_unlink (path);
+    return 0;
+  }
+
+  return program;
+}
+
+static void
+_binary_cache_store (GstGLContext * context, const gchar * path,
+    GLuint program)
+{
+  GstGLFuncs *gl = context->gl_vtable;
+  GLint length = 0;
+  GError *error = NULL;
+
+  gl->GetProgramiv (program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  gsize size = sizeof (Gst3DShaderBinaryHeader) + length;
+  guint8 *contents = g_malloc (size);
+  Gst3DShaderBinaryHeader *header = (Gst3DShaderBinaryHeader *) contents;
+  GLenum format = 0;
+
+  memcpy (header->magic, GST_3D_SHADER_BINARY_MAGIC, 4);
+  gl->GetProgramBinary (program, length, NULL, &format,
+      contents + sizeof (*header));
+  header->format = format;
+
+  gchar *dir = g_path_get_dirname (path);
+  g_mkdir_with_parents (dir, 0700);
+  g_free (dir);
+
+  /* written to a temporary file and renamed, so concurrent pipelines never
+   * read half a binary */
+  if (!g_file_set_contents (path, (const gchar *) contents, size, &error)) {
+    GST_DEBUG ("Unable to store program binary: %s", error->message);
+    g_clear_error (&error);
+  }
+
+  g_free (contents);
+}
+
+/* program cache */
+
+#define GST_3D_SHADER_CACHE_KEY "gst-3d-shader-cache"
+
+G_LOCK_DEFINE_STATIC (shader_cache);
+/* signalled under the cache lock when the worker finishes a program */
+static GCond compile_cond;
+
+static void
+_delete_program (GstGLContext * context, gpointer program)
+{
+  context->gl_vtable->DeleteProgram (GPOINTER_TO_UINT (program));
+}
+
+static void
+_program_unref (Gst3DShaderProgram * program)
+{
+  G_LOCK (shader_cache);
+  if (--program->ref_count > 0) {
+    G_UNLOCK (shader_cache);
+    return;
+  }
+  GHashTable *cache = g_object_get_data (G_OBJECT (program->context),
+      GST_3D_SHADER_CACHE_KEY);
+  if (cache && g_hash_table_lookup (cache, program->key) == program)
+    g_hash_table_remove (cache, program->key);
+  G_UNLOCK (shader_cache);
+
+  if (program->shader)
+    gst_object_unref (program->shader);
+  else if (program->program)
+    gst_gl_context_thread_add (program->context, _delete_program,
+        GUINT_TO_POINTER (program->program));
+
+  gst_object_unref (program->context);
+  if (program->uniforms)
+    g_hash_table_unref (program->uniforms);
+  g_clear_error (&program->error);
+  g_free (program->binary_path);
+  g_free (program->vertex_src);
+  g_free (program->fragment_src);
+  g_free (program->key);
+  g_free (program);
+}
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+
+/* Has to be set before linking, some drivers report an empty binary
+ * without it. glProgramParameteri is not part of GstGLFuncs. */
+static void
+_set_binary_retrievable (GstGLContext * context, GLuint program)
+{
+  void (GSTGLAPI * program_parameteri) (GLuint program, GLenum pname,
+      GLint value) = gst_gl_context_get_proc_address (context,
+      "glProgramParameteri");
+
+  if (program_parameteri)
+    program_parameteri (program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+/* @retrievable: the binary of the program will be stored in the cache */
+static GstGLShader *
+_compile (GstGLContext * context, const gchar * vertex_src,
+    const gchar * fragment_src, gboolean retrievable, GError ** error)
+{
+  GstGLShader *shader = gst_gl_shader_new (context);
+  GstGLSLStage *stage;
+
+  if (!(stage = gst_glsl_stage_new_with_string (context, GL_VERTEX_SHADER,
+              GST_GLSL_VERSION_NONE, GST_GLSL_PROFILE_NONE, vertex_src))) {
+    goto error;
+  }
+
+  if (!gst_gl_shader_compile_attach_stage (shader, stage, error)) {
+    gst_object_unref (stage);
+    goto error;
+  }
+
+  if (!(stage = gst_glsl_stage_new_with_string (context, GL_FRAGMENT_SHADER,
+              GST_GLSL_VERSION_NONE, GST_GLSL_PROFILE_NONE, fragment_src))) {
+    goto error;
+  }
+
+  if (!gst_gl_shader_compile_attach_stage (shader, stage, error)) {
+    gst_object_unref (stage);
+    goto error;
+  }
+
+  for (guint i = 0; i < G_N_ELEMENTS (bound_attributes); i++)
+    gst_gl_shader_bind_attribute_location (shader,
+        bound_attributes[i].location, bound_attributes[i].name);
+
+  if (retrievable)
+    _set_binary_retrievable (context,
+        gst_gl_shader_get_program_handle (shader));
+
+  if (!gst_gl_shader_link (shader, error))
+    goto error;
+
+  return shader;
+
+error:
+  gst_object_unref (shader);
+  return NULL;
+}
+
+/* Looks up the uniforms once, so setting one costs a hash lookup instead
+ * of a round trip to the driver, and binds the view block. */
+static void
+_program_reflect (GstGLContext * context, Gst3DShaderProgram * program)
+{
+  GstGLFuncs *gl = context->gl_vtable;
+  GLint count = 0;
+  GLint max_length = 0;
+
+  program->uniforms = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      NULL);
+
+  gl->GetProgramiv (program->program, GL_ACTIVE_UNIFORMS, &count);
+  gl->GetProgramiv (program->program, GL_ACTIVE_UNIFORM_MAX_LENGTH,
+      &max_length);
+
+  gchar *name = g_malloc0 (max_length + 1);
+  for (GLint i = 0; i < count; i++) {
+    GLint size;
+    GLenum type;
+    gl->GetActiveUniform (program->program, i, max_length + 1, NULL, &size,
+        &type, name);
+
+    /* arrays are reported as name[0] */
+    gchar *bracket = strchr (name, '[');
+    if (bracket)
+      *bracket = '\0';
+
+    /* members of uniform blocks have no location */
+    GLint location = gl->GetUniformLocation (program->program, name);
+    if (location < 0)
+      continue;
+
+    g_hash_table_insert (program->uniforms, g_strdup (name),
+        GINT_TO_POINTER (location + 1));
+  }
+  g_free (name);
+
+  program->instanced = gl->GetAttribLocation (program->program, "model")
+      == GST_3D_ATTRIBUTE_MODEL;
+
+  if (gl->GetUniformBlockIndex) {
+    GLuint block = gl->GetUniformBlockIndex (program->program,
+        GST_3D_SHADER_VIEW_BLOCK);
+    if (block != GL_INVALID_INDEX)
+      gl->UniformBlockBinding (program->program, block,
+          GST_3D_SHADER_VIEW_BINDING);
+  }
+}
+
+/* asynchronous compilation */
+
+static gboolean
+_parallel_compile_supported (GstGLContext * context)
+{
+  return gst_gl_context_check_feature (context, "GL_KHR_parallel_shader_compile")
+      || gst_gl_context_check_feature (context,
+      "GL_ARB_parallel_shader_compile");
+}
+
+static GLuint
+_compile_stage (GstGLFuncs * gl, GLenum type, const gchar * source)
+{
+  GLuint stage = gl->CreateShader (type);
+  gl->ShaderSource (stage, 1, &source, NULL);
+  gl->CompileShader (stage);
+  return stage;
+}
+
+/* Compiles and links without waiting, the driver does the work on its own
+ * threads until GL_COMPLETION_STATUS_KHR is set. */
+static void
+_program_start_parallel (GstGLContext * context,
+    Gst3DShaderProgram * program, const gchar * vertex_src,
+    const gchar * fragment_src)
+{
+  GstGLFuncs *gl = context->gl_vtable;
+
+  program->program = gl->CreateProgram ();
+  program->stages[0] = _compile_stage (gl, GL_VERTEX_SHADER, vertex_src);
+  program->stages[1] = _compile_stage (gl, GL_FRAGMENT_SHADER, fragment_src);
+
+  for (guint i = 0; i < G_N_ELEMENTS (program->stages); i++)
+    gl->AttachShader (program->program, program->stages[i]);
+  for (guint i = 0; i < G_N_ELEMENTS (bound_attributes); i++)
+    gl->BindAttribLocation (program->program, bound_attributes[i].location,
+        bound_attributes[i].name);
+
+  if (program->binary_path)
+    _set_binary_retrievable (context, program->program);
+  gl->LinkProgram (program->program);
+}
+
+/* Blocks if the driver is not done yet. */
+static void
+_program_finish_parallel (Gst3DShaderProgram * program)
+{
+  GstGLFuncs *gl = program->context->gl_vtable;
+  GLint linked = GL_FALSE;
+
+  gl->GetProgramiv (program->program, GL_LINK_STATUS, &linked);
+
+  if (!linked) {
+    GString *log = g_string_new (NULL);
+    gchar info[1024];
+
+    for (guint i = 0; i < G_N_ELEMENTS (program->stages); i++) {
+      gl->GetShaderInfoLog (program->stages[i], sizeof (info), NULL, info);
+      g_string_append (log, info);
+    }
+    gl->GetProgramInfoLog (program->program, sizeof (info), NULL, info);
+    g_string_append (log, info);
+
+    g_set_error (&program->error, GST_GLSL_ERROR, GST_GLSL_ERROR_LINK,
+        "Failed to link %s: %s", program->key, log->str);
+    g_string_free (log, TRUE);
+  }
+
+  for (guint i = 0; i < G_N_ELEMENTS (program->stages); i++) {
+    gl->DetachShader (program->program, program->stages[i]);
+    gl->DeleteShader (program->stages[i]);
+    program->stages[i] = 0;
+  }
+
+  g_atomic_int_set (&program->state, linked ?
+      GST_3D_SHADER_PROGRAM_COMPILED : GST_3D_SHADER_PROGRAM_FAILED);
+}
+
+/* A context shared with the GL context, compiling on its own thread where
+ * the driver has no parallel compile. */
+#define GST_3D_SHADER_WORKER_KEY "gst-3d-shader-worker"
+#define GST_3D_SHADER_NO_WORKER_KEY "gst-3d-shader-no-worker"
+
+static GstGLContext *
+_worker_get (GstGLContext * context)
+{
+  GError *error = NULL;
+  GstGLContext *worker = g_object_get_data (G_OBJECT (context),
+      GST_3D_SHADER_WORKER_KEY);
+
+  if (worker || g_object_get_data (G_OBJECT (context),
+          GST_3D_SHADER_NO_WORKER_KEY))
+    return worker;
+
+  worker = gst_gl_context_new (context->display);
+  if (!gst_gl_context_create (worker, context, &error)) {
+    GST_INFO ("No shared context for compiling shaders: %s", error->message);
+    g_clear_error (&error);
+    gst_object_unref (worker);
+    g_object_set_data (G_OBJECT (context), GST_3D_SHADER_NO_WORKER_KEY,
+        GINT_TO_POINTER (TRUE));
+    return NULL;
+  }
+
+  g_object_set_data_full (G_OBJECT (context), GST_3D_SHADER_WORKER_KEY,
+      worker, (GDestroyNotify) gst_object_unref);
+  return worker;
+}
+
+static void
+_worker_compile (gpointer data)
+{
+  Gst3DShaderProgram *program = data;
+  GstGLContext *worker = gst_gl_context_get_current ();
+  GError *error = NULL;
+
+  GstGLShader *shader = _compile (worker, program->vertex_src,
+      program->fragment_src, program->binary_path != NULL, &error);
+  /* the program is used from the other context */
+  if (shader)
+    worker->gl_vtable->Finish ();
+
+  G_LOCK (shader_cache);
+  program->shader = shader;
+  program->error = error;
+  g_atomic_int_set (&program->state, shader ?
+      GST_3D_SHADER_PROGRAM_COMPILED : GST_3D_SHADER_PROGRAM_FAILED);
+  g_cond_broadcast (&compile_cond);
+  G_UNLOCK (shader_cache);
+}
+
+static void
+_program_start_worker (GstGLContext * worker, Gst3DShaderProgram * program)
+{
+  GstGLWindow *window = gst_gl_context_get_window (worker);
+
+  /* the worker keeps the program alive until it is done */
+  program->ref_count++;
+  gst_gl_window_send_message_async (window, _worker_compile, program,
+      (GDestroyNotify) _program_unref);
+  gst_object_unref (window);
+}
+
+/* Finishes a compiled program on the GL thread. With @wait it blocks until
+ * the compile is done.
+ *
+ * Returns: %FALSE while the program is still compiling */
+static gboolean
+_program_poll (Gst3DShaderProgram * program, gboolean wait)
+{
+  GstGLFuncs *gl = program->context->gl_vtable;
+  gint state = g_atomic_int_get (&program->state);
+
+  if (state == GST_3D_SHADER_PROGRAM_COMPILING && program->stages[0]) {
+    GLint done = GL_FALSE;
+    if (!wait)
+      gl->GetProgramiv (program->program, GL_COMPLETION_STATUS_KHR, &done);
+    if (wait || done)
+      _program_finish_parallel (program);
+  } else if (state == GST_3D_SHADER_PROGRAM_COMPILING && wait) {
+    G_LOCK (shader_cache);
+    while (g_atomic_int_get (&program->state) ==
+        GST_3D_SHADER_PROGRAM_COMPILING)
+      g_cond_wait (&compile_cond, &G_LOCK_NAME (shader_cache));
+    G_UNLOCK (shader_cache);
+  }
+
+  state = g_atomic_int_get (&program->state);
+  switch (state) {
+    case GST_3D_SHADER_PROGRAM_COMPILING:
+      return FALSE;
+    case GST_3D_SHADER_PROGRAM_COMPILED:
+      if (program->shader)
+        program->program = gst_gl_shader_get_program_handle (program->shader);
+      _program_reflect (program->context, program);
+      if (program->binary_path)
+        _binary_cache_store (program->context, program->binary_path,
+            program->program);
+      g_atomic_int_set (&program->state, GST_3D_SHADER_PROGRAM_LINKED);
+      break;
+    case GST_3D_SHADER_PROGRAM_FAILED:{
+      /* the next request compiles again */
+      G_LOCK (shader_cache);
+      GHashTable *cache = g_object_get_data (G_OBJECT (program->context),
+          GST_3D_SHADER_CACHE_KEY);
+      if (cache && g_hash_table_lookup (cache, program->key) == program)
+        g_hash_table_remove (cache, program->key);
+      G_UNLOCK (shader_cache);
+      break;
+    }
+    default:
+      break;
+  }
+
+  return TRUE;
+}
+
+/* Waits for the program, on failure it is released. */
+static gboolean
+_program_wait (Gst3DShaderProgram * program, GError ** error)
+{
+  _program_poll (program, TRUE);
+
+  if (g_atomic_int_get (&program->state) == GST_3D_SHADER_PROGRAM_FAILED) {
+    if (error)
+      *error = g_error_copy (program->error);
+    _program_unref (program);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* variants */
+
+static gint
+_compare_strings (gconstpointer a, gconstpointer b)
+{
+  return strcmp (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Turns the specializations into #define lines. They are sorted, so the
+ * same set in another order maps to the same cached variant. */
+static gchar *
+_defines_to_string (const gchar * const *defines)
+{
+  if (!defines || !defines[0])
+    return NULL;
+
+  guint n = g_strv_length ((gchar **) defines);
+  const gchar **sorted = g_new (const gchar *, n);
+  memcpy (sorted, defines, n * sizeof (gchar *));
+  qsort (sorted, n, sizeof (gchar *), _compare_strings);
+
+  GString *str = g_string_new (NULL);
+  for (guint i = 0; i < n; i++)
+    g_string_append_printf (str, "#define %s\n", sorted[i]);
+
+  g_free (sorted);
+  return g_string_free (str, FALSE);
+}
+
+/* Inserts the defines after #version, which has to stay the first
+ * directive, and resets the line number so compiler messages still point
+ * into the shader file. */
+static gchar *
+_specialize (const gchar * source, const gchar * defines)
+{
+  if (!defines)
+    return g_strdup (source);
+
+  const gchar *body = source;
+  const gchar *version = strstr (source, "#version");
+  if (version) {
+    const gchar *eol = strchr (version, '\n');
+    body = eol ? eol + 1 : version + strlen (version);
+  }
+
+  guint line = 1;
+  for (const gchar * c = source; c < body; c++)
+    if (*c == '\n')
+      line++;
+
+  return g_strdup_printf ("%.*s%s%s#line %u\n%s", (gint) (body - source),
+      source, body > source && body[-1] != '\n' ? "\n" : "", defines, line,
+      body);
+}
+
+/* Returns the program for the sources and defines, from memory, from the
+ * binary cache on disk, or compiled. With @async the compile is only
+ * started and the program has to be polled. Must be called from the GL
+ * thread. */
+static Gst3DShaderProgram *
+_program_cache_get (GstGLContext * context, const gchar * vertex,
+    const gchar * fragment, const gchar * defines, gboolean async,
+    GError ** error)
+{
+  GHashTable *cache;
+  Gst3DShaderProgram *program;
+  /* reloaded sources are new programs */
+  gchar *key = g_strdup_printf ("%s\n%s\n%s\n%d %d", vertex, fragment,
+      defines ? defines : "", _source_generation (vertex),
+      _source_generation (fragment));
+
+  G_LOCK (shader_cache);
+  cache = g_object_get_data (G_OBJECT (context), GST_3D_SHADER_CACHE_KEY);
+  if (!cache) {
+    cache = g_hash_table_new (g_str_hash, g_str_equal);
+    g_object_set_data_full (G_OBJECT (context), GST_3D_SHADER_CACHE_KEY,
+        cache, (GDestroyNotify) g_hash_table_unref);
+  }
+  program = g_hash_table_lookup (cache, key);
+  if (program)
+    program->ref_count++;
+  G_UNLOCK (shader_cache);
+
+  if (program) {
+    GST_DEBUG ("reusing program %s %s", vertex, fragment);
+    g_free (key);
+    if (!async && !_program_wait (program, error))
+      return NULL;
+    return program;
+  }
+
+  GBytes *vertex_bytes = _read_source (vertex);
+  GBytes *fragment_bytes = _read_source (fragment);
+  const gchar *vertex_src = vertex_bytes ?
+      g_bytes_get_data (vertex_bytes, NULL) : "";
+  const gchar *fragment_src = fragment_bytes ?
+      g_bytes_get_data (fragment_bytes, NULL) : "";
+  GstGLContext *worker = NULL;
+
+  program = g_new0 (Gst3DShaderProgram, 1);
+  program->ref_count = 1;
+  program->context = gst_object_ref (context);
+  program->key = key;
+  program->state = GST_3D_SHADER_PROGRAM_COMPILING;
+
+  if (_binary_cache_supported (context)) {
+    gchar *path = _binary_cache_path (context, vertex_src, fragment_src,
+        defines);
+    program->program = _binary_cache_load (context, path);
+    if (program->program) {
+      GST_DEBUG ("loaded program %s %s from %s", vertex, fragment, path);
+      program->state = GST_3D_SHADER_PROGRAM_COMPILED;
+      g_free (path);
+    } else {
+      program->binary_path = path;
+    }
+  }
+
+  if (program->state == GST_3D_SHADER_PROGRAM_COMPILING) {
+    gchar *vertex_variant = _specialize (vertex_src, defines);
+    gchar *fragment_variant = _specialize (fragment_src, defines);
+    GST_LOG ("Creating shader from vertex src %s, fragment src %s",
+        vertex_variant, fragment_variant);
+
+    if (async && _parallel_compile_supported (context)) {
+      _program_start_parallel (context, program, vertex_variant,
+          fragment_variant);
+      g_free (vertex_variant);
+      g_free (fragment_variant);
+    } else if (async && (worker = _worker_get (context))) {
+      program->vertex_src = vertex_variant;
+      program->fragment_src = fragment_variant;
+    } else {
+      program->shader = _compile (context, vertex_variant, fragment_variant,
+          program->binary_path != NULL, error);
+      g_free (vertex_variant);
+      g_free (fragment_variant);
+      if (!program->shader) {
+        program->state = GST_3D_SHADER_PROGRAM_FAILED;
+      } else {
+        program->state = GST_3D_SHADER_PROGRAM_COMPILED;
+      }
+    }
+  }
+
+  if (vertex_bytes)
+    g_bytes_unref (vertex_bytes);
+  if (fragment_bytes)
+    g_bytes_unref (fragment_bytes);
+
+  if (program->state == GST_3D_SHADER_PROGRAM_FAILED) {
+    _program_unref (program);
+    return NULL;
+  }
+
+  /* pending programs are shared as well */
+  G_LOCK (shader_cache);
+  g_hash_table_replace (cache, program->key, program);
+  G_UNLOCK (shader_cache);
+
+  if (worker)
+    _program_start_worker (worker, program);
+
+  _program_poll (program, FALSE);
+
+  return program;
+}
+
+static void
+_shader_set_program (Gst3DShader * self, Gst3DShaderProgram * program)
+{
+  if (self->cached_program)
+    _program_unref ((Gst3DShaderProgram *) self->cached_program);
+  self->cached_program = program;
+  self->program = program ? program->program : 0;
+  self->instanced = program ? program->instanced : FALSE;
+}
+
+/* Switches to the pending program once it is linked. */
+static void
+_shader_poll (Gst3DShader * self, GError ** error)
+{
+  Gst3DShaderProgram *pending = self->pending_program;
+
+  if (!pending || !_program_poll (pending, FALSE))
+    return;
+
+  self->pending_program = NULL;
+
+  if (g_atomic_int_get (&pending->state) == GST_3D_SHADER_PROGRAM_FAILED) {
+    if (error && !self->reloading)
+      *error = g_error_copy (pending->error);
+    else
+      GST_WARNING_OBJECT (self, "%s", pending->error->message);
+    _program_unref (pending);
+    /* a broken reload keeps the working program */
+    self->ready = self->reloading;
+    self->reloading = FALSE;
+    return;
+  }
+
+  _shader_set_program (self, pending);
+  self->ready = TRUE;
+  self->reloading = FALSE;
+}
+
+static void
+_shader_set_sources (Gst3DShader * self, const gchar * vertex,
+    const gchar * fragment, const gchar * const *defines)
+{
+  gchar *old_vertex = self->vertex;
+  gchar *old_fragment = self->fragment;
+  gchar **old_defines = self->defines;
+
+  self->vertex = g_strdup (vertex);
+  self->fragment = g_strdup (fragment);
+  self->defines = g_strdupv ((gchar **) defines);
+  self->generation = g_atomic_int_get (&shader_generation);
+
+  /* the arguments may be the old sources */
+  g_free (old_vertex);
+  g_free (old_fragment);
+  g_strfreev (old_defines);
+}
+
+/* Relinks the program in the background if one of its files changed in the
+ * shader directory. */
+static void
+_shader_reload (Gst3DShader * self)
+{
+  GError *error = NULL;
+  gint generation = g_atomic_int_get (&shader_generation);
+
+  if (G_LIKELY (generation == self->generation) || !self->vertex)
+    return;
+
+  gboolean changed =
+      _source_generation (self->vertex) > self->generation ||
+      _source_generation (self->fragment) > self->generation;
+  self->generation = generation;
+  if (!changed)
+    return;
+
+  GST_INFO_OBJECT (self, "reloading %s %s", self->vertex, self->fragment);
+  gboolean ready = self->ready;
+  if (!gst_3d_shader_from_vert_frag_async (self, self->vertex, self->fragment,
+          (const gchar * const *) self->defines, NULL, NULL, &error)) {
+    GST_WARNING_OBJECT (self, "%s", error->message);
+    g_clear_error (&error);
+    self->ready = ready;
+    return;
+  }
+  if (self->pending_program)
+    self->reloading = ready;
+  else if (!self->ready)
+    /* failed at once, the old program stays */
+    self->ready = ready;
+}
+
 void
 gst_3d_shader_delete (Gst3DShader * self)
 {
-  if (self->shader != NULL) {
-    gst_object_unref (self->shader);
-    self->shader = NULL;
+  if (self->pending_program != NULL) {
+    _program_unref ((Gst3DShaderProgram *) self->pending_program);
+    self->pending_program = NULL;
   }
+  _shader_set_program (self, NULL);
+  self->ready = FALSE;
 }
 
+/**
+ * gst_3d_shader_from_vert_frag:
+ *
+ * Builds the program from two shaders of the gpu resources. Programs are
+ * shared between the shaders of a context and kept on disk, where the
+ * driver supports program binaries, so they are only compiled once.
+ */
 gboolean
 gst_3d_shader_from_vert_frag (Gst3DShader * self, const gchar * vertex, const gchar * fragment, GError **error)
 {
-  gboolean ret = FALSE;
-  GstGLShader *shader = NULL;
+  return gst_3d_shader_from_vert_frag_defines (self, vertex, fragment, NULL,
+      error);
+}
+
+/**
+ * gst_3d_shader_from_vert_frag_defines:
+ * @defines: (array zero-terminated=1) (nullable): specializations as
+ *   "NAME" or "NAME VALUE"
+ *
+ * Like gst_3d_shader_from_vert_frag(), with the @defines inserted after
+ * the #version of both shaders. Each set of defines is a variant of its
+ * own in the program cache, so constants can be folded by the compiler
+ * instead of being branched on per fragment.
+ */
+gboolean
+gst_3d_shader_from_vert_frag_defines (Gst3DShader * self, const gchar * vertex,
+    const gchar * fragment, const gchar * const *defines, GError ** error)
+{
   GstGLContext *context = self->context;
 
-  if (gst_gl_context_get_gl_api (context)) {
-    GstGLSLStage *stage;
+  if (!gst_gl_context_get_gl_api (context))
+    return FALSE;
 
-    const gchar *vertex_src = gst_3d_shader_read (vertex);
-    const gchar *fragment_src = gst_3d_shader_read (fragment);
+  gchar *define_lines = _defines_to_string (defines);
+  Gst3DShaderProgram *program = _program_cache_get (context, vertex,
+      fragment, define_lines, FALSE, error);
+  g_free (define_lines);
+  if (!program)
+    return FALSE;
 
-    GST_LOG_OBJECT (self, "Creating shader from vertex src %s, fragment src %s",
-        vertex_src, fragment_src);
+  gst_3d_shader_delete (self);
+  _shader_set_program (self, program);
+  _shader_set_sources (self, vertex, fragment, defines);
+  self->ready = TRUE;
 
-    shader = gst_gl_shader_new (context);
+  return TRUE;
+}
 
-    if (!(stage = gst_glsl_stage_new_with_string (context, GL_VERTEX_SHADER,
-                GST_GLSL_VERSION_NONE, GST_GLSL_PROFILE_NONE, vertex_src))) {
-      goto print_error;
-    }
+/**
+ * gst_3d_shader_from_vert_frag_async:
+ * @fallback_vertex: (nullable): vertex shader to draw with meanwhile
+ * @fallback_fragment: (nullable): fragment shader to draw with meanwhile
+ *
+ * Like gst_3d_shader_from_vert_frag_defines(), but only starts compiling,
+ * with KHR_parallel_shader_compile or on a shared context. Until the
+ * program is linked the shader keeps its current program, or uses the
+ * fallback, which should be trivial to compile. Without either it has no
+ * program and callers skip drawing, see gst_3d_shader_is_ready().
+ *
+ * Uniforms set before the switch apply to the previous program.
+ */
+gboolean
+gst_3d_shader_from_vert_frag_async (Gst3DShader * self, const gchar * vertex,
+    const gchar * fragment, const gchar * const *defines,
+    const gchar * fallback_vertex, const gchar * fallback_fragment,
+    GError ** error)
+{
+  GstGLContext *context = self->context;
 
-    if (!gst_gl_shader_compile_attach_stage (shader, stage, error)) {
-      gst_object_unref (stage);
-      goto print_error;
-    }
+  if (!gst_gl_context_get_gl_api (context))
+    return FALSE;
 
-    if (!(stage = gst_glsl_stage_new_with_string (context, GL_FRAGMENT_SHADER,
-                GST_GLSL_VERSION_NONE, GST_GLSL_PROFILE_NONE, fragment_src))) {
-      goto print_error;
-    }
+  gchar *define_lines = _defines_to_string (defines);
+  Gst3DShaderProgram *program = _program_cache_get (context, vertex,
+      fragment, define_lines, TRUE, error);
+  g_free (define_lines);
+  if (!program)
+    return FALSE;
 
-    if (!gst_gl_shader_compile_attach_stage (shader, stage, error)) {
-      gst_object_unref (stage);
-      goto print_error;
-    }
+  if (self->pending_program)
+    _program_unref ((Gst3DShaderProgram *) self->pending_program);
+  self->pending_program = program;
+  self->ready = FALSE;
+  self->reloading = FALSE;
+  _shader_set_sources (self, vertex, fragment, defines);
 
-    if (!gst_gl_shader_link (shader, error)) {
-      goto print_error;
-    }
-    if (self->shader)
-      gst_object_unref (self->shader);
-    self->shader = gst_object_ref (shader);
-    ret = TRUE;
+  if (!self->program && fallback_vertex && fallback_fragment) {
+    Gst3DShaderProgram *fallback = _program_cache_get (context,
+        fallback_vertex, fallback_fragment, NULL, FALSE, error);
+    if (!fallback)
+      return FALSE;
+    _shader_set_program (self, fallback);
   }
 
-  return ret;
+  /* cached programs are ready at once */
+  _shader_poll (self, NULL);
 
-print_error:
-  if (shader)
-    gst_object_unref (shader);
+  return TRUE;
+}
 
-  return FALSE;
+/**
+ * gst_3d_shader_is_ready:
+ * @error: set if the requested program failed to build
+ *
+ * Returns: %TRUE if the program requested last is linked and in use
+ */
+gboolean
+gst_3d_shader_is_ready (Gst3DShader * self, GError ** error)
+{
+  _shader_poll (self, error);
+  return self->ready;
+}
+
+/**
+ * gst_3d_shader_get_uniform_location:
+ *
+ * Returns: the location of the uniform @name, or -1 if the program does not
+ * use it. Locations are cached when the program is linked.
+ */
+GLint
+gst_3d_shader_get_uniform_location (Gst3DShader * self, const gchar * name)
+{
+  Gst3DShaderProgram *program = self->cached_program;
+  if (!program)
+    return -1;
+  return GPOINTER_TO_INT (g_hash_table_lookup (program->uniforms, name)) - 1;
+}
+
+GLint
+gst_3d_shader_get_attribute_location (Gst3DShader * self, const gchar * name)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+
+  /* vertex arrays can be set up while the program is compiling */
+  if (!self->program) {
+    for (guint i = 0; i < G_N_ELEMENTS (bound_attributes); i++)
+      if (g_strcmp0 (bound_attributes[i].name, name) == 0)
+        return bound_attributes[i].location;
+    return -1;
+  }
+
+  return gl->GetAttribLocation (self->program, name);
+}
+
+/* The uniform setters apply to the bound shader, see gst_3d_shader_bind(). */
+void
+gst_3d_shader_upload_1i (Gst3DShader * self, const gchar * name, gint value)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  GLint location = gst_3d_shader_get_uniform_location (self, name);
+  if (location >= 0)
+    gl->Uniform1i (location, value);
+}
+
+void
+gst_3d_shader_upload_1f (Gst3DShader * self, const gchar * name, gfloat value)
+{
+  GstGLFuncs *gl = self->context->gl_vtable;
+  GLint location = gst_3d_shader_get_uniform_location (self, name);
+  if (location >= 0)
+    gl->Uniform1f (location, value);
 }
 
 void
 gst_3d_shader_upload_matrix (Gst3DShader * self, graphene_matrix_t * mat, const gchar * name)
 {
+  GstGLFuncs *gl = self->context->gl_vtable;
+  GLint location = gst_3d_shader_get_uniform_location (self, name);
+  if (location < 0)
+    return;
   GLfloat temp_matrix[16];
   graphene_matrix_to_float (mat, temp_matrix);
-  gst_gl_shader_set_uniform_matrix_4fv (self->shader, name, 1, GL_FALSE, temp_matrix);
+  gl->UniformMatrix4fv (location, 1, GL_FALSE, temp_matrix);
 }
 
 void
 gst_3d_shader_upload_vec2 (Gst3DShader * self, graphene_vec2_t * vec, const gchar * name)
 {
+  GstGLFuncs *gl = self->context->gl_vtable;
+  GLint location = gst_3d_shader_get_uniform_location (self, name);
+  if (location < 0)
+    return;
   GLfloat temp_vec[2];
   graphene_vec2_to_float (vec, temp_vec);
-  gst_gl_shader_set_uniform_2fv (self->shader, name, 1, temp_vec);
+  gl->Uniform2fv (location, 1, temp_vec);
 }
@@ -38,6 +38,39 @@ G_BEGIN_DECLS
 typedef struct _Gst3DShader Gst3DShader;
 typedef struct _Gst3DShaderClass Gst3DShaderClass;
 
+/* Attribute locations bound before linking. Meshes set up their vertex
+ * arrays for these, so one mesh can be drawn with any shader. */
+#define GST_3D_ATTRIBUTE_POSITION 0
+#define GST_3D_ATTRIBUTE_UV 1
+#define GST_3D_ATTRIBUTE_COLOR 2
+#define GST_3D_ATTRIBUTE_NORMAL 3
+/* per instance attributes of Gst3DInstance, the mat4 takes 4 locations */
+#define GST_3D_ATTRIBUTE_MODEL 8
+#define GST_3D_ATTRIBUTE_INSTANCE_COLOR 12
+
+/* Element of the instance buffer of the scene, read by shaders with a
+ * "model" attribute. */
+typedef struct _Gst3DInstance
+{
+  GLfloat model[16];
+  GLfloat color[4];
+} Gst3DInstance;
+
+/* Uniform block with the matrices of the current view, shared by all
+ * programs. Its layout is Gst3DViewBlock. */
+#define GST_3D_SHADER_VIEW_BLOCK "ViewBlock"
+#define GST_3D_SHADER_VIEW_BINDING 0
+
+/* std140 layout of the view block. Single pass stereo sets both eyes and
+ * an eye count of 2, instanced shaders then draw every instance once per
+ * eye into its half of the viewport. */
+typedef struct _Gst3DViewBlock
+{
+  GLfloat view_projection[2][16];
+  GLint eye_count;
+  GLint padding[3];
+} Gst3DViewBlock;
+
 struct _Gst3DShader
 {
   /*< private > */
@@ -45,7 +78,21 @@ struct _Gst3DShader
 
   GstGLContext *context;
 
-  GstGLShader *shader;
+  /* linked GL program, bound with gst_3d_shader_bind() */
+  GLuint program;
+  gpointer cached_program;
+  /* compiling, replaces the program once linked */
+  gpointer pending_program;
+  gboolean ready;
+  gboolean reloading;
+  /* the program reads Gst3DInstance attributes */
+  gboolean instanced;
+
+  /* sources of the program, to relink them when they change */
+  gchar *vertex;
+  gchar *fragment;
+  gchar **defines;
+  gint generation;
   GLint attr_position;
   GLint attr_uv;
 };
@@ -59,15 +106,31 @@ Gst3DShader *gst_3d_shader_new (GstGLContext * context);
 GType gst_3d_shader_get_type (void);
 
 const char *gst_3d_shader_read (const char *file);
+void gst_3d_shader_set_directory (const gchar * dir);
+gchar *gst_3d_shader_get_directory (void);
 void gst_3d_shader_bind (Gst3DShader * self);
+void gst_3d_shader_update (Gst3DShader * self);
 /*
 void gst_3d_shader_disable_attribs (Gst3DShader * self);
 void gst_3d_shader_enable_attribs (Gst3DShader * self);
 */	
 gboolean gst_3d_shader_from_vert_frag (Gst3DShader * self, const gchar * vertex,
     const gchar * fragment, GError **error);
+gboolean gst_3d_shader_from_vert_frag_defines (Gst3DShader * self,
+    const gchar * vertex, const gchar * fragment, const gchar * const *defines,
+    GError **error);
+gboolean gst_3d_shader_from_vert_frag_async (Gst3DShader * self,
+    const gchar * vertex, const gchar * fragment, const gchar * const *defines,
+    const gchar * fallback_vertex, const gchar * fallback_fragment,
+    GError **error);
+gboolean gst_3d_shader_is_ready (Gst3DShader * self, GError **error);
 void gst_3d_shader_delete (Gst3DShader * self);
 
+GLint gst_3d_shader_get_uniform_location (Gst3DShader * self, const gchar * name);
+GLint gst_3d_shader_get_attribute_location (Gst3DShader * self, const gchar * name);
+
+void gst_3d_shader_upload_1i (Gst3DShader * self, const gchar * name, gint value);
+void gst_3d_shader_upload_1f (Gst3DShader * self, const gchar * name, gfloat value);
 void gst_3d_shader_upload_matrix (Gst3DShader * self, graphene_matrix_t * mat,
     const gchar * name);
 void gst_3d_shader_upload_vec2 (Gst3DShader * self, graphene_vec2_t * vec,
@@ -76,6 +139,10 @@ void gst_3d_shader_upload_vec2 (Gst3DShader * self, graphene_vec2_t * vec,
 Gst3DShader *
 gst_3d_shader_new_vert_frag (GstGLContext * context, const gchar * vertex,
     const gchar * fragment, GError **error);
+Gst3DShader *
+gst_3d_shader_new_vert_frag_defines (GstGLContext * context,
+    const gchar * vertex, const gchar * fragment, const gchar * const *defines,
+    GError **error);
 
 G_END_DECLS
 #endif /* __GST_3D_SHADER_H__ */
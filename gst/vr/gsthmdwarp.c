@@ -51,6 +51,11 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 enum
 {
   PROP_0,
+  PROP_K1,
+  PROP_K2,
+  PROP_K3,
+  PROP_CLIP,
+  PROP_SHADER_DIR,
 };
 
 #define DEBUG_INIT \
@@ -84,6 +89,33 @@ gst_hmd_warp_class_init (GstHmdWarpClass * klass)
   gobject_class->set_property = gst_hmd_warp_set_property;
   gobject_class->get_property = gst_hmd_warp_get_property;
 
+  g_object_class_install_property (gobject_class, PROP_K1,
+      g_param_spec_float ("k1", "K1",
+          "Second order radial distortion coefficient of the lenses",
+          -10.0, 10.0, 0.22, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_K2,
+      g_param_spec_float ("k2", "K2",
+          "Fourth order radial distortion coefficient of the lenses",
+          -10.0, 10.0, 0.24, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_K3,
+      g_param_spec_float ("k3", "K3",
+          "Sixth order radial distortion coefficient of the lenses",
+          -10.0, 10.0, 0.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CLIP,
+      g_param_spec_boolean ("clip", "Clip",
+          "Draw black where the distortion samples outside of the eye",
+          TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SHADER_DIR,
+      g_param_spec_string ("shader-dir", "Shader directory",
+          "Load the shaders of all elements from this directory and reload "
+          "them when they change, for development. Defaults to "
+          "GST_VR_SHADER_DIR", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   GST_GL_BASE_FILTER_CLASS (klass)->gl_stop = gst_hmd_warp_gl_stop;
 
   gst_gl_filter_add_rgba_pad_templates (GST_GL_FILTER_CLASS (klass));
@@ -107,23 +139,63 @@ gst_hmd_warp_init (GstHmdWarp * self)
   self->shader = NULL;
   self->in_tex = 0;
   self->render_plane = NULL;
+  self->k1 = 0.22;
+  self->k2 = 0.24;
+  self->k3 = 0.0;
+  self->clip = TRUE;
+  self->variant_changed = FALSE;
 }
 
 static void
 gst_hmd_warp_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec)
 {
+  GstHmdWarp *self = GST_HMD_WARP (object);
+
   switch (prop_id) {
+    case PROP_K1:
+      self->k1 = g_value_get_float (value);
+      break;
+    case PROP_K2:
+      self->k2 = g_value_get_float (value);
+      break;
+    case PROP_K3:
+      self->k3 = g_value_get_float (value);
+      break;
+    case PROP_CLIP:
+      self->clip = g_value_get_boolean (value);
+      break;
+    case PROP_SHADER_DIR:
+      gst_3d_shader_set_directory (g_value_get_string (value));
+      return;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-      break;
+      return;
   }
+  self->variant_changed = TRUE;
 }
 
 
 static void
 gst_hmd_warp_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec)
 {
+  GstHmdWarp *self = GST_HMD_WARP (object);
+
   switch (prop_id) {
+    case PROP_K1:
+      g_value_set_float (value, self->k1);
+      break;
+    case PROP_K2:
+      g_value_set_float (value, self->k2);
+      break;
+    case PROP_K3:
+      g_value_set_float (value, self->k3);
+      break;
+    case PROP_CLIP:
+      g_value_set_boolean (value, self->clip);
+      break;
+    case PROP_SHADER_DIR:
+      g_value_take_string (value, gst_3d_shader_get_directory ());
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -174,6 +246,31 @@ gst_hmd_warp_stop (GstBaseTransform * trans)
   return GST_BASE_TRANSFORM_CLASS (parent_class)->stop (trans);
 }
 
+/* The coefficients are constants of the variant, so the compiler folds the
+ * distortion polynomial and drops the clip test when it is disabled. The
+ * variant compiles in the background, the video passes through unwarped,
+ * or with the previous variant, until it is linked. */
+static gboolean
+_build_shader (GstHmdWarp * self, GError ** error)
+{
+  gchar k1[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar k2[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar k3[G_ASCII_DTOSTR_BUF_SIZE];
+  gchar *kappa = g_strdup_printf ("KAPPA vec4(1.0, %s, %s, %s)",
+      g_ascii_dtostr (k1, sizeof (k1), self->k1),
+      g_ascii_dtostr (k2, sizeof (k2), self->k2),
+      g_ascii_dtostr (k3, sizeof (k3), self->k3));
+  const gchar *defines[] = { kappa, self->clip ? NULL : "NO_CLIP", NULL };
+
+  gboolean ret = gst_3d_shader_from_vert_frag_async (self->shader,
+      "mvp_uv.vert", "warp.frag", defines, "mvp_uv.vert", "texture_uv.frag",
+      error);
+  g_free (kappa);
+  self->variant_changed = FALSE;
+
+  return ret;
+}
+
 static gboolean
 gst_hmd_warp_init_gl (GstGLFilter * filter)
 {
@@ -184,19 +281,13 @@ gst_hmd_warp_init_gl (GstGLFilter * filter)
 
   if (!self->render_plane) {
     self->shader = gst_3d_shader_new (context);
-    if (!gst_3d_shader_from_vert_frag (self->shader, "mvp_uv.vert", "warp.frag", &error))
+    if (!_build_shader (self, &error))
       goto handle_error;
 
-    gst_3d_shader_bind (self->shader);
-
-    self->render_plane = gst_3d_mesh_new_plane (context, self->aspect);
+    self->render_plane = gst_3d_mesh_cache_get_plane (context, self->aspect);
 
     gl->ClearColor (0.f, 0.f, 0.f, 0.f);
     gl->ActiveTexture (GL_TEXTURE0);
-    gst_gl_shader_set_uniform_1i (self->shader->shader, "texture", 0);
-
-    gst_gl_shader_use (self->shader->shader);
-    gst_3d_shader_upload_vec2 (self->shader, &self->screen_size, "screen_size");
 
     gst_3d_mesh_bind_shader (self->render_plane, self->shader);
   }
@@ -233,9 +324,19 @@ gst_hmd_warp_draw (gpointer this)
 
   gl->Clear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  gst_gl_shader_use (self->shader->shader);
+  GError *error = NULL;
+  if (self->variant_changed && !_build_shader (self, &error))
+    goto handle_error;
+  if (!gst_3d_shader_is_ready (self->shader, &error) && error)
+    goto handle_error;
+
+  gst_3d_shader_bind (self->shader);
   gl->BindTexture (GL_TEXTURE_2D, self->in_tex->tex_id);
 
+  /* set every frame, the program changes when the variant is linked */
+  gst_3d_shader_upload_1i (self->shader, "texture", 0);
+  gst_3d_shader_upload_vec2 (self->shader, &self->screen_size, "screen_size");
+
   graphene_matrix_t projection_ortho;
   graphene_matrix_init_ortho (&projection_ortho, -self->aspect, self->aspect, -1.0, 1.0, -1.0, 1.0);
   gst_3d_shader_upload_matrix (self->shader, &projection_ortho, "mvp");
@@ -247,4 +348,10 @@ gst_hmd_warp_draw (gpointer this)
   gst_gl_context_clear_shader (context);
 
   return TRUE;
+
+handle_error:
+  GST_ELEMENT_ERROR (self, RESOURCE, FAILED, ("%s", error->message), (NULL));
+  g_clear_error (&error);
+
+  return FALSE;
 }
@@ -47,6 +47,13 @@ struct _GstHmdWarp
   graphene_vec2_t screen_size;
   Gst3DMesh *render_plane;
   float aspect;
+
+  /* distortion, compiled into the shader variant */
+  gfloat k1;
+  gfloat k2;
+  gfloat k3;
+  gboolean clip;
+  gboolean variant_changed;
 };
 
 struct _GstHmdWarpClass
@@ -240,17 +240,16 @@ gst_point_cloud_builder_init_scene (GstGLFilter * filter)
   if (!self->mesh) {
     GError *error = NULL;
 
-    self->shader = gst_3d_shader_new_vert_frag (context, "points.vert",
-        "points.frag", &error);
-    if (self->shader == NULL)
+    /* compiles in the background, frames stay black until it is linked */
+    self->shader = gst_3d_shader_new (context);
+    if (!gst_3d_shader_from_vert_frag_async (self->shader, "points.vert",
+            "points.frag", NULL, NULL, NULL, &error))
       goto handle_error;
-    gst_3d_shader_bind (self->shader);
     self->mesh = gst_3d_mesh_new_point_plane (context, 512, 424);
     gst_3d_mesh_bind_shader (self->mesh, self->shader);
 
     gl->ClearColor (0.f, 0.f, 0.f, 0.f);
     gl->ActiveTexture (GL_TEXTURE0);
-    gst_gl_shader_set_uniform_1i (self->shader->shader, "texture", 0);
   }
   return ret;
 
@@ -281,8 +280,18 @@ gst_point_cloud_builder_draw (gpointer this)
 
   gl->Clear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-  gst_gl_shader_use (self->shader->shader);
+  GError *error = NULL;
+  if (!gst_3d_shader_is_ready (self->shader, &error)) {
+    if (!error)
+      return TRUE;
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED, ("%s", error->message), (NULL));
+    g_clear_error (&error);
+    return FALSE;
+  }
+
+  gst_3d_shader_bind (self->shader);
   gl->BindTexture (GL_TEXTURE_2D, self->in_tex->tex_id);
+  gst_3d_shader_upload_1i (self->shader, "texture", 0);
 
   gst_3d_camera_update_view (GST_3D_CAMERA (self->camera));
   gst_3d_shader_upload_matrix (self->shader, &GST_3D_CAMERA (self->camera)->mvp,
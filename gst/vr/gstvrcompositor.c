@@ -59,6 +59,18 @@ GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
 enum
 {
   PROP_0,
+  PROP_SPHERE_LOD,
+  PROP_PROJECTION,
+  PROP_LENS_FOV,
+  PROP_LENS_RADIUS,
+  PROP_FRONT_LENS_X,
+  PROP_FRONT_LENS_Y,
+  PROP_BACK_LENS_X,
+  PROP_BACK_LENS_Y,
+  PROP_SHADER_DIR,
+  PROP_DYNAMIC_RESOLUTION,
+  PROP_MIN_EYE_SCALE,
+  PROP_EYE_SCALE,
 };
 
 #define DEBUG_INIT \
@@ -81,6 +93,27 @@ static gboolean gst_vr_compositor_filter_texture (GstGLFilter * filter, GstGLMem
 
 static void _init_scene (Gst3DScene * scene);
 
+#define GST_TYPE_VR_COMPOSITOR_PROJECTION (gst_vr_compositor_projection_get_type ())
+static GType
+gst_vr_compositor_projection_get_type (void)
+{
+  static GType vr_compositor_projection_type = 0;
+  static const GEnumValue projection_types[] = {
+    {GST_3D_MESH_PROJECTION_EQUIRECTANGULAR, "Equirectangular", "equirectangular"},
+    {GST_3D_MESH_PROJECTION_FISHEYE, "Single fisheye lens", "fisheye"},
+    {GST_3D_MESH_PROJECTION_DUAL_FISHEYE, "Two fisheye lenses side by side", "dual-fisheye"},
+    {GST_3D_MESH_PROJECTION_EAC, "Equi-angular cubemap in 3x2 layout", "eac"},
+    {GST_3D_MESH_PROJECTION_CUBEMAP, "Cubemap in 3x2 layout", "cubemap"},
+    {0, NULL, NULL}
+  };
+
+  if (!vr_compositor_projection_type) {
+    vr_compositor_projection_type =
+        g_enum_register_static ("GstVRCompositorProjection", projection_types);
+  }
+  return vr_compositor_projection_type;
+}
+
 static void
 gst_vr_compositor_class_init (GstVRCompositorClass * klass)
 {
@@ -97,6 +130,76 @@ gst_vr_compositor_class_init (GstVRCompositorClass * klass)
 
   base_transform_class->src_event = gst_vr_compositor_src_event;
 
+  g_object_class_install_property (gobject_class, PROP_SPHERE_LOD,
+      g_param_spec_int ("sphere-lod", "Sphere LOD",
+          "Level of detail of the video sphere, -1 selects it from the eye "
+          "resolution and the video size", -1, GST_3D_MESH_SPHERE_LODS - 1,
+          -1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PROJECTION,
+      g_param_spec_enum ("projection", "Projection",
+          "Layout of the 360 degree video", GST_TYPE_VR_COMPOSITOR_PROJECTION,
+          GST_3D_MESH_PROJECTION_EQUIRECTANGULAR,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LENS_FOV,
+      g_param_spec_float ("lens-fov", "Lens FOV",
+          "Field of view of the fisheye lenses in degrees", 1.0, 360.0,
+          180.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LENS_RADIUS,
+      g_param_spec_float ("lens-radius", "Lens radius",
+          "Radius of the fisheye lens circles relative to the frame height",
+          0.0, 1.0, 0.5, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_FRONT_LENS_X,
+      g_param_spec_float ("front-lens-x", "Front lens X",
+          "Horizontal center of the front lens in texture coordinates, "
+          "-1 centers it in its half of the frame", -1.0, 1.0, -1.0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_FRONT_LENS_Y,
+      g_param_spec_float ("front-lens-y", "Front lens Y",
+          "Vertical center of the front lens in texture coordinates, "
+          "-1 centers it", -1.0, 1.0, -1.0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BACK_LENS_X,
+      g_param_spec_float ("back-lens-x", "Back lens X",
+          "Horizontal center of the back lens in texture coordinates, "
+          "-1 centers it in its half of the frame", -1.0, 1.0, -1.0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BACK_LENS_Y,
+      g_param_spec_float ("back-lens-y", "Back lens Y",
+          "Vertical center of the back lens in texture coordinates, "
+          "-1 centers it", -1.0, 1.0, -1.0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_SHADER_DIR,
+      g_param_spec_string ("shader-dir", "Shader directory",
+          "Load the shaders of all elements from this directory and reload "
+          "them when they change, for development. Defaults to "
+          "GST_VR_SHADER_DIR", NULL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_DYNAMIC_RESOLUTION,
+      g_param_spec_boolean ("dynamic-resolution", "Dynamic resolution",
+          "Lower the eye resolution while the GPU can not keep up with the "
+          "frame rate", FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MIN_EYE_SCALE,
+      g_param_spec_float ("min-eye-scale", "Minimum eye scale",
+          "Lowest fraction of the eye resolution the dynamic resolution "
+          "draws at", 1.0 - (GST_3D_RENDERER_SCALE_LEVELS - 1) *
+          GST_3D_RENDERER_SCALE_STEP, 1.0, 0.5,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_EYE_SCALE,
+      g_param_spec_float ("eye-scale", "Eye scale",
+          "Fraction of the eye resolution currently drawn at", 0.0, 1.0, 1.0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   gst_gl_filter_add_rgba_pad_templates (GST_GL_FILTER_CLASS (klass));
 
   GST_GL_FILTER_CLASS (klass)->init_fbo = gst_vr_compositor_init_scene;
@@ -120,16 +223,70 @@ gst_vr_compositor_init (GstVRCompositor * self)
 {
   self->scene = NULL;
   self->in_tex = 0;
+  self->sphere_node = NULL;
+  self->sphere_shader = NULL;
+  self->sphere_lod = -1;
+  self->current_sphere_lod = -1;
+  self->projection = GST_3D_MESH_PROJECTION_EQUIRECTANGULAR;
+  self->front_lens[0] = self->front_lens[1] = -1.0;
+  self->back_lens[0] = self->back_lens[1] = -1.0;
+  self->lens_radius = 0.5;
+  self->lens_fov = 180.0;
+  self->dynamic_resolution = FALSE;
+  self->min_eye_scale = 0.5;
+  self->resolution_change = FALSE;
 }
 
 static void
 gst_vr_compositor_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec)
 {
+  GstVRCompositor *self = GST_VR_COMPOSITOR (object);
+
   switch (prop_id) {
+  case PROP_SPHERE_LOD:
+    self->sphere_lod = g_value_get_int (value);
+    break;
+  case PROP_PROJECTION:
+    self->projection = g_value_get_enum (value);
+    break;
+  case PROP_LENS_FOV:
+    self->lens_fov = g_value_get_float (value);
+    break;
+  case PROP_LENS_RADIUS:
+    self->lens_radius = g_value_get_float (value);
+    break;
+  case PROP_FRONT_LENS_X:
+    self->front_lens[0] = g_value_get_float (value);
+    break;
+  case PROP_FRONT_LENS_Y:
+    self->front_lens[1] = g_value_get_float (value);
+    break;
+  case PROP_BACK_LENS_X:
+    self->back_lens[0] = g_value_get_float (value);
+    break;
+  case PROP_BACK_LENS_Y:
+    self->back_lens[1] = g_value_get_float (value);
+    break;
+  case PROP_SHADER_DIR:
+    /* picked up by the shaders, the mesh stays */
+    gst_3d_shader_set_directory (g_value_get_string (value));
+    return;
+  case PROP_DYNAMIC_RESOLUTION:
+    self->dynamic_resolution = g_value_get_boolean (value);
+    self->resolution_change = TRUE;
+    return;
+  case PROP_MIN_EYE_SCALE:
+    self->min_eye_scale = g_value_get_float (value);
+    self->resolution_change = TRUE;
+    return;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-    break;
+    return;
   }
+
+  /* regenerate the mesh on the next draw */
+  self->current_sphere_lod = -1;
+  self->caps_change = TRUE;
 }
 
 
@@ -137,7 +294,46 @@ static void
 gst_vr_compositor_get_property (GObject * object, guint prop_id,
                                 GValue * value, GParamSpec * pspec)
 {
+  GstVRCompositor *self = GST_VR_COMPOSITOR (object);
+
   switch (prop_id) {
+  case PROP_SPHERE_LOD:
+    g_value_set_int (value, self->sphere_lod);
+    break;
+  case PROP_PROJECTION:
+    g_value_set_enum (value, self->projection);
+    break;
+  case PROP_LENS_FOV:
+    g_value_set_float (value, self->lens_fov);
+    break;
+  case PROP_LENS_RADIUS:
+    g_value_set_float (value, self->lens_radius);
+    break;
+  case PROP_FRONT_LENS_X:
+    g_value_set_float (value, self->front_lens[0]);
+    break;
+  case PROP_FRONT_LENS_Y:
+    g_value_set_float (value, self->front_lens[1]);
+    break;
+  case PROP_BACK_LENS_X:
+    g_value_set_float (value, self->back_lens[0]);
+    break;
+  case PROP_BACK_LENS_Y:
+    g_value_set_float (value, self->back_lens[1]);
+    break;
+  case PROP_SHADER_DIR:
+    g_value_take_string (value, gst_3d_shader_get_directory ());
+    break;
+  case PROP_DYNAMIC_RESOLUTION:
+    g_value_set_boolean (value, self->dynamic_resolution);
+    break;
+  case PROP_MIN_EYE_SCALE:
+    g_value_set_float (value, self->min_eye_scale);
+    break;
+  case PROP_EYE_SCALE:
+    g_value_set_float (value, self->scene && self->scene->renderer ?
+        self->scene->renderer->eye_scale : 1.0);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     break;
@@ -163,6 +359,7 @@ gst_vr_compositor_set_caps (GstGLFilter * filter, GstCaps * incaps, GstCaps * ou
 #endif
   }
   self->caps_change = TRUE;
+  self->resolution_change = TRUE;
   return ret;
 }
 
@@ -206,8 +403,21 @@ gst_vr_compositor_stop (GstBaseTransform * trans)
 
   /* blocking call, wait until the opengl thread has destroyed the shader */
 
-  if (self->scene)
+  if (self->sphere_node) {
+    gst_object_unref (self->sphere_node);
+    self->sphere_node = NULL;
+  }
+
+  if (self->sphere_shader) {
+    gst_object_unref (self->sphere_shader);
+    self->sphere_shader = NULL;
+  }
+  self->current_sphere_lod = -1;
+
+  if (self->scene) {
     gst_object_unref (self->scene);
+    self->scene = NULL;
+  }
 
   return GST_BASE_TRANSFORM_CLASS (parent_class)->stop (trans);
 }
@@ -217,28 +427,142 @@ _init_scene (Gst3DScene * scene)
 {
   GstGLContext *context = scene->context;
   GstGLFuncs *gl = context->gl_vtable;
+
+  gl->ClearColor (0.f, 0.f, 0.f, 0.f);
+  gl->ActiveTexture (GL_TEXTURE0);
+}
+
+/* The sphere is owned by the element, so its mesh can follow the caps. The
+ * mesh itself is created on the first draw. */
+static gboolean
+_init_sphere (GstVRCompositor * self, GstGLContext * context)
+{
   GError *error = NULL;
-  Gst3DMesh *sphere_mesh;
-  Gst3DNode *sphere_node;
-  // ´´½¨×ÅÉ«Æ÷³ÌÐò
-  Gst3DShader *sphere_shader = gst_3d_shader_new_vert_frag (context, "mvp_uv.vert", "texture_uv.frag", &error);
-  if (sphere_shader == NULL) {
+
+  /* compiles in the background, the scene skips the sphere until it is
+   * linked. The sampler stays on its default unit 0. */
+  self->sphere_shader = gst_3d_shader_new (context);
+  if (!gst_3d_shader_from_vert_frag_async (self->sphere_shader,
+          "view_uv.vert", "texture_uv.frag", NULL, NULL, NULL, &error)) {
     GST_WARNING ("Failed to create VR compositor shaders. Error: %s", error->message);
     g_clear_error (&error);
-    return; /* FIXME: Add boolean return result */
+    gst_object_unref (self->sphere_shader);
+    self->sphere_shader = NULL;
+    return FALSE;
   }
 
-  sphere_mesh = gst_3d_mesh_new_sphere (context, 1.0, 100, 100);//球
-  // sphere_mesh = gst_3d_mesh_new_cube (context);//画立方体
-  // sphere_mesh = gst_3d_mesh_new_plane (context, 1.0);//平面
-  sphere_node = gst_3d_node_new_from_mesh_shader (context, sphere_mesh, sphere_shader);
-  gst_3d_scene_append_node (scene, sphere_node);
+  self->sphere_node = gst_3d_node_new (context);
+  self->sphere_node->shader = self->sphere_shader;
+  gst_3d_scene_append_node (self->scene, gst_object_ref (self->sphere_node));
 
-  gl->ClearColor (0.f, 0.f, 0.f, 0.f);
-  gl->ActiveTexture (GL_TEXTURE0);
+  self->current_sphere_lod = -1;
+  self->caps_change = TRUE;
+
+  return TRUE;
+}
+
+/* the lower of the eye and video densities, finer detail is not visible */
+static gfloat
+_sphere_pixels_per_radian (GstVRCompositor * self)
+{
+  GstGLFilter *filter = GST_GL_FILTER (self);
+  Gst3DCamera *camera = self->scene->camera;
+  gfloat fov = camera->fov * M_PI / 180.0;
+  guint eye_height = GST_VIDEO_INFO_HEIGHT (&filter->out_info);
+
+#ifdef HAVE_OPENHMD
+  if (GST_IS_3D_CAMERA_HMD (camera))
+    fov = GST_3D_CAMERA_HMD (camera)->hmd->left_fov;
+#endif
+  if (self->scene->renderer)
+    eye_height = self->scene->renderer->eye_height;
+
+  gfloat eye_density = eye_height / fov;
+  /* equirectangular video spans 2 pi horizontally */
+  gfloat video_density = GST_VIDEO_INFO_WIDTH (&filter->in_info) / (2 * M_PI);
+
+  return MIN (eye_density, video_density);
+}
+
+static void
+_init_lens (GstVRCompositor * self, Gst3DFisheyeLens * lens,
+    const gfloat center[2], gfloat default_x, gfloat aspect)
+{
+  lens->center[0] = center[0] < 0 ? default_x : center[0];
+  lens->center[1] = center[1] < 0 ? 0.5 : center[1];
+  lens->radius[0] = self->lens_radius * aspect;
+  lens->radius[1] = self->lens_radius;
+  lens->fov = self->lens_fov;
+}
+
+/* The level of detail also sets the tessellation of the other projections,
+ * matching the angular resolution of the sphere. */
+static Gst3DMesh *
+_create_projection_mesh (GstVRCompositor * self, GstGLContext * context,
+    gint level)
+{
+  GstGLFilter *filter = GST_GL_FILTER (self);
+  Gst3DFisheyeLens front, back;
+  Gst3DMesh *mesh;
+  guint stacks, slices;
+
+  if (self->projection == GST_3D_MESH_PROJECTION_EQUIRECTANGULAR)
+    return gst_3d_mesh_cache_get_sphere_lod (context, 1.0, level);
+
+  gst_3d_mesh_sphere_lod_get_size (level, &stacks, &slices);
+  mesh = gst_3d_mesh_new (context);
+
+  /* aspect of the frame, lens circles are round in pixels */
+  gfloat aspect = (gfloat) GST_VIDEO_INFO_HEIGHT (&filter->in_info) /
+      GST_VIDEO_INFO_WIDTH (&filter->in_info);
+
+  switch (self->projection) {
+    case GST_3D_MESH_PROJECTION_FISHEYE:
+      _init_lens (self, &front, self->front_lens, 0.5, aspect);
+      gst_3d_mesh_upload_fisheye (mesh, 1.0, slices / 2, stacks, &front, NULL);
+      break;
+    case GST_3D_MESH_PROJECTION_DUAL_FISHEYE:
+      _init_lens (self, &front, self->front_lens, 0.25, aspect);
+      _init_lens (self, &back, self->back_lens, 0.75, aspect);
+      gst_3d_mesh_upload_fisheye (mesh, 1.0, slices / 2, stacks, &front,
+          &back);
+      break;
+    case GST_3D_MESH_PROJECTION_EAC:
+    case GST_3D_MESH_PROJECTION_CUBEMAP:
+      gst_3d_mesh_upload_cubemap (mesh, 1.0, MAX (slices / 2, 2),
+          self->projection == GST_3D_MESH_PROJECTION_EAC);
+      break;
+    default:
+      g_assert_not_reached ();
+  }
 
-  gst_3d_shader_bind (sphere_shader);
-  gst_gl_shader_set_uniform_1i (sphere_shader->shader, "texture", 0);
+  return mesh;
+}
+
+static void
+_update_sphere_lod (GstVRCompositor * self, GstGLContext * context)
+{
+  gint level = self->sphere_lod;
+
+  if (level < 0)
+    level = gst_3d_mesh_sphere_lod_for_density (_sphere_pixels_per_radian
+        (self), GST_3D_MESH_SPHERE_LOD_TOLERANCE);
+
+  /* the other projections depend on the frame aspect */
+  if (level == self->current_sphere_lod
+      && self->projection == GST_3D_MESH_PROJECTION_EQUIRECTANGULAR)
+    return;
+
+  Gst3DMesh *mesh = _create_projection_mesh (self, context, level);
+  gst_3d_mesh_bind_shader (mesh, self->sphere_shader);
+
+  g_list_free_full (self->sphere_node->meshes, gst_object_unref);
+  self->sphere_node->meshes = g_list_append (NULL, mesh);
+  gst_3d_node_invalidate_bounds (self->sphere_node);
+
+  GST_DEBUG_OBJECT (self, "sphere level of detail %d with %d vertices", level,
+      mesh->vertex_count);
+  self->current_sphere_lod = level;
 }
 
 static gboolean
@@ -255,6 +579,9 @@ gst_vr_compositor_init_scene (GstGLFilter * filter)
 
   gst_3d_scene_init_gl (self->scene, context);
 
+  if (!self->sphere_node && !_init_sphere (self, context))
+    return FALSE;
+
   return TRUE;
 }
 
@@ -278,6 +605,21 @@ gst_vr_compositor_filter_texture (GstGLFilter * filter, GstGLMemory * in_tex, Gs
   return TRUE;
 }
 
+/* the frames have to be drawn within their duration */
+static void
+_update_dynamic_resolution (GstVRCompositor * self)
+{
+  GstVideoInfo *info = &GST_GL_FILTER (self)->out_info;
+  GstClockTime frame_budget = 0;
+
+  if (GST_VIDEO_INFO_FPS_N (info) > 0)
+    frame_budget = gst_util_uint64_scale_int (GST_SECOND,
+        GST_VIDEO_INFO_FPS_D (info), GST_VIDEO_INFO_FPS_N (info));
+
+  gst_3d_renderer_set_dynamic_resolution (self->scene->renderer,
+      self->dynamic_resolution, self->min_eye_scale, frame_budget);
+}
+
 static gboolean
 gst_vr_compositor_draw (gpointer this)
 {
@@ -285,7 +627,17 @@ gst_vr_compositor_draw (gpointer this)
   GstGLContext *context = GST_GL_BASE_FILTER (this)->context;
   GstGLFuncs *gl = context->gl_vtable;
 
-  gl->BindTexture (GL_TEXTURE_2D, self->in_tex->tex_id);
+  if (self->caps_change) {
+    _update_sphere_lod (self, context);
+    self->caps_change = FALSE;
+  }
+
+  if (self->resolution_change && self->scene->renderer) {
+    _update_dynamic_resolution (self);
+    self->resolution_change = FALSE;
+  }
+
+  self->sphere_node->texture = self->in_tex->tex_id;
   gl->Clear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   gst_3d_scene_draw (self->scene);
 
@@ -51,6 +51,26 @@ struct _GstVRCompositor
   gboolean caps_change;
 
   Gst3DScene *scene;
+
+  Gst3DNode *sphere_node;
+  Gst3DShader *sphere_shader;
+  /* level of the sphere mesh, -1 picks it from the eye and video size */
+  gint sphere_lod;
+  gint current_sphere_lod;
+
+  Gst3DMeshProjection projection;
+  /* lens centers in texture coordinates, negative values center the lens
+   * in its half of the frame */
+  gfloat front_lens[2];
+  gfloat back_lens[2];
+  /* fraction of the frame height */
+  gfloat lens_radius;
+  gfloat lens_fov;
+
+  /* eye resolution follows the GPU time, see Gst3DRenderer */
+  gboolean dynamic_resolution;
+  gfloat min_eye_scale;
+  gboolean resolution_change;
 };
 
 struct _GstVRCompositorClass
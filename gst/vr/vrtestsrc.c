@@ -67,9 +67,10 @@ _init_scene (Gst3DScene * scene)
   axes_node = gst_3d_node_new_debug_axes (context);
   gst_3d_scene_append_node (scene, axes_node);
 
-  Gst3DMesh *sphere_mesh = gst_3d_mesh_new_sphere (context, 0.5, 100, 100);
+  Gst3DMesh *sphere_mesh = gst_3d_mesh_cache_get_sphere (context, 0.5, 100, 100);
   Gst3DNode *sphere_node =
       gst_3d_node_new_from_mesh_shader (context, sphere_mesh, uv_shader);
+  gst_object_unref (sphere_mesh);
 
   gst_3d_scene_append_node (scene, sphere_node);
   /*
@@ -38,11 +38,11 @@ draw_render (gpointer data)
 
   gl->Clear (GL_COLOR_BUFFER_BIT);
 
-  gst_gl_shader_use (shader->shader);
+  gst_3d_shader_bind (shader);
 
   gl->ActiveTexture (GL_TEXTURE0);
   gl->BindTexture (GL_TEXTURE_2D, tex_id);
-  gst_gl_shader_set_uniform_1i (shader->shader, "s_texture", 0);
+  gst_3d_shader_upload_1i (shader, "s_texture", 0);
 
   gst_3d_mesh_bind (mesh);
   gst_3d_mesh_draw (mesh);
@@ -64,7 +64,7 @@ init (gpointer data)
   }
 
   mesh = gst_3d_mesh_new_sphere (context, 0.5, 100, 100);
-  gst_gl_shader_use (shader->shader);
+  gst_3d_shader_bind (shader);
   gst_3d_mesh_bind_shader (mesh, shader);
 
   g_assert_false (shader == NULL);
@@ -0,0 +1,100 @@
+#include <glib.h>
+#include <string.h>
+
+#define GST_USE_UNSTABLE_API 1
+#include <gst/gl/gl.h>
+
+#include "../../gst-libs/gst/3d/gst3dmeshbatch.h"
+
+/* a quad of two triangles at height z */
+static Gst3DMeshData *
+create_quad (gfloat z)
+{
+  Gst3DVertexLayout layout;
+  const gfloat positions[] = {
+    0, 0, z, 1, 0, z, 1, 1, z, 0, 1, z,
+  };
+  const guint32 indices[] = { 0, 1, 2, 0, 2, 3 };
+
+  gst_3d_vertex_layout_init (&layout);
+  gst_3d_vertex_layout_add (&layout, "position", 3, GL_FLOAT, GL_FALSE);
+
+  Gst3DMeshData *data = gst_3d_mesh_data_new (&layout, 4, 6, GL_TRIANGLES);
+  memcpy (data->vertices, positions, sizeof (positions));
+  memcpy (data->indices, indices, sizeof (indices));
+  graphene_vec4_init (&data->diffuse_color, z, z, z, 1.f);
+  return data;
+}
+
+static void
+test_mesh_batch ()
+{
+  Gst3DMeshData *quads[] = { create_quad (0), create_quad (1), create_quad (2) };
+  Gst3DMeshData *batch = gst_3d_mesh_data_batch (quads, 3);
+
+  g_assert_cmpuint (batch->vertex_count, ==, 12);
+  g_assert_cmpuint (batch->index_count, ==, 18);
+  g_assert_cmpuint (batch->parts->len, ==, 3);
+
+  /* every part draws the triangles of its source mesh */
+  for (guint i = 0; i < 3; i++) {
+    Gst3DMeshPart *part = &g_array_index (batch->parts, Gst3DMeshPart, i);
+    g_assert_cmpuint (part->first_index, ==, i * 6);
+    g_assert_cmpuint (part->index_count, ==, 6);
+    g_assert_cmpfloat (graphene_vec4_get_x (&part->diffuse_color), ==, i);
+
+    for (guint j = 0; j < part->index_count; j++) {
+      guint32 index = batch->indices[part->first_index + j];
+      const gfloat *position =
+          (const gfloat *) (batch->vertices + index * batch->layout.stride);
+      g_assert_cmpfloat (position[2], ==, i);
+      g_assert (memcmp (position, quads[i]->vertices +
+              quads[i]->indices[j] * quads[i]->layout.stride,
+              3 * sizeof (gfloat)) == 0);
+    }
+  }
+
+  gst_3d_mesh_data_free (batch);
+  for (guint i = 0; i < 3; i++)
+    gst_3d_mesh_data_free (quads[i]);
+}
+
+static void
+test_mesh_batch_all ()
+{
+  GPtrArray *meshes = g_ptr_array_new ();
+  Gst3DMeshData *lines;
+  graphene_vec3_t from, to;
+
+  graphene_vec3_init (&from, 0.f, 0.f, 0.f);
+  graphene_vec3_init (&to, 1.f, 0.f, 0.f);
+  lines = gst_3d_mesh_data_new_line (&from, &to, &to);
+
+  g_ptr_array_add (meshes, create_quad (0));
+  g_ptr_array_add (meshes, lines);
+  g_ptr_array_add (meshes, create_quad (1));
+  g_ptr_array_add (meshes, create_quad (2));
+
+  GPtrArray *batches = gst_3d_mesh_data_batch_all (meshes);
+
+  /* the lines have another layout and draw mode */
+  g_assert_cmpuint (batches->len, ==, 2);
+  Gst3DMeshData *quads = g_ptr_array_index (batches, 0);
+  g_assert_cmpuint (quads->parts->len, ==, 3);
+  g_assert_cmpuint (quads->vertex_count, ==, 12);
+  g_assert (g_ptr_array_index (batches, 1) == lines);
+  g_assert (lines->parts == NULL);
+
+  g_ptr_array_unref (batches);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/gst3d/mesh/batch", test_mesh_batch);
+  g_test_add_func ("/gst3d/mesh/batch-all", test_mesh_batch_all);
+
+  return g_test_run ();
+}
@@ -0,0 +1,165 @@
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GST_USE_UNSTABLE_API 1
+#include <gst/gl/gl.h>
+
+#include "../../gst-libs/gst/3d/gst3dmeshoptimize.h"
+
+#define GRID 200
+
+/* a flat grid with its triangles shuffled, the worst case for the cache */
+static Gst3DMeshData *
+create_shuffled_grid (void)
+{
+  Gst3DVertexLayout layout;
+  guint vertex_count = (GRID + 1) * (GRID + 1);
+  guint triangle_count = GRID * GRID * 2;
+
+  gst_3d_vertex_layout_init (&layout);
+  gst_3d_vertex_layout_add (&layout, "position", 3, GL_FLOAT, GL_FALSE);
+
+  Gst3DMeshData *data = gst_3d_mesh_data_new (&layout, vertex_count,
+      triangle_count * 3, GL_TRIANGLES);
+
+  gfloat *p = (gfloat *) data->vertices;
+  for (guint i = 0; i <= GRID; i++) {
+    for (guint j = 0; j <= GRID; j++) {
+      *p++ = j;
+      *p++ = i;
+      *p++ = 0;
+    }
+  }
+
+  guint32 *index = data->indices;
+  for (guint i = 0; i < GRID; i++) {
+    for (guint j = 0; j < GRID; j++) {
+      guint32 a = i * (GRID + 1) + j;
+      guint32 b = a + GRID + 1;
+      guint32 quad[] = { a, b, a + 1, a + 1, b, b + 1 };
+      memcpy (index, quad, sizeof (quad));
+      index += 6;
+    }
+  }
+
+  GRand *rand = g_rand_new_with_seed (42);
+  for (guint t = triangle_count - 1; t > 0; t--) {
+    guint r = g_rand_int_range (rand, 0, t + 1);
+    guint32 tmp[3];
+    memcpy (tmp, &data->indices[t * 3], sizeof (tmp));
+    memcpy (&data->indices[t * 3], &data->indices[r * 3], sizeof (tmp));
+    memcpy (&data->indices[r * 3], tmp, sizeof (tmp));
+  }
+  g_rand_free (rand);
+
+  return data;
+}
+
+/* triangles as sorted tuples of positions, independent of the order of
+ * vertices, triangles and the first vertex of each triangle */
+static gint
+compare_triangles (gconstpointer a, gconstpointer b)
+{
+  return memcmp (a, b, 9 * sizeof (gfloat));
+}
+
+static gint
+compare_positions (const gfloat * a, const gfloat * b)
+{
+  for (guint c = 0; c < 3; c++)
+    if (a[c] != b[c])
+      return a[c] < b[c] ? -1 : 1;
+  return 0;
+}
+
+static const gfloat *
+vertex_position (const Gst3DMeshData * data, guint32 v)
+{
+  return (const gfloat *) (data->vertices + v * data->layout.stride);
+}
+
+static gfloat *
+triangle_positions (const Gst3DMeshData * data)
+{
+  guint triangle_count = data->index_count / 3;
+  gfloat *triangles = g_new (gfloat, triangle_count * 9);
+
+  for (guint t = 0; t < triangle_count; t++) {
+    const guint32 *tri = &data->indices[t * 3];
+    guint first = 0;
+    /* by position, the indices change when the vertices are reordered */
+    for (guint k = 1; k < 3; k++)
+      if (compare_positions (vertex_position (data, tri[k]),
+              vertex_position (data, tri[first])) < 0)
+        first = k;
+    /* rotate to a canonical start, keeping the winding */
+    for (guint k = 0; k < 3; k++) {
+      memcpy (&triangles[t * 9 + k * 3],
+          vertex_position (data, tri[(first + k) % 3]), 3 * sizeof (gfloat));
+    }
+  }
+
+  qsort (triangles, triangle_count, 9 * sizeof (gfloat), compare_triangles);
+  return triangles;
+}
+
+static void
+test_mesh_optimize ()
+{
+  Gst3DMeshData *data = create_shuffled_grid ();
+  guint index_count = data->index_count;
+
+  gfloat before = gst_3d_mesh_compute_acmr (data->indices, index_count,
+      data->vertex_count, GST_3D_MESH_OPTIMIZE_CACHE_SIZE);
+
+  gst_3d_mesh_optimize_vertex_cache (data->indices, index_count,
+      data->vertex_count);
+  gfloat cache = gst_3d_mesh_compute_acmr (data->indices, index_count,
+      data->vertex_count, GST_3D_MESH_OPTIMIZE_CACHE_SIZE);
+
+  Gst3DMeshData *optimized = create_shuffled_grid ();
+  gfloat *expected = triangle_positions (optimized);
+  gint64 start = g_get_monotonic_time ();
+  gst_3d_mesh_data_optimize (optimized,
+      GST_3D_MESH_OPTIMIZE_OVERDRAW_THRESHOLD);
+  gdouble ms = (g_get_monotonic_time () - start) / 1000.0;
+  gfloat after = gst_3d_mesh_compute_acmr (optimized->indices, index_count,
+      optimized->vertex_count, GST_3D_MESH_OPTIMIZE_CACHE_SIZE);
+
+  g_print ("%u triangles ACMR: shuffled %.3f, vertex cache %.3f, "
+      "with overdraw and fetch %.3f (%.1f ms)\n", index_count / 3, before,
+      cache, after, ms);
+
+  g_assert_cmpfloat (before, >, 2.5);
+  g_assert_cmpfloat (cache, <, 0.8);
+  g_assert_cmpfloat (after, <=, cache * GST_3D_MESH_OPTIMIZE_OVERDRAW_THRESHOLD);
+
+  /* same triangles, and vertices in order of first use */
+  gfloat *triangles = triangle_positions (optimized);
+  g_assert (memcmp (expected, triangles,
+          index_count * 3 * sizeof (gfloat)) == 0);
+  g_assert_cmpuint (optimized->vertex_count, ==, data->vertex_count);
+
+  guint32 next = 0;
+  for (guint i = 0; i < index_count; i++) {
+    g_assert_cmpuint (optimized->indices[i], <=, next);
+    if (optimized->indices[i] == next)
+      next++;
+  }
+
+  g_free (triangles);
+  g_free (expected);
+  gst_3d_mesh_data_free (optimized);
+  gst_3d_mesh_data_free (data);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/gst3d/mesh/optimize", test_mesh_optimize);
+
+  return g_test_run ();
+}
@@ -0,0 +1,132 @@
+#include <glib.h>
+
+#define GST_USE_UNSTABLE_API 1
+#include <gst/gl/gl.h>
+#include <gst/gl/gstglcontext.h>
+
+#include "../../gst-libs/gst/3d/gst3doctree.h"
+
+#define CLOUD_SIZE (16 * 16 * 4)
+
+static GstGLContext *context = NULL;
+
+/* one point in the center of each cell of the four lowest layers of the
+ * root grid, all in the lower half of the unit cube */
+static Gst3DOctreePoint *
+create_cloud (void)
+{
+  Gst3DOctreePoint *points = g_new0 (Gst3DOctreePoint, CLOUD_SIZE);
+  Gst3DOctreePoint *p = points;
+
+  for (guint z = 0; z < 4; z++)
+    for (guint y = 0; y < 16; y++)
+      for (guint x = 0; x < 16; x++) {
+        p->position[0] = (x + 0.5f) / 16;
+        p->position[1] = (y + 0.5f) / 16;
+        p->position[2] = (z + 0.5f) / 16;
+        p++;
+      }
+
+  return points;
+}
+
+/* looks at the cube from 3 units in front of it, so all nodes are visible */
+static void
+init_mvp (graphene_matrix_t * mvp)
+{
+  graphene_matrix_t view, projection;
+  graphene_point3d_t eye;
+
+  graphene_matrix_init_translate (&view,
+      graphene_point3d_init (&eye, -0.5f, -0.5f, -3.0f));
+  graphene_matrix_init_perspective (&projection, 90.f, 1.f, 0.1f, 100.f);
+  graphene_matrix_multiply (&view, &projection, mvp);
+}
+
+static void
+octree_insert_draw (gpointer data)
+{
+  const GstGLFuncs *gl = context->gl_vtable;
+  Gst3DOctreePoint *cloud = create_cloud ();
+  graphene_point3d_t min, max;
+  graphene_box_t bounds;
+  graphene_matrix_t mvp;
+
+  graphene_box_init (&bounds, graphene_point3d_init (&min, 0, 0, 0),
+      graphene_point3d_init (&max, 1, 1, 1));
+  Gst3DOctree *octree = gst_3d_octree_new (context, &bounds, 1);
+
+  /* the first copy fills the root grid, the second goes to the children
+   * and the third does not fit below the maximum depth */
+  g_assert_cmpuint (gst_3d_octree_insert_points (octree, cloud, CLOUD_SIZE),
+      ==, CLOUD_SIZE);
+  g_assert_cmpuint (gst_3d_octree_insert_points (octree, cloud, CLOUD_SIZE),
+      ==, CLOUD_SIZE);
+  g_assert_cmpuint (gst_3d_octree_insert_points (octree, cloud, CLOUD_SIZE),
+      ==, 0);
+  g_assert_cmpuint (octree->dropped_points, ==, CLOUD_SIZE);
+
+  /* the cloud spans the lower four octants */
+  g_assert_cmpuint (octree->nodes->len, ==, 5);
+  for (guint i = 1; i < octree->nodes->len; i++) {
+    Gst3DOctreeNode *node = &g_array_index (octree->nodes, Gst3DOctreeNode, i);
+    g_assert_cmpuint (node->depth, ==, 1);
+    g_assert_cmpuint (node->points->len, ==, CLOUD_SIZE / 4);
+    for (guint c = 0; c < 8; c++)
+      g_assert_cmpint (node->children[c], ==, -1);
+  }
+
+  init_mvp (&mvp);
+  gl->Viewport (0, 0, 100, 100);
+
+  /* coarse enough at the root */
+  gst_3d_octree_set_lod (octree, G_MAXFLOAT, G_MAXUINT);
+  gst_3d_octree_draw (octree, &mvp);
+  g_assert_cmpuint (octree->drawn_nodes, ==, 1);
+  g_assert_cmpuint (octree->drawn_points, ==, CLOUD_SIZE);
+
+  /* refined to the leaves */
+  gst_3d_octree_set_lod (octree, 0.f, G_MAXUINT);
+  gst_3d_octree_draw (octree, &mvp);
+  g_assert_cmpuint (octree->drawn_nodes, ==, 5);
+  g_assert_cmpuint (octree->drawn_points, ==, 2 * CLOUD_SIZE);
+
+  /* the budget stops before the third leaf */
+  gst_3d_octree_set_lod (octree, 0.f, CLOUD_SIZE + CLOUD_SIZE / 2);
+  gst_3d_octree_draw (octree, &mvp);
+  g_assert_cmpuint (octree->drawn_nodes, ==, 3);
+  g_assert_cmpuint (octree->drawn_points, ==, CLOUD_SIZE + CLOUD_SIZE / 2);
+
+  gst_object_unref (octree);
+  g_free (cloud);
+}
+
+static void
+test_octree ()
+{
+  GError *error = NULL;
+  gst_init (NULL, NULL);
+
+  GstGLDisplay *display = gst_gl_display_new ();
+  context = gst_gl_context_new (display);
+  gst_gl_context_create (context, 0, &error);
+  g_assert_no_error (error);
+
+  GstGLWindow *window = gst_gl_context_get_window (context);
+  gst_gl_window_send_message (window, GST_GL_WINDOW_CB (octree_insert_draw),
+      context);
+
+  gst_object_unref (window);
+  gst_object_unref (context);
+  gst_object_unref (display);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/gst3d/octree/insert-draw", test_octree);
+
+  return g_test_run ();
+}
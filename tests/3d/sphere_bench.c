@@ -0,0 +1,96 @@
+#include <glib.h>
+#include <math.h>
+
+#define GST_USE_UNSTABLE_API 1
+#include "../../gst-libs/gst/3d/gst3dmesh.h"
+
+#define ITERATIONS 10
+
+static const guint sizes[][2] = {
+  {100, 100},
+  {256, 128},
+  {512, 256},
+  {1024, 512},
+  {2048, 1024},
+};
+
+/* the generator before the tables, as reference and baseline */
+static void
+generate_sphere_reference (Gst3DSphereVertex * v, float radius,
+    guint stacks, guint slices)
+{
+  float const J = 1. / (float) (stacks - 1);
+  float const I = 1. / (float) (slices - 1);
+
+  for (guint i = 0; i < slices; i++) {
+    float const theta = M_PI * i * I;
+    for (guint j = 0; j < stacks; j++) {
+      float const phi = 2 * M_PI * j * J + M_PI / 2.0;
+
+      v->position[0] = sin (theta) * cos (phi) * radius;
+      v->position[1] = -cos (theta) * radius;
+      v->position[2] = sin (phi) * sin (theta) * radius;
+      v->uv[0] = j * J;
+      v->uv[1] = i * I;
+      v++;
+    }
+  }
+}
+
+static gdouble
+time_generator (void (*generate) (Gst3DSphereVertex *, float, guint, guint),
+    Gst3DSphereVertex * vertices, guint stacks, guint slices)
+{
+  gint64 start = g_get_monotonic_time ();
+
+  for (guint i = 0; i < ITERATIONS; i++)
+    generate (vertices, 1.0, stacks, slices);
+
+  return (g_get_monotonic_time () - start) / (1000.0 * ITERATIONS);
+}
+
+static void
+test_sphere_generate ()
+{
+  for (guint s = 0; s < G_N_ELEMENTS (sizes); s++) {
+    guint stacks = sizes[s][0];
+    guint slices = sizes[s][1];
+    guint count = stacks * slices;
+    Gst3DSphereVertex *expected = g_new (Gst3DSphereVertex, count);
+    Gst3DSphereVertex *vertices = g_new (Gst3DSphereVertex, count);
+
+    generate_sphere_reference (expected, 1.0, stacks, slices);
+    gst_3d_mesh_generate_sphere (vertices, 1.0, stacks, slices);
+
+    for (guint i = 0; i < count; i++) {
+      for (guint c = 0; c < 3; c++)
+        g_assert_cmpfloat (fabs (vertices[i].position[c] -
+                expected[i].position[c]), <, 1e-5);
+      for (guint c = 0; c < 2; c++)
+        g_assert_cmpfloat (fabs (vertices[i].uv[c] - expected[i].uv[c]), <,
+            1e-5);
+    }
+
+    gdouble reference_ms =
+        time_generator (generate_sphere_reference, expected, stacks, slices);
+    gdouble table_ms =
+        time_generator (gst_3d_mesh_generate_sphere, vertices, stacks, slices);
+
+    g_print ("sphere %4ux%-4u %8u vertices: reference %8.3f ms, "
+        "tables %8.3f ms (%.1fx)\n", stacks, slices, count, reference_ms,
+        table_ms, reference_ms / table_ms);
+
+    g_free (expected);
+    g_free (vertices);
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/gst3d/sphere/generate", test_sphere_generate);
+
+  return g_test_run ();
+}
@@ -0,0 +1,174 @@
+#include <glib.h>
+
+#define GST_USE_UNSTABLE_API 1
+#include <gst/gl/gl.h>
+#include <gst/gl/gstglcontext.h>
+
+#include "../../gst-libs/gst/3d/gst3dscene.h"
+#include "../../gst-libs/gst/3d/gst3dcamera_arcball.h"
+#include "../../gst-libs/gst/3d/gst3dmesh.h"
+#include "../../gst-libs/gst/3d/gst3dnode.h"
+
+#define WARMUP 10
+#define FRAMES 200
+
+static const struct
+{
+  const gchar *name;
+  gboolean single_pass;
+  gboolean direct;
+} modes[] = {
+  {"eye framebuffers", FALSE, FALSE},
+  {"eye framebuffers, single pass", TRUE, FALSE},
+  {"direct", FALSE, TRUE},
+  {"direct, single pass", TRUE, TRUE},
+};
+
+static GstGLContext *context = NULL;
+static Gst3DScene *scene = NULL;
+static GLuint output_fbo, output_tex, output_depth;
+
+static void
+_init_scene (Gst3DScene * scene)
+{
+  GError *error = NULL;
+  Gst3DShader *shader = gst_3d_shader_new_vert_frag (scene->context,
+      "view_uv.vert", "debug_uv.frag", &error);
+  g_assert_no_error (error);
+
+  gst_3d_scene_append_node (scene,
+      gst_3d_node_new_debug_axes (scene->context));
+
+  Gst3DMesh *sphere = gst_3d_mesh_cache_get_sphere (scene->context, 0.5, 100,
+      100);
+  gst_3d_scene_append_node (scene,
+      gst_3d_node_new_from_mesh_shader (scene->context, sphere, shader));
+  gst_object_unref (sphere);
+}
+
+/* an output like the one of a GstGLFilter, with both eyes side by side */
+static void
+init (gpointer data)
+{
+  const GstGLFuncs *gl = context->gl_vtable;
+
+  Gst3DCamera *camera = GST_3D_CAMERA (gst_3d_camera_arcball_new ());
+  scene = gst_3d_scene_new (camera, _init_scene);
+  gst_3d_scene_init_gl (scene, context);
+
+  guint width = scene->renderer->eye_width * 2;
+  guint height = scene->renderer->eye_height;
+
+  gl->GenTextures (1, &output_tex);
+  gl->BindTexture (GL_TEXTURE_2D, output_tex);
+  gl->TexImage2D (GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+      GL_UNSIGNED_BYTE, NULL);
+
+  gl->GenRenderbuffers (1, &output_depth);
+  gl->BindRenderbuffer (GL_RENDERBUFFER, output_depth);
+  gl->RenderbufferStorage (GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width,
+      height);
+
+  gl->GenFramebuffers (1, &output_fbo);
+  gl->BindFramebuffer (GL_FRAMEBUFFER, output_fbo);
+  gl->FramebufferTexture2D (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      GL_TEXTURE_2D, output_tex, 0);
+  gl->FramebufferRenderbuffer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+      GL_RENDERBUFFER, output_depth);
+  g_assert_cmpuint (gl->CheckFramebufferStatus (GL_FRAMEBUFFER), ==,
+      GL_FRAMEBUFFER_COMPLETE);
+  gl->Enable (GL_DEPTH_TEST);
+}
+
+static void
+draw_frame (void)
+{
+  const GstGLFuncs *gl = context->gl_vtable;
+
+  gl->BindFramebuffer (GL_FRAMEBUFFER, output_fbo);
+  gl->Viewport (0, 0, scene->renderer->eye_width * 2,
+      scene->renderer->eye_height);
+  gst_3d_scene_draw (scene);
+}
+
+static void
+bench (gpointer data)
+{
+  const GstGLFuncs *gl = context->gl_vtable;
+  Gst3DRenderer *renderer = scene->renderer;
+  gdouble baseline_ms = 0;
+
+  for (guint m = 0; m < G_N_ELEMENTS (modes); m++) {
+    if (gst_3d_renderer_set_single_pass (renderer,
+            modes[m].single_pass) != modes[m].single_pass) {
+      g_print ("%-30s unsupported\n", modes[m].name);
+      continue;
+    }
+    gst_3d_renderer_set_direct (renderer, modes[m].direct);
+
+    for (guint i = 0; i < WARMUP; i++)
+      draw_frame ();
+    gl->Finish ();
+    g_assert (renderer->direct == modes[m].direct);
+
+    gint64 start = g_get_monotonic_time ();
+    for (guint i = 0; i < FRAMES; i++)
+      draw_frame ();
+    gl->Finish ();
+    gdouble frame_ms = (g_get_monotonic_time () - start) / (1000.0 * FRAMES);
+
+    if (m == 0)
+      baseline_ms = frame_ms;
+    g_print ("%-30s %ux%u: %8.3f ms per frame (%.2fx)\n", modes[m].name,
+        renderer->eye_width * 2, renderer->eye_height, frame_ms,
+        baseline_ms / frame_ms);
+  }
+}
+
+static void
+deinit (gpointer data)
+{
+  const GstGLFuncs *gl = context->gl_vtable;
+
+  gl->DeleteFramebuffers (1, &output_fbo);
+  gl->DeleteRenderbuffers (1, &output_depth);
+  gl->DeleteTextures (1, &output_tex);
+  gst_object_unref (scene);
+}
+
+static void
+test_stereo_draw ()
+{
+#ifdef HAVE_OPENHMD
+  /* the renderer draws stereo for the HMD camera only */
+  g_test_skip ("needs a HMD");
+  return;
+#endif
+  GError *error = NULL;
+  gst_init (NULL, NULL);
+
+  GstGLDisplay *display = gst_gl_display_new ();
+  context = gst_gl_context_new (display);
+  gst_gl_context_create (context, 0, &error);
+  g_assert_no_error (error);
+
+  GstGLWindow *window = gst_gl_context_get_window (context);
+
+  gst_gl_window_send_message (window, GST_GL_WINDOW_CB (init), context);
+  gst_gl_window_send_message (window, GST_GL_WINDOW_CB (bench), context);
+  gst_gl_window_send_message (window, GST_GL_WINDOW_CB (deinit), context);
+
+  gst_object_unref (window);
+  gst_object_unref (context);
+  gst_object_unref (display);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/gst3d/stereo/draw", test_stereo_draw);
+
+  return g_test_run ();
+}
@@ -0,0 +1,225 @@
+/* GStreamer
+ *
+ * Copyright (C) 2016 Lubosz Sarnecki <lubosz.sarnecki@collabora.co.uk>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:gst-3d-bake
+ * @short_description: Converts models to prebaked mesh files
+ *
+ * Imports a model with assimp and writes it as a mesh file that
+ * gst_3d_mesh_file_open() maps without parsing.
+ *
+ * gst-3d-bake-1.0 --lods 4 model.obj model.g3dm
+ */
+
+#include <string.h>
+#include <math.h>
+
+#define GST_USE_UNSTABLE_API
+#include <gst/gst.h>
+#include <gst/gl/gl.h>
+
+#include "gst/3d/gst3dloader.h"
+#include "gst/3d/gst3dmeshfile.h"
+#include "gst/3d/gst3dmeshoptimize.h"
+
+/* grid resolution of the first simplified level, halved for every level */
+#define CLUSTER_GRID 256
+/* stop adding levels that remove less than this fraction of triangles */
+#define MIN_REDUCTION 0.1
+#define MIN_TRIANGLES 64
+
+typedef struct
+{
+  gint x, y, z;
+} Cell;
+
+static guint
+_cell_hash (gconstpointer key)
+{
+  const Cell *c = key;
+  return (guint) (c->x * 73856093) ^ (guint) (c->y * 19349663) ^
+      (guint) (c->z * 83492791);
+}
+
+static gboolean
+_cell_equal (gconstpointer a, gconstpointer b)
+{
+  return memcmp (a, b, sizeof (Cell)) == 0;
+}
+
+/* Simplifies by vertex clustering: all vertices in a grid cell collapse to
+ * the first one found, triangles that become degenerate are dropped. The
+ * new levels only reference existing vertices, so they are appended to the
+ * index buffer as ranges. */
+static void
+_generate_lods (Gst3DMeshData * data, guint n_lods)
+{
+  const Gst3DVertexAttribute *position =
+      gst_3d_vertex_layout_find (&data->layout, "position");
+
+  if (data->draw_mode != GL_TRIANGLES || !position
+      || position->type != GL_FLOAT || data->vertex_count == 0)
+    return;
+
+  graphene_vec3_t min, max;
+  graphene_vec3_init (&min, G_MAXFLOAT, G_MAXFLOAT, G_MAXFLOAT);
+  graphene_vec3_init (&max, -G_MAXFLOAT, -G_MAXFLOAT, -G_MAXFLOAT);
+  for (guint i = 0; i < data->vertex_count; i++) {
+    const GLfloat *p = (const GLfloat *) (data->vertices +
+        i * data->layout.stride + position->offset);
+    graphene_vec3_t v;
+    graphene_vec3_init (&v, p[0], p[1], p[2]);
+    graphene_vec3_min (&min, &v, &min);
+    graphene_vec3_max (&max, &v, &max);
+  }
+
+  graphene_vec3_t extent;
+  graphene_vec3_subtract (&max, &min, &extent);
+  gfloat size = MAX (graphene_vec3_get_x (&extent),
+      MAX (graphene_vec3_get_y (&extent), graphene_vec3_get_z (&extent)));
+  if (size <= 0.f)
+    return;
+
+  GArray *lods = g_array_new (FALSE, FALSE, sizeof (Gst3DMeshLod));
+  GArray *indices = g_array_sized_new (FALSE, FALSE, sizeof (guint32),
+      data->index_count * 2);
+  g_array_append_vals (indices, data->indices, data->index_count);
+
+  Gst3DMeshLod base = { 0, data->index_count, 0.f };
+  g_array_append_val (lods, base);
+
+  guint32 *remap = g_new (guint32, data->vertex_count);
+  guint grid = CLUSTER_GRID;
+
+  for (guint level = 1; level < n_lods && grid > 1; level++, grid /= 2) {
+    gfloat cell_size = size / grid;
+    GHashTable *cells = g_hash_table_new_full (_cell_hash, _cell_equal,
+        g_free, NULL);
+    const Gst3DMeshLod *previous =
+        &g_array_index (lods, Gst3DMeshLod, lods->len - 1);
+
+    for (guint i = 0; i < data->vertex_count; i++) {
+      const GLfloat *p = (const GLfloat *) (data->vertices +
+          i * data->layout.stride + position->offset);
+      Cell cell = {
+        (gint) floorf ((p[0] - graphene_vec3_get_x (&min)) / cell_size),
+        (gint) floorf ((p[1] - graphene_vec3_get_y (&min)) / cell_size),
+        (gint) floorf ((p[2] - graphene_vec3_get_z (&min)) / cell_size)
+      };
+      gpointer representative;
+
+      if (g_hash_table_lookup_extended (cells, &cell, NULL, &representative)) {
+        remap[i] = GPOINTER_TO_UINT (representative);
+      } else {
+        Cell *key = g_new (Cell, 1);
+        *key = cell;
+        remap[i] = i;
+        g_hash_table_insert (cells, key, GUINT_TO_POINTER (i));
+      }
+    }
+    g_hash_table_unref (cells);
+
+    Gst3DMeshLod lod = { indices->len, 0, cell_size * sqrtf (3.f) };
+    for (guint t = 0; t + 2 < data->index_count; t += 3) {
+      guint32 a = remap[data->indices[t]];
+      guint32 b = remap[data->indices[t + 1]];
+      guint32 c = remap[data->indices[t + 2]];
+      if (a == b || b == c || a == c)
+        continue;
+      g_array_append_val (indices, a);
+      g_array_append_val (indices, b);
+      g_array_append_val (indices, c);
+      lod.index_count += 3;
+    }
+
+    if (lod.index_count / 3 < MIN_TRIANGLES
+        || lod.index_count > previous->index_count * (1.0 - MIN_REDUCTION)) {
+      g_array_set_size (indices, lod.first_index);
+      if (lod.index_count / 3 < MIN_TRIANGLES)
+        break;
+      continue;
+    }
+
+    g_print ("  level %d: %d triangles, error %f\n", lods->len,
+        lod.index_count / 3, lod.error);
+    g_array_append_val (lods, lod);
+  }
+
+  g_free (remap);
+
+  g_free (data->indices);
+  data->index_count = indices->len;
+  data->indices = (guint32 *) g_array_free (indices, FALSE);
+  if (data->lods)
+    g_array_unref (data->lods);
+  data->lods = lods;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GError *error = NULL;
+  gint n_lods = 4;
+  GOptionEntry entries[] = {
+    {"lods", 'l', 0, G_OPTION_ARG_INT, &n_lods,
+        "Number of levels of detail, including the full mesh", "N"},
+    {NULL}
+  };
+  GOptionContext *ctx = g_option_context_new ("INPUT OUTPUT");
+
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &error)) {
+    g_printerr ("%s\n", error->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (argc != 3) {
+    g_printerr ("usage: %s [--lods N] INPUT OUTPUT\n", argv[0]);
+    return 1;
+  }
+
+  n_lods = CLAMP (n_lods, 1, GST_3D_MESH_FILE_MAX_LODS);
+
+  GPtrArray *meshes = gst_3d_loader_import (argv[1], &error);
+  if (!meshes) {
+    g_printerr ("%s\n", error->message);
+    return 1;
+  }
+
+  for (guint i = 0; i < meshes->len; i++) {
+    Gst3DMeshData *data = g_ptr_array_index (meshes, i);
+    g_print ("mesh %d: %d vertices, %d indices\n", i, data->vertex_count,
+        data->index_count);
+    _generate_lods (data, n_lods);
+    /* the simplified levels come out in cluster order */
+    gst_3d_mesh_data_optimize (data, GST_3D_MESH_OPTIMIZE_OVERDRAW_THRESHOLD);
+  }
+
+  if (!gst_3d_mesh_file_save (argv[2], meshes, &error)) {
+    g_printerr ("%s\n", error->message);
+    g_ptr_array_unref (meshes);
+    return 1;
+  }
+
+  g_ptr_array_unref (meshes);
+  return 0;
+}